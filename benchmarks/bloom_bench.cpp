@@ -0,0 +1,123 @@
+/*
+ * Microbenchmark comparing the insert and lookup throughput, and the
+ * measured false positive rate, of the blocked bloom filter used for
+ * the tombstone and key filters against psudb::BloomFilter, across a
+ * range of target false positive rates.
+ */
+
+#define ENABLE_TIMER
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "psu-ds/BloomFilter.h"
+#include "util/BlockedBloomFilter.h"
+#include "util/bf_config.h"
+
+#include "psu-util/timer.h"
+
+template <typename F>
+static void run(const char *name, double fpr, std::vector<uint64_t> &keys,
+                std::vector<uint64_t> &absent) {
+    F filter(fpr, keys.size(), de::BF_HASH_FUNCS);
+
+    TIMER_INIT();
+    TIMER_START();
+    for (auto key : keys) {
+        filter.insert(key);
+    }
+    TIMER_STOP();
+    auto insert_latency = TIMER_RESULT();
+
+    size_t hits = 0;
+    TIMER_START();
+    for (auto key : keys) {
+        hits += filter.lookup(key);
+    }
+    TIMER_STOP();
+    auto lookup_latency = TIMER_RESULT();
+
+    size_t false_positives = 0;
+    TIMER_START();
+    for (auto key : absent) {
+        false_positives += filter.lookup(key);
+    }
+    TIMER_STOP();
+    auto miss_latency = TIMER_RESULT();
+
+    if (hits != keys.size()) {
+        fprintf(stderr, "%s: false negatives at fpr %lf\n", name, fpr);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t insert_tput = (size_t) ((double) keys.size() / (double) insert_latency * 1e9);
+    size_t lookup_tput = (size_t) ((double) keys.size() / (double) lookup_latency * 1e9);
+    size_t miss_tput = (size_t) ((double) absent.size() / (double) miss_latency * 1e9);
+    double measured_fpr = (double) false_positives / (double) absent.size();
+
+    fprintf(stdout, "%s\t%lf\t%ld\t%ld\t%ld\t%lf\t%ld\n", name, fpr, insert_tput,
+            lookup_tput, miss_tput, measured_fpr, filter.memory_usage());
+}
+
+/* the batched lookup of absent keys, which only the blocked filter supports */
+static void run_batch(double fpr, std::vector<uint64_t> &keys,
+                      std::vector<uint64_t> &absent) {
+    de::BlockedBloomFilter<uint64_t> filter(fpr, keys.size(), de::BF_HASH_FUNCS);
+    for (auto key : keys) {
+        filter.insert(key);
+    }
+
+    auto results = new bool[absent.size()];
+
+    TIMER_INIT();
+    TIMER_START();
+    filter.lookup_batch(absent.data(), absent.size(), results);
+    TIMER_STOP();
+    auto miss_latency = TIMER_RESULT();
+
+    size_t false_positives = 0;
+    for (size_t i=0; i<absent.size(); i++) {
+        false_positives += results[i];
+    }
+
+    size_t miss_tput = (size_t) ((double) absent.size() / (double) miss_latency * 1e9);
+    double measured_fpr = (double) false_positives / (double) absent.size();
+
+    fprintf(stdout, "blocked_batch\t%lf\t-\t-\t%ld\t%lf\t%ld\n", fpr, miss_tput,
+            measured_fpr, filter.memory_usage());
+
+    delete[] results;
+}
+
+void usage(char *progname) {
+    fprintf(stderr, "%s [keycnt]\n", progname);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t n = (argc > 1) ? atol(argv[1]) : 10000000;
+    std::vector<double> fprs = {.1, .01, .001, .0001};
+    std::mt19937_64 rng(0);
+
+    /* even keys are inserted, and odd keys used to measure false positives */
+    std::vector<uint64_t> keys(n);
+    std::vector<uint64_t> absent(n);
+    for (size_t i=0; i<n; i++) {
+        keys[i] = rng() & ~1ull;
+        absent[i] = rng() | 1ull;
+    }
+
+    fprintf(stdout, "filter\ttarget_fpr\tinsert_tput\thit_tput\tmiss_tput\tmeasured_fpr\tbytes\n");
+    for (auto fpr : fprs) {
+        run<psudb::BloomFilter<uint64_t>>("standard", fpr, keys, absent);
+        run<de::BlockedBloomFilter<uint64_t>>("blocked", fpr, keys, absent);
+        run_batch(fpr, keys, absent);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -53,7 +53,9 @@ void insert_thread(Ext *extension, size_t n, size_t k, size_t rate) {
 int main(int argc, char **argv) {
 
     /* the closeout routine takes _forever_ ... so we'll just leak the memory */
-    auto extension = new Ext(12000, 12001, 3);
+    auto extension = new Ext({.buffer_low_watermark = 12000,
+                              .buffer_high_watermark = 12001,
+                              .scale_factor = 3});
     size_t n = 10000000;
     size_t per_trial = 1000;
     double selectivity = .001;
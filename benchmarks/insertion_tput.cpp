@@ -38,7 +38,9 @@ int main(int argc, char **argv) {
 
     for (auto thread_count : counts) {
 
-        auto extension = new Ext(1000, 12000, 8);
+        auto extension = new Ext({.buffer_low_watermark = 1000,
+                                  .buffer_high_watermark = 12000,
+                                  .scale_factor = 8});
 
         size_t per_thread = n / thread_count;
 
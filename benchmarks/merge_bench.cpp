@@ -0,0 +1,131 @@
+/*
+ * Microbenchmark comparing the throughput of the sorted merge used for
+ * shard construction against the priority queue based merge that it
+ * replaced, across a range of fan-ins.
+ */
+
+#define ENABLE_TIMER
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+#include "framework/interface/Record.h"
+#include "util/SortedMerge.h"
+
+#include "psu-util/timer.h"
+
+typedef de::Record<uint64_t, uint64_t> Rec;
+typedef de::Wrapped<Rec> WRec;
+typedef de::Cursor<WRec> Cur;
+
+/* the merge routine used prior to the introduction of the loser tree */
+static size_t pq_merge(std::vector<Cur> &cursors, WRec *buffer) {
+    size_t reccnt = 0;
+    psudb::PriorityQueue<WRec> pq(cursors.size());
+    for (size_t i=0; i<cursors.size(); i++) {
+        pq.push(cursors[i].ptr, i);
+    }
+
+    while (pq.size()) {
+        auto now = pq.peek();
+        auto next = pq.size() > 1 ? pq.peek(1) : psudb::queue_record<WRec>{nullptr, 0};
+        if (!now.data->is_tombstone() && next.data != nullptr &&
+            now.data->rec == next.data->rec && next.data->is_tombstone()) {
+            pq.pop(); pq.pop();
+            auto &cursor1 = cursors[now.version];
+            auto &cursor2 = cursors[next.version];
+            if (advance_cursor(cursor1)) pq.push(cursor1.ptr, now.version);
+            if (advance_cursor(cursor2)) pq.push(cursor2.ptr, next.version);
+        } else {
+            auto &cursor = cursors[now.version];
+            if (!cursor.ptr->is_deleted()) {
+                buffer[reccnt++] = *cursor.ptr;
+            }
+            pq.pop();
+            if (advance_cursor(cursor)) pq.push(cursor.ptr, now.version);
+        }
+    }
+
+    return reccnt;
+}
+
+static std::vector<Cur> get_cursors(std::vector<std::vector<WRec>> &runs) {
+    std::vector<Cur> cursors;
+    for (auto &run : runs) {
+        cursors.push_back({run.data(), run.data() + run.size(), 0, run.size()});
+    }
+
+    return cursors;
+}
+
+void usage(char *progname) {
+    fprintf(stderr, "%s [reccnt] [tombstone_proportion]\n", progname);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 3) {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t n = (argc > 1) ? atol(argv[1]) : 10000000;
+    double ts_prop = (argc > 2) ? atof(argv[2]) : 0.05;
+    size_t trials = 5;
+
+    std::vector<size_t> fanins = {2, 3, 4, 8, 16, 32, 64};
+    std::mt19937_64 rng(0);
+
+    auto buffer = new WRec[n];
+
+    fprintf(stdout, "fanin\tpq_tput\tmerge_tput\n");
+    for (auto fanin : fanins) {
+        /* split n records over fanin runs, with some tombstones */
+        std::vector<std::vector<WRec>> runs(fanin);
+        for (size_t i=0; i<n; i++) {
+            WRec r = {};
+            r.rec = {rng() % (n * 4), i};
+            r.header = (std::generate_canonical<double, 32>(rng) < ts_prop);
+            runs[rng() % fanin].push_back(r);
+        }
+
+        for (auto &run : runs) {
+            std::sort(run.begin(), run.end());
+        }
+
+        size_t pq_cnt = 0;
+        size_t merge_cnt = 0;
+
+        TIMER_INIT();
+        TIMER_START();
+        for (size_t i=0; i<trials; i++) {
+            auto cursors = get_cursors(runs);
+            pq_cnt = pq_merge(cursors, buffer);
+        }
+        TIMER_STOP();
+        auto pq_latency = TIMER_RESULT();
+
+        TIMER_START();
+        for (size_t i=0; i<trials; i++) {
+            auto cursors = get_cursors(runs);
+            merge_cnt = de::sorted_array_merge<Rec>(cursors, buffer).record_count;
+        }
+        TIMER_STOP();
+        auto merge_latency = TIMER_RESULT();
+
+        if (pq_cnt != merge_cnt) {
+            fprintf(stderr, "Merge output mismatch at fanin %ld: %ld vs %ld\n",
+                    fanin, pq_cnt, merge_cnt);
+            exit(EXIT_FAILURE);
+        }
+
+        size_t pq_tput = (size_t) ((double) (n * trials) / (double) pq_latency * 1e9);
+        size_t merge_tput = (size_t) ((double) (n * trials) / (double) merge_latency * 1e9);
+
+        fprintf(stdout, "%ld\t%ld\t%ld\n", fanin, pq_tput, merge_tput);
+    }
+
+    delete[] buffer;
+
+    exit(EXIT_SUCCESS);
+}
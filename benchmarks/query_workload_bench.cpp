@@ -138,7 +138,9 @@ int main(int argc, char **argv) {
 
     size_t scale_factor = 8;
 
-    auto extension = new Ext(lwm, hwm, scale_factor);
+    auto extension = new Ext({.buffer_low_watermark = lwm,
+                              .buffer_high_watermark = hwm,
+                              .scale_factor = scale_factor});
     size_t per_trial = 1000;
     double selectivity = .001;
 
@@ -44,7 +44,9 @@ void query_thread(Ext *extension, double selectivity, size_t k) {
 }
 
 Ext *build_structure(size_t n) {
-    auto extension = new Ext(1000, 10000, 2);
+    auto extension = new Ext({.buffer_low_watermark = 1000,
+                              .buffer_high_watermark = 10000,
+                              .scale_factor = 2});
 
     size_t i=0;
     Rec r;
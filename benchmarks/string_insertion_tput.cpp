@@ -77,7 +77,9 @@ int main(int argc, char **argv) {
 
     for (auto &sf : scale_factors) {
         for (auto &bf_sz : buffer_sizes) {
-            auto extension = new Ext(bf_sz, bf_sz, sf);
+            auto extension = new Ext({.buffer_low_watermark = bf_sz,
+                                      .buffer_high_watermark = bf_sz,
+                                      .scale_factor = sf});
 
             TIMER_INIT();
             TIMER_START();
@@ -37,7 +37,10 @@ int main(int argc, char **argv) {
     size_t n = atol(argv[1]);
     std::string d_fname = std::string(argv[2]);
 
-    auto extension = new Ext(1, 12001, 2, 0, 64);
+    auto extension = new Ext({.buffer_low_watermark = 1,
+                              .buffer_high_watermark = 12001,
+                              .scale_factor = 2,
+                              .thread_cnt = 64});
     gsl_rng * rng = gsl_rng_alloc(gsl_rng_mt19937);
     
     auto strings = read_string_file(d_fname, n);
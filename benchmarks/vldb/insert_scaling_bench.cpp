@@ -0,0 +1,149 @@
+/*
+ * Multi-producer insert scaling benchmark. Measures the insert throughput
+ * of the framework against the number of inserting threads, when
+ * inserting records directly (retrying failed inserts after a short
+ * sleep), when inserting with insert_wait, and when inserting through
+ * per-thread staging lanes.
+ */
+
+#define ENABLE_TIMER
+
+#include <thread>
+
+#include "framework/DynamicExtension.h"
+#include "framework/structure/StagingLane.h"
+#include "shard/ISAMTree.h"
+#include "query/irs.h"
+#include "framework/interface/Record.h"
+#include "file_util.h"
+
+#include <gsl/gsl_rng.h>
+
+#include "psu-util/timer.h"
+
+
+typedef de::Record<int64_t, int64_t> Rec;
+typedef de::ISAMTree<Rec> ISAM;
+typedef de::irs::Query<ISAM> Q;
+typedef de::DynamicExtension<ISAM, Q> Ext;
+typedef de::StagingLane<Ext, Rec> Lane;
+
+struct timespec delay = {0, 500};
+
+enum class InsertMode { DIRECT, WAIT, LANE };
+
+void insert_thread(Ext *extension, size_t start, size_t stop, std::vector<Rec> *records) {
+    for (size_t i=start; i<stop; i++) {
+        while (!extension->insert((*records)[i])) {
+            nanosleep(&delay, nullptr);
+        }
+    }
+}
+
+void wait_insert_thread(Ext *extension, size_t start, size_t stop, std::vector<Rec> *records) {
+    for (size_t i=start; i<stop; i++) {
+        extension->insert_wait((*records)[i]);
+    }
+}
+
+void lane_insert_thread(Ext *extension, size_t start, size_t stop, std::vector<Rec> *records, size_t lane_size) {
+    Lane lane(extension, lane_size);
+    for (size_t i=start; i<stop; i++) {
+        while (!lane.insert((*records)[i])) {
+            nanosleep(&delay, nullptr);
+        }
+    }
+
+    while (!lane.flush()) {
+        nanosleep(&delay, nullptr);
+    }
+}
+
+size_t run(std::vector<Rec> &data, size_t thread_cnt, InsertMode mode, size_t lane_size) {
+    auto extension = new Ext({.buffer_low_watermark = 1000,
+                              .buffer_high_watermark = 12000,
+                              .scale_factor = 8,
+                              .thread_cnt = 64});
+
+    /* warmup structure w/ 10% of records */
+    size_t n = data.size();
+    size_t warmup = .1 * n;
+    for (size_t i=0; i<warmup; i++) {
+        while (!extension->insert(data[i])) {
+            usleep(1);
+        }
+    }
+
+    extension->await_next_epoch();
+
+    TIMER_INIT();
+
+    std::vector<std::thread> threads(thread_cnt);
+
+    TIMER_START();
+    size_t start = warmup;
+    size_t per_thread = (n - warmup) / thread_cnt;
+    for (size_t i=0; i<thread_cnt; i++) {
+        if (mode == InsertMode::DIRECT) {
+            threads[i] = std::thread(insert_thread, extension, start, start + per_thread, &data);
+        } else if (mode == InsertMode::WAIT) {
+            threads[i] = std::thread(wait_insert_thread, extension, start, start + per_thread, &data);
+        } else {
+            threads[i] = std::thread(lane_insert_thread, extension, start, start + per_thread, &data, lane_size);
+        }
+        start += per_thread;
+    }
+
+    for (size_t i=0; i<thread_cnt; i++) {
+        threads[i].join();
+    }
+    TIMER_STOP();
+
+    auto total_latency = TIMER_RESULT();
+
+    delete extension;
+    return total_latency;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc < 5) {
+        fprintf(stderr, "Usage:\n");
+        fprintf(stderr, "%s reccnt max_threads lane_size datafile\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t n = atol(argv[1]);
+    size_t max_threads = atol(argv[2]);
+    size_t lane_size = atol(argv[3]);
+    std::string d_fname = std::string(argv[4]);
+
+    auto data = read_sosd_file<Rec>(d_fname, n);
+    size_t warmup = .1 * n;
+
+    /*
+     * for each thread count, run the benchmark once inserting directly
+     * into the buffer, once using insert_wait, and once inserting through
+     * staging lanes
+     */
+    for (size_t thread_cnt=1; thread_cnt <= max_threads; thread_cnt *= 2) {
+        size_t inserted = ((n - warmup) / thread_cnt) * thread_cnt;
+
+        auto direct_latency = run(data, thread_cnt, InsertMode::DIRECT, 0);
+        size_t direct_tput = (size_t) ((double) inserted / (double) direct_latency * 1e9);
+
+        auto wait_latency = run(data, thread_cnt, InsertMode::WAIT, 0);
+        size_t wait_tput = (size_t) ((double) inserted / (double) wait_latency * 1e9);
+
+        auto lane_latency = run(data, thread_cnt, InsertMode::LANE, lane_size);
+        size_t lane_tput = (size_t) ((double) inserted / (double) lane_latency * 1e9);
+
+        fprintf(stdout, "%ld\t%ld\t%ld\t%ld\t%ld\t%ld\t%ld\n", thread_cnt,
+                direct_latency, direct_tput, wait_latency, wait_tput,
+                lane_latency, lane_tput);
+        fflush(stdout);
+    }
+
+    fflush(stderr);
+}
+
@@ -73,7 +73,10 @@ int main(int argc, char **argv) {
     std::string d_fname = std::string(argv[4]);
     std::string q_fname = std::string(argv[5]);
 
-    auto extension = new Ext(1000, 12000, 8, 0, 64);
+    auto extension = new Ext({.buffer_low_watermark = 1000,
+                              .buffer_high_watermark = 12000,
+                              .scale_factor = 8,
+                              .thread_cnt = 64});
     gsl_rng * rng = gsl_rng_alloc(gsl_rng_mt19937);
     
     auto data = read_sosd_file<Rec>(d_fname, n);
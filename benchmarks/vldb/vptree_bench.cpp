@@ -38,7 +38,10 @@ int main(int argc, char **argv) {
     std::string d_fname = std::string(argv[2]);
     std::string q_fname = std::string(argv[3]);
 
-    auto extension = new Ext(1400, 1400, 8, 0, 64);
+    auto extension = new Ext({.buffer_low_watermark = 1400,
+                              .buffer_high_watermark = 1400,
+                              .scale_factor = 8,
+                              .thread_cnt = 64});
     gsl_rng * rng = gsl_rng_alloc(gsl_rng_mt19937);
     
     fprintf(stderr, "[I] Reading data file...\n");
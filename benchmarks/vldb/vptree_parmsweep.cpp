@@ -59,7 +59,10 @@ int main(int argc, char **argv) {
 
     for (const auto &bs : buffer_sizes) {
         for (const auto &sf : scale_factors) {
-            auto extension = new Ext(bs, bs, sf, 0, 64);
+            auto extension = new Ext({.buffer_low_watermark = bs,
+                                      .buffer_high_watermark = bs,
+                                      .scale_factor = sf,
+                                      .thread_cnt = 64});
 
             /* warmup structure w/ 10% of records */
             size_t warmup = .1 * n;
@@ -92,7 +95,10 @@ int main(int argc, char **argv) {
 
     for (const auto &bs : buffer_sizes) {
         for (const auto &sf : scale_factors) {
-            auto extension = new Ext2(bs, bs, sf, 0, 64);
+            auto extension = new Ext2({.buffer_low_watermark = bs,
+                                       .buffer_high_watermark = bs,
+                                       .scale_factor = sf,
+                                       .thread_cnt = 64});
 
             /* warmup structure w/ 10% of records */
             size_t warmup = .1 * n;
@@ -44,7 +44,9 @@ int main(int argc, char **argv) {
         for (size_t i=0; i<lwms.size(); i++) {
             size_t lwm = hwm * lwms[i];
 
-            auto extension = new Ext(lwm, hwm, 8);
+            auto extension = new Ext({.buffer_low_watermark = lwm,
+                                      .buffer_high_watermark = (size_t) hwm,
+                                      .scale_factor = 8});
             TIMER_START();
             for (size_t i=0; i<n; i++) {
                 Rec r = {keys[i], keys[i]};
@@ -9,8 +9,16 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <cstdio>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <vector>
 
 #include "framework/interface/Scheduler.h"
@@ -18,9 +26,13 @@
 
 #include "framework/structure/ExtensionStructure.h"
 #include "framework/structure/MutableBuffer.h"
+#include "framework/structure/StagingLane.h"
 
 #include "framework/scheduling/Epoch.h"
 #include "framework/util/Configuration.h"
+#include "framework/util/ScanCursor.h"
+#include "util/Allocators.h"
+#include "util/ParallelBuild.h"
 
 namespace de {
 
@@ -51,49 +63,74 @@ private:
   static constexpr size_t QUERY = 1;
   static constexpr size_t RECONSTRUCTION = 2;
 
+  /*
+   * the minimum total estimated work (see ParallelQueryInterface) for
+   * the local queries of a query to be spread across multiple threads
+   */
+  static constexpr size_t PARALLEL_QUERY_MIN_COST = 1ul << 16;
+
+  /*
+   * the longest that insert_wait will sleep before retrying, in case
+   * the flush it is waiting on was deferred with nothing in flight to
+   * wake it
+   */
+  static constexpr std::chrono::microseconds INSERT_WAIT_TIMEOUT{100};
+
   struct epoch_ptr {
     _Epoch *epoch;
     size_t refcnt;
   };
 
+  struct pending_insert {
+    RecordType rec;
+    std::promise<int> result;
+  };
+
 public:
   /**
    * Create a new Dynamized version of a data structure, supporting
-   * inserts and, possibly, deletes. The following parameters are used
-   * for configuration of the structure,
-   * @param buffer_low_watermark The number of records that can be 
-   *        inserted before a buffer flush is initiated
-   *
-   * @param buffer_high_watermark The maximum buffer capacity, inserts 
-   *        will begin to fail once this number is reached, until the 
-   *        buffer flush has completed. Has no effect in single-threaded 
-   *        operation
-   *
-   * @param scale_factor The rate at which the capacity of levels 
-   *        grows; should be at least 2 for reasonable performance
-   *
-   * @param memory_budget Unused at this time
-   *
-   * @param thread_cnt The maximum number of threads available to the
-   *        framework's scheduler for use in answering queries and 
-   *        performing compactions and flushes, etc.
-   */
-  DynamicExtension(size_t buffer_low_watermark, size_t buffer_high_watermark,
-                   size_t scale_factor, size_t memory_budget = 0,
-                   size_t thread_cnt = 16)
-      : m_scale_factor(scale_factor), m_max_delete_prop(1),
-        m_sched(memory_budget, thread_cnt),
-        m_buffer(new Buffer(buffer_low_watermark, buffer_high_watermark)),
-        m_core_cnt(thread_cnt), m_next_core(0), m_epoch_cnt(0) {
+   * inserts and, possibly, deletes.
+   *
+   * @param config The configuration of the structure. See
+   *        ExtensionConfiguration (framework/util/Configuration.h) for
+   *        a description of each field.
+   */
+  DynamicExtension(const ExtensionConfiguration &config)
+      : m_scale_factor(config.scale_factor), m_max_delete_prop(1),
+        m_sched(config.memory_budget, config.thread_cnt),
+        m_buffer(new Buffer(config.buffer_low_watermark,
+                            config.buffer_high_watermark, 0,
+                            config.sorted_buffer, config.hashed_buffer)),
+        m_core_cnt(config.thread_cnt), m_next_core(0), m_epoch_cnt(0),
+        m_deferred_reconstructions(0), m_build_parallelism(1),
+        m_query_parallelism(1),
+        m_active_reconstructions(0),
+        m_reconstruction_scheduled(false), m_retry_generation(0),
+        m_deferred_generation(UINT64_MAX) {
     if constexpr (L == LayoutPolicy::BSM) {
-      assert(scale_factor == 2);
+      assert(config.scale_factor == 2);
     }
 
-    auto vers =
-        new Structure(buffer_high_watermark, m_scale_factor, m_max_delete_prop);
+    assert(config.partition_size == 0 ||
+           (L == LayoutPolicy::LEVELING &&
+            PartitionedShardInterface<ShardType>));
+
+    auto vers = new Structure(config.buffer_high_watermark, m_scale_factor,
+                              m_max_delete_prop, config.partition_size);
     m_current_epoch.store({new _Epoch(0, vers, m_buffer, 0), 0});
     m_previous_epoch.store({nullptr, 0});
     m_next_epoch.store({nullptr, 0});
+
+    /*
+     * a flush deferred for lack of memory may fit once a reservation is
+     * released, so wake any inserts waiting on it
+     */
+    m_sched.get_memory_governor().set_release_callback([this] {
+      m_retry_generation.fetch_add(1);
+      m_epoch_cv_lk.lock();
+      m_epoch_cv.notify_all();
+      m_epoch_cv_lk.unlock();
+    });
   }
 
   /**
@@ -110,11 +147,23 @@ public:
     /* shutdown the scheduler */
     m_sched.shutdown();
 
+    /*
+     * any asynchronous inserts that are still waiting for buffer
+     * space will never be performed, so notify their callers
+     */
+    for (auto &pending : m_pending_inserts) {
+      pending.result.set_value(0);
+    }
+
     /* delete all held resources */
     delete m_next_epoch.load().epoch;
     delete m_current_epoch.load().epoch;
     delete m_previous_epoch.load().epoch;
 
+    for (auto &retired : m_retired_epochs) {
+      delete retired.epoch;
+    }
+
     delete m_buffer;
   }
 
@@ -132,6 +181,112 @@ public:
    */
   int insert(const RecordType &rec) { return internal_append(rec, false); }
 
+  /**
+   *  Inserts a batch of records into the index. The buffer space for
+   *  the batch is reserved in a single operation, rather than one
+   *  record at a time, and so this is considerably cheaper than calling
+   *  insert once for each record. If the buffer cannot hold the entire
+   *  batch before reaching its high water mark, a prefix of the batch
+   *  will be inserted and the number of records inserted is returned.
+   *  The remaining records should be retried once the buffer has
+   *  flushed. Inserted records will be immediately visible inside the
+   *  index upon the return of this function.
+   *
+   *  @param recs The records to be inserted
+   *
+   *  @return The number of records from the front of recs that were
+   *          inserted. This will be 0 if the buffer is full.
+   */
+  size_t insert_batch(std::span<const RecordType> recs) {
+    return internal_append_batch(recs, false);
+  }
+
+  /**
+   *  Inserts a record into the index, blocking until the insert
+   *  succeeds. Rather than failing when the buffer has reached its high
+   *  water mark, the calling thread will sleep until a buffer flush has
+   *  completed and space has been freed, and then retry. The record will
+   *  be immediately visible inside the index upon the return of this
+   *  function. Note that if the memory budget has been exhausted, the
+   *  flush will be deferred, and so this function will not return until
+   *  the running reconstructions have released their memory.
+   *
+   *  @param rec The record to be inserted
+   *
+   *  @return 1 once the insert has succeeded
+   */
+  int insert_wait(const RecordType &rec) {
+    while (!internal_append(rec, false)) {
+      std::unique_lock<std::mutex> lk(m_epoch_cv_lk);
+
+      /*
+       * the condition variable is notified after the buffer head is
+       * advanced, after each reconstruction completes, and when memory
+       * reserved from the budget is released, so if the buffer is still
+       * full here we will be woken once a retry may succeed. The flush
+       * may, however, have been deferred with nothing in flight to
+       * notify us, and so the wait is bounded, with the retry
+       * attempting to schedule the flush again.
+       */
+      if (m_buffer->is_full()) {
+        m_epoch_cv.wait_for(lk, INSERT_WAIT_TIMEOUT);
+      }
+    }
+
+    return 1;
+  }
+
+  /**
+   *  Inserts a record into the index without blocking. If there is room
+   *  in the buffer, the insert is performed immediately. Otherwise, the
+   *  record is queued and will be inserted by the framework as soon as
+   *  a buffer flush has freed enough space. Queued records are inserted
+   *  in the order in which they were queued. The returned future becomes
+   *  ready once the record has been inserted, at which point the record
+   *  is visible inside the index.
+   *
+   *  @param rec The record to be inserted
+   *
+   *  @return A future which will contain 1 once the record has been
+   *          inserted. If the index is destroyed before a queued record
+   *          could be inserted, the future will contain 0.
+   */
+  std::future<int> insert_async(const RecordType &rec) {
+    std::promise<int> result;
+    auto future = result.get_future();
+
+    /*
+     * if there are records already waiting, this one must wait behind
+     * them. Otherwise, attempt the insert immediately. This is done
+     * without holding m_pending_insert_lk, as the insert may trigger
+     * a reconstruction which will itself service the queue.
+     */
+    bool queue_empty;
+    {
+      std::unique_lock<std::mutex> lk(m_pending_insert_lk);
+      queue_empty = m_pending_inserts.empty();
+    }
+
+    if (queue_empty && internal_append(rec, false)) {
+      result.set_value(1);
+      return future;
+    }
+
+    {
+      std::unique_lock<std::mutex> lk(m_pending_insert_lk);
+      m_pending_inserts.push_back({rec, std::move(result)});
+    }
+
+    /*
+     * a flush may have completed between the failed insert above and
+     * queueing the record, in which case nothing else will service
+     * the queue until the buffer reaches the low watermark again.
+     */
+    service_pending_inserts();
+
+    return future;
+  }
+
   /**
    *  Erases a record from the index, according to the DeletePolicy 
    *  template parameter. Returns 1 on success and 0 on failure. The
@@ -207,6 +362,40 @@ public:
     return schedule_query(std::move(parms));
   }
 
+  /**
+   *  Execute a query with specified parameters on the calling thread,
+   *  rather than scheduling it, and return its results. This avoids the
+   *  overhead of handing the query off to the scheduler, and is intended
+   *  for short queries (such as point lookups) for which that overhead
+   *  would dominate. The query is answered against the active epoch, in
+   *  the same way as a query scheduled by query.
+   *  @param parms An rvalue reference to the query parameters.
+   *
+   *  @return The query results
+   */
+  QueryResult query_sync(Parameters &&parms) {
+    return run_query(this, &parms);
+  }
+
+  /**
+   *  Schedule the execution of a batch of queries, which are all answered
+   *  against the same version of the structure. The batch is scheduled
+   *  as a single job, saving the overhead of scheduling each query
+   *  separately. The batch is also sorted by key (where the query type
+   *  has one), and the local queries on each shard are created for the
+   *  whole batch at once, so that the shard's index stays in cache. Each
+   *  query is otherwise answered on its own, and so does no less work
+   *  than it would if passed to query.
+   *  @param parms An rvalue reference to the parameters of each query.
+   *
+   *  @return A future, from which the results of each query, in the same
+   *          order as parms, can be retrieved upon completion of the batch
+   */
+  std::future<std::vector<QueryResult>>
+  query_batch(std::vector<Parameters> &&parms) {
+    return schedule_query_batch(std::move(parms));
+  }
+
   /**
    *  Determine the number of records (including tagged records and 
    *  tombstones) currently within the framework. This number is used for
@@ -255,6 +444,29 @@ public:
     return t;
   }
 
+  /**
+   *  Get the number of records stored on each level of the index,
+   *  ordered from the top level down. Exposed for unit-testing
+   *  purposes.
+   *
+   *  @return The number of records on each level, including deleted
+   *          records and tombstones
+   */
+  std::vector<size_t> get_level_record_counts() {
+    auto epoch = get_active_epoch();
+    auto &levels = epoch->get_structure()->get_levels();
+
+    std::vector<size_t> counts(levels.size(), 0);
+    for (size_t i = 0; i < levels.size(); i++) {
+      if (levels[i]) {
+        counts[i] = levels[i]->get_record_count();
+      }
+    }
+    end_job(epoch);
+
+    return counts;
+  }
+
   /**
    *  Get the number of bytes of memory allocated across the framework for
    *  storing records and associated index information (i.e., internal
@@ -290,6 +502,79 @@ public:
     return t;
   }
 
+  /**
+   *  Get the memory budget of the index, as specified on construction.
+   *  If no budget was specified, this will be UINT64_MAX.
+   *
+   *  @return The memory budget in bytes
+   */
+  size_t get_memory_budget() const { return m_sched.get_memory_budget(); }
+
+  /**
+   *  Get the number of bytes of memory currently reserved from the
+   *  memory budget by running reconstructions, in addition to the
+   *  memory reported by get_memory_usage and get_aux_memory_usage.
+   *
+   *  @return The number of bytes currently reserved
+   */
+  size_t get_reserved_memory() const { return m_sched.get_reserved_memory(); }
+
+  /**
+   *  Get the number of times that a reconstruction has been deferred
+   *  due to insufficient room in the memory budget.
+   *
+   *  @return The number of deferred reconstructions
+   */
+  size_t get_deferred_reconstruction_count() const {
+    return m_deferred_reconstructions.load();
+  }
+
+  /**
+   *  Set the number of threads used to construct each shard during a
+   *  reconstruction. The additional threads are taken from the
+   *  scheduler's thread pool when they are idle, and so a value larger
+   *  than the thread count given to the constructor has no further
+   *  effect. Shards built by reconstructions that are already running
+   *  are unaffected.
+   *
+   *  @param parallelism The number of threads to use, including the
+   *         one running the reconstruction. Defaults to 1.
+   */
+  void set_build_parallelism(size_t parallelism) {
+    m_build_parallelism.store(std::max<size_t>(parallelism, 1));
+  }
+
+  /**
+   *  Get the number of threads used to construct each shard during a
+   *  reconstruction.
+   *
+   *  @return The number of threads
+   */
+  size_t get_build_parallelism() const { return m_build_parallelism.load(); }
+
+  /**
+   *  Set the number of threads used to answer the local queries of each
+   *  query against the shards. As with shard construction, the
+   *  additional threads are taken from the scheduler's thread pool when
+   *  they are idle. Only queries satisfying ParallelQueryInterface are
+   *  answered in parallel, and only when their estimated work is large
+   *  enough to benefit; all others are answered on a single thread.
+   *
+   *  @param parallelism The number of threads to use, including the
+   *         one running the query. Defaults to 1.
+   */
+  void set_query_parallelism(size_t parallelism) {
+    m_query_parallelism.store(std::max<size_t>(parallelism, 1));
+  }
+
+  /**
+   *  Get the number of threads used to answer the local queries of each
+   *  query.
+   *
+   *  @return The number of threads
+   */
+  size_t get_query_parallelism() const { return m_query_parallelism.load(); }
+
   /**
    *  Create a new single Shard object containing all of the records
    *  within the framework (buffer and shards). 
@@ -329,7 +614,7 @@ public:
      * head pointer any longer
      */
     {
-      auto bv = epoch->get_buffer();
+      auto bv = epoch->get_buffer(true);
       if (bv.get_record_count() > 0) {
         shards.emplace_back(new ShardType(std::move(bv)));
       }
@@ -345,15 +630,57 @@ public:
     return flattened;
   }
 
+  /**
+   *  Open a cursor that streams the records with keys in [lower, upper]
+   *  out of the currently active version of the index, in key order,
+   *  with deleted records removed. Records are merged out of the shards
+   *  as they are requested, so no more of the range than is consumed is
+   *  read, and nothing is materialized up front other than the matching
+   *  records of the buffer.
+   *
+   *  The cursor holds a reference to the active epoch until it is
+   *  exhausted, closed, or destroyed, which delays the retirement of
+   *  that epoch's shards, and so cursors should not be held open for
+   *  long periods.
+   *
+   *  @param lower The smallest key to return
+   *  @param upper The largest key to return
+   *  @param limit The maximum number of records to return, or 0 for no
+   *         limit. Defaults to 0.
+   *
+   *  @return The cursor
+   */
+  template <ScannableShardInterface S = ShardType>
+  ScanCursor<S> scan(const decltype(S::RECORD::key) &lower,
+                     const decltype(S::RECORD::key) &upper,
+                     size_t limit = 0) {
+    auto epoch = get_active_epoch();
+    auto vers = epoch->get_structure();
+    std::vector<S *> shards;
+
+    for (auto &level : vers->get_levels()) {
+      for (size_t i = 0; level && i < level->get_shard_count(); i++) {
+        if (level->get_shard(i)) {
+          shards.push_back(level->get_shard(i));
+        }
+      }
+    }
+
+    auto bv = epoch->get_buffer(true);
+    return ScanCursor<S>(shards, bv, lower, upper, limit,
+                         [this, epoch] { end_job(epoch); });
+  }
+
   /*
-   * If the current epoch is *not* the newest one, then wait for
-   * the newest one to become available. Otherwise, returns immediately.
+   * If there are any reconstructions in progress, wait for all of them
+   * (including any background reconstructions that they schedule) to
+   * complete and their epochs to become active. Otherwise, returns
+   * immediately.
    */
   void await_next_epoch() {
-    while (m_next_epoch.load().epoch != nullptr) {
-      std::unique_lock<std::mutex> lk(m_epoch_cv_lk);
-      m_epoch_cv.wait(lk);
-    }
+    std::unique_lock<std::mutex> lk(m_epoch_cv_lk);
+    m_epoch_cv.wait(lk,
+                    [this] { return m_active_reconstructions.load() == 0; });
   }
 
   /**
@@ -387,16 +714,57 @@ private:
   size_t m_core_cnt;
   std::atomic<int> m_next_core;
   std::atomic<size_t> m_epoch_cnt;
-  
+  std::atomic<size_t> m_deferred_reconstructions;
+  std::atomic<size_t> m_build_parallelism;
+  std::atomic<size_t> m_query_parallelism;
+
+  /*
+   * the number of reconstructions (buffer flushes and background
+   * reconstructions) that have been scheduled but not yet completed
+   */
+  std::atomic<size_t> m_active_reconstructions;
+
   alignas(64) std::atomic<bool> m_reconstruction_scheduled;
 
+  /*
+   * incremented whenever something happens that may allow a deferred
+   * flush to be scheduled (a reconstruction completes, or memory is
+   * released from the budget), and the value it had when the last flush
+   * was deferred, or UINT64_MAX if it has not been since. The flush is
+   * only retried once the two differ, so that inserts don't replan it
+   * while nothing has changed.
+   */
+  alignas(64) std::atomic<size_t> m_retry_generation;
+  std::atomic<size_t> m_deferred_generation;
+
+  /*
+   * the levels of the structure that are currently reserved by a
+   * reconstruction. A level can only be involved in one reconstruction
+   * at a time, and is not modified by anything else while reserved.
+   */
+  std::vector<bool> m_busy_levels;
+  std::mutex m_level_lk;
+
+  /* serializes the installation of new epochs by reconstructions */
+  std::mutex m_install_lk;
+
   std::atomic<epoch_ptr> m_next_epoch;
   std::atomic<epoch_ptr> m_current_epoch;
   std::atomic<epoch_ptr> m_previous_epoch;
 
+  /*
+   * epochs that have been retired while jobs were still active on
+   * them, along with the number of those jobs
+   */
+  std::vector<epoch_ptr> m_retired_epochs;
+  std::mutex m_retired_epoch_lk;
+
   std::condition_variable m_epoch_cv;
   std::mutex m_epoch_cv_lk;
 
+  std::deque<pending_insert> m_pending_inserts;
+  std::mutex m_pending_insert_lk;
+
 
 
 
@@ -413,12 +781,15 @@ private:
       args->merges = compactions;
       args->extension = this;
       args->compaction = true;
+      args->flush = false;
       /* NOTE: args is deleted by the reconstruction job, so shouldn't be freed
        * here */
 
       auto wait = args->result.get_future();
 
-      m_sched.schedule_job(reconstruction, 0, args, RECONSTRUCTION);
+      size_t estimate =
+          estimate_reconstruction_memory(structure, compactions, 0);
+      m_sched.schedule_job(reconstruction, estimate, args, RECONSTRUCTION);
 
       /* wait for compaction completion */
       wait.get();
@@ -472,15 +843,11 @@ private:
 
     m_previous_epoch.store(cur);
 
-    // FIXME: this may currently block because there isn't any
-    // query preemption yet. At this point, we'd need to either
-    // 1) wait for all queries on the old_head to finish
-    // 2) kill all queries on the old_head
-    // 3) somehow migrate all queries on the old_head to the new
-    //    version
-    while (!m_next_epoch.load().epoch->advance_buffer_head(buffer_head)) {
-      _mm_pause();
-    }
+    /*
+     * the buffer can always advance its head, as any queries on the
+     * old epoch keep their own portion of the buffer alive
+     */
+    m_next_epoch.load().epoch->advance_buffer_head(buffer_head);
 
     m_current_epoch.store(m_next_epoch);
     m_next_epoch.store({nullptr, 0});
@@ -492,138 +859,272 @@ private:
   }
 
   /*
-   * Creates a new epoch by copying the currently active one. The new epoch's
-   * structure will be a shallow copy of the old one's.
+   * Creates a new epoch by copying the currently active one, replacing the
+   * levels of its structure covered by delta, and makes it active. The new
+   * epoch's structure will otherwise be a shallow copy of the old one's. If
+   * buffer_head is provided, the buffer head is also advanced to it.
+   *
+   * Reconstructions on disjoint sets of levels can complete concurrently,
+   * so installations are serialized, each building upon the epoch
+   * installed by the last.
    */
-  _Epoch *create_new_epoch() {
-    /*
-     * This epoch access is _not_ protected under the assumption that
-     * only one reconstruction will be able to trigger at a time. If that
-     * condition is violated, it is possible that this code will clone a retired
-     * epoch.
-     */
+  void install_level_delta(const typename Structure::level_delta &delta,
+                           std::optional<size_t> buffer_head = std::nullopt) {
+    std::unique_lock<std::mutex> lk(m_install_lk);
     assert(m_next_epoch.load().epoch == nullptr);
-    auto current_epoch = get_active_epoch();
 
+    auto current_epoch = get_active_epoch();
     m_epoch_cnt.fetch_add(1);
-    m_next_epoch.store({current_epoch->clone(m_epoch_cnt.load()), 0});
-
+    auto epoch = current_epoch->clone(m_epoch_cnt.load());
     end_job(current_epoch);
 
-    return m_next_epoch.load().epoch;
+    epoch->get_structure()->apply_level_delta(delta);
+    m_next_epoch.store({epoch, 0});
+
+    advance_epoch(buffer_head.value_or(epoch->get_buffer_head()));
   }
 
-  void retire_epoch(_Epoch *epoch) {
-    /*
-     * Epochs with currently active jobs cannot
-     * be retired. By the time retire_epoch is called,
-     * it is assumed that a new epoch is active, meaning
-     * that the epoch to be retired should no longer
-     * accumulate new active jobs. Eventually, this
-     * number will hit zero and the function will
-     * proceed.
-     */
+  /*
+   * Reserve levels [first, last] for a reconstruction, returning false
+   * (and reserving nothing) if any of them are already reserved. Must be
+   * called with m_level_lk held.
+   */
+  bool reserve_levels(level_index first, level_index last) {
+    if (m_busy_levels.size() <= (size_t)last) {
+      m_busy_levels.resize(last + 1, false);
+    }
+
+    for (level_index i = first; i <= last; i++) {
+      if (m_busy_levels[i]) {
+        return false;
+      }
+    }
+
+    for (level_index i = first; i <= last; i++) {
+      m_busy_levels[i] = true;
+    }
 
+    return true;
+  }
+
+  void release_levels(level_index first, level_index last) {
+    std::unique_lock<std::mutex> lk(m_level_lk);
+    for (level_index i = first; i <= last; i++) {
+      m_busy_levels[i] = false;
+    }
+  }
+
+  /*
+   * Remove an epoch from m_previous_epoch. If there are no remaining
+   * jobs operating on it, it is deleted immediately. Otherwise, it is
+   * moved into the list of retired epochs, and will be deleted by
+   * end_job once its last job finishes, so that a long-running query
+   * never holds up an epoch transition.
+   */
+  void retire_epoch(_Epoch *epoch) {
     if (epoch == nullptr) {
       return;
     }
 
-    epoch_ptr old, new_ptr;
-    new_ptr = {nullptr, 0};
-    do {
-      old = m_previous_epoch.load();
-
+    epoch_ptr old;
+    {
       /*
-       * If running in single threaded mode, the failure to retire
-       * an Epoch will result in the thread of execution blocking
-       * indefinitely.
+       * the swap is done under the lock, so that end_job will always
+       * find the epoch either in m_previous_epoch or in the retired
+       * list
        */
-      if constexpr (std::same_as<SchedType, SerialScheduler>) {
-        if (old.epoch == epoch)
-          assert(old.refcnt == 0);
-      }
+      std::unique_lock<std::mutex> lock(m_retired_epoch_lk);
+      old = m_previous_epoch.exchange({nullptr, 0});
+      assert(old.epoch == epoch);
 
-      if (old.epoch == epoch && old.refcnt == 0 &&
-          m_previous_epoch.compare_exchange_strong(old, new_ptr)) {
-        break;
+      if (old.refcnt > 0) {
+        m_retired_epochs.push_back(old);
+        return;
       }
-      usleep(1);
-
-    } while (true);
+    }
 
     delete epoch;
   }
 
-  static void reconstruction(void *arguments) {
-    auto args = (ReconstructionArgs<ShardType, QueryType, L> *)arguments;
-
-    ((DynamicExtension *)args->extension)->SetThreadAffinity();
-    Structure *vers = args->epoch->get_structure();
-
+  static void run_reconstructions(Structure *vers,
+                                  ReconstructionVector &merges) {
     if constexpr (L == LayoutPolicy::BSM) {
-      if (args->merges.size() > 0) {
-        vers->reconstruction(args->merges[0]);
+      if (merges.size() > 0) {
+        vers->reconstruction(merges[0]);
       }
     } else {
-      for (size_t i = 0; i < args->merges.size(); i++) {
-        vers->reconstruction(args->merges[i].target,
-                             args->merges[i].sources[0]);
+      for (size_t i = 0; i < merges.size(); i++) {
+        vers->reconstruction(merges[i].target, merges[i].sources[0],
+                             merges[i].move_reccnt);
       }
     }
+  }
+
+  static void reconstruction(void *arguments) {
+    auto args = (ReconstructionArgs<ShardType, QueryType, L> *)arguments;
+    auto extension = (DynamicExtension *)args->extension;
+
+    extension->SetThreadAffinity();
+
+    /*
+     * allow the shards built by this reconstruction to use idle threads
+     * from the scheduler's pool
+     */
+    BuildContext build_context = {
+        [extension](std::function<void()> task) {
+          extension->m_sched.schedule_subtask(std::move(task));
+        },
+        extension->m_build_parallelism.load()};
+    BuildContextGuard build_guard(&build_context);
 
     /*
-     * we'll grab the buffer AFTER doing the internal reconstruction, so we
-     * can flush as many records as possible in one go. The reconstruction
-     * was done so as to make room for the full buffer anyway, so there's
-     * no real benefit to doing this first.
+     * Compactions occur on an epoch _before_ it becomes active, and so
+     * are performed directly on its structure, and the active epoch
+     * should _not_ be advanced as part of a compaction
      */
-    auto buffer_view = args->epoch->get_buffer();
-    size_t new_head = buffer_view.get_tail();
+    if (args->compaction) {
+      run_reconstructions(args->epoch->get_structure(), args->merges);
+      args->result.set_value(true);
+      delete args;
+      return;
+    }
 
     /*
-     * if performing a compaction, don't flush the buffer, as
-     * there is no guarantee that any necessary reconstructions
-     * will free sufficient space in L0 to support a flush
+     * Otherwise, the reconstruction is performed on a private copy of the
+     * active structure, and only the levels that it has reserved are
+     * installed from this copy once it is complete. Other reconstructions
+     * may install their own levels in the meantime.
      */
-    if (!args->compaction) {
-      vers->flush_buffer(std::move(buffer_view));
+    auto epoch = extension->get_active_epoch();
+    Structure *vers = epoch->get_structure()->copy();
+    run_reconstructions(vers, args->merges);
+
+    std::optional<size_t> new_head;
+    if (args->flush) {
+      /*
+       * we'll grab the buffer AFTER doing the internal reconstruction, so
+       * we can flush as many records as possible in one go. The
+       * reconstruction was done so as to make room for the full buffer
+       * anyway, so there's no real benefit to doing this first. The
+       * view may also be empty, if the records past the head have been
+       * reserved but not yet published.
+       */
+      auto buffer_view = epoch->get_buffer(true);
+      new_head = buffer_view.get_tail();
+
+      if (buffer_view.get_record_count() > 0) {
+        vers->flush_buffer(std::move(buffer_view));
+      }
     }
 
+    extension->end_job(epoch);
+
+    extension->install_level_delta(
+        vers->get_level_delta(args->first_level, args->last_level), new_head);
+    delete vers;
+
+    extension->release_levels(args->first_level, args->last_level);
     args->result.set_value(true);
 
     /*
-     * Compactions occur on an epoch _before_ it becomes active,
-     * and as a result the active epoch should _not_ be advanced as
-     * part of a compaction
+     * the installed levels may now be full, in which case they can be
+     * emptied in the background ahead of the flush that would need them
      */
-    if (!args->compaction) {
-      ((DynamicExtension *)args->extension)->advance_epoch(new_head);
+    extension->schedule_background_reconstructions();
+
+    if (args->flush) {
+      extension->m_reconstruction_scheduled.store(false);
     }
 
-    ((DynamicExtension *)args->extension)
-        ->m_reconstruction_scheduled.store(false);
+    /* wake any inserts waiting on the completion of this reconstruction */
+    extension->m_retry_generation.fetch_add(1);
+    extension->m_active_reconstructions.fetch_sub(1);
+    extension->m_epoch_cv_lk.lock();
+    extension->m_epoch_cv.notify_all();
+    extension->m_epoch_cv_lk.unlock();
+
+    /*
+     * a flush has freed space in the buffer, and a background
+     * reconstruction may have released levels needed by a deferred
+     * flush, so any queued asynchronous inserts can now be performed
+     */
+    extension->service_pending_inserts();
 
     delete args;
   }
 
-  static void async_query(void *arguments) {
-    auto *args = 
-      (QueryArgs<ShardType, QueryType, DynamicExtension> *) arguments;
+  /*
+   * Answer the buffer and local queries concurrently, storing their
+   * results in query_results (with the buffer's first), if the query
+   * supports this and there is enough work for it to be worthwhile.
+   * Returns false, without answering any of the queries, otherwise.
+   */
+  static bool
+  parallel_local_queries(DynamicExtension *extension,
+                         std::vector<std::pair<ShardID, ShardType *>> &shards,
+                         std::vector<LocalQuery *> &local_queries,
+                         BufferQuery *buffer_query,
+                         std::vector<LocalResult> &query_results) {
+    if constexpr (ParallelQueryInterface<QueryType, ShardType> &&
+                  !QueryType::EARLY_ABORT) {
+      size_t parallelism = extension->m_query_parallelism.load();
+      if (parallelism <= 1 || shards.size() == 0) {
+        return false;
+      }
 
-    auto epoch = args->extension->get_active_epoch();
+      /*
+       * order the shards from the most to the least work, so that the
+       * largest are started first and the smallest fill in around them
+       */
+      std::vector<std::pair<size_t, size_t>> order;
+      size_t total_cost = 0;
+      for (size_t i = 0; i < shards.size(); i++) {
+        size_t cost =
+            QueryType::local_query_cost(shards[i].second, local_queries[i]);
+        order.push_back({cost, i});
+        total_cost += cost;
+      }
 
-    auto buffer = epoch->get_buffer();
-    auto vers = epoch->get_structure();
-    auto *parms = &(args->query_parms);
+      if (total_cost < PARALLEL_QUERY_MIN_COST) {
+        return false;
+      }
 
-    /* create initial buffer query */
-    auto buffer_query = QueryType::local_preproc_buffer(&buffer, parms);
+      std::sort(order.begin(), order.end(), std::greater<>());
 
-    /* create initial local queries */
-    std::vector<std::pair<ShardID, ShardType *>> shards;
-    std::vector<LocalQuery *> local_queries =
-        vers->get_local_queries(shards, parms);
+      BuildContext query_context = {
+          [extension](std::function<void()> task) {
+            extension->m_sched.schedule_subtask(std::move(task));
+          },
+          parallelism};
+      BuildContextGuard query_guard(&query_context);
+
+      /* the buffer query is run last, on whichever thread gets to it */
+      parallel_for_each(order.size() + 1, [&](size_t task) {
+        if (task == order.size()) {
+          query_results[0] = QueryType::local_query_buffer(buffer_query);
+          return;
+        }
 
+        size_t i = order[task].second;
+        query_results[i + 1] =
+            QueryType::local_query(shards[i].second, local_queries[i]);
+      });
+
+      return true;
+    }
+
+    return false;
+  }
+
+  /*
+   * Run a query against the shards and buffer of a pinned epoch, given
+   * its initial local and buffer queries, and return the combined result.
+   */
+  static QueryResult
+  execute_query(DynamicExtension *extension, Parameters *parms,
+                std::vector<std::pair<ShardID, ShardType *>> &shards,
+                std::vector<LocalQuery *> &local_queries,
+                BufferQuery *buffer_query) {
     /* process local/buffer queries to create the final version */
     QueryType::distribute_query(parms, local_queries, buffer_query);
 
@@ -631,18 +1132,21 @@ private:
     QueryResult output;
     do {
       std::vector<LocalResult> query_results(shards.size() + 1);
-      for (size_t i = 0; i < query_results.size(); i++) {
-        if (i == 0) { /* execute buffer query */
-          query_results[i] = QueryType::local_query_buffer(buffer_query);
-        } else { /*execute local queries */
-          query_results[i] = QueryType::local_query(shards[i - 1].second,
-                                                 local_queries[i - 1]);
-        }
-
-        /* end query early if EARLY_ABORT is set and a result exists */
-        if constexpr (QueryType::EARLY_ABORT) {
-          if (query_results[i].size() > 0)
-            break;
+      if (!parallel_local_queries(extension, shards, local_queries,
+                                  buffer_query, query_results)) {
+        for (size_t i = 0; i < query_results.size(); i++) {
+          if (i == 0) { /* execute buffer query */
+            query_results[i] = QueryType::local_query_buffer(buffer_query);
+          } else { /*execute local queries */
+            query_results[i] = QueryType::local_query(shards[i - 1].second,
+                                                   local_queries[i - 1]);
+          }
+
+          /* end query early if EARLY_ABORT is set and a result exists */
+          if constexpr (QueryType::EARLY_ABORT) {
+            if (query_results[i].size() > 0)
+              break;
+          }
         }
       }
 
@@ -655,11 +1159,29 @@ private:
       /* optionally repeat the local queries if necessary */
     } while (QueryType::repeat(parms, output, local_queries, buffer_query));
 
-    /* return the output vector to caller via the future */
-    args->result_set.set_value(std::move(output));
+    return output;
+  }
 
-    /* officially end the query job, releasing the pin on the epoch */
-    args->extension->end_job(epoch);
+  /*
+   * Answer a query against the active epoch, on the calling thread
+   */
+  static QueryResult run_query(DynamicExtension *extension,
+                               Parameters *parms) {
+    auto epoch = extension->get_active_epoch();
+
+    auto buffer = epoch->get_buffer();
+    auto vers = epoch->get_structure();
+
+    /* create initial buffer query */
+    auto buffer_query = QueryType::local_preproc_buffer(&buffer, parms);
+
+    /* create initial local queries */
+    std::vector<std::pair<ShardID, ShardType *>> shards;
+    std::vector<LocalQuery *> local_queries =
+        vers->get_local_queries(shards, parms);
+
+    auto output =
+        execute_query(extension, parms, shards, local_queries, buffer_query);
 
     /* clean up memory allocated for temporary query objects */
     delete buffer_query;
@@ -667,23 +1189,229 @@ private:
       delete local_queries[i];
     }
 
+    /* officially end the query job, releasing the pin on the epoch */
+    extension->end_job(epoch);
+
+    return output;
+  }
+
+  static void async_query(void *arguments) {
+    auto *args = 
+      (QueryArgs<ShardType, QueryType, DynamicExtension> *) arguments;
+
+    /* return the output vector to caller via the future */
+    args->result_set.set_value(
+        run_query(args->extension, &(args->query_parms)));
+
+    delete args;
+  }
+
+  /*
+   * Return true if lhs should be run before rhs within a batch of
+   * queries. Queries with a key (range and point queries) are ordered by
+   * it, so that consecutive queries search nearby parts of each shard.
+   * Otherwise, the batch is left in its original order.
+   */
+  static bool batch_order(const Parameters &lhs, const Parameters &rhs) {
+    if constexpr (KeyRangeQueryInterface<QueryType>) {
+      return lhs.lower_bound < rhs.lower_bound;
+    } else if constexpr (PointQueryInterface<QueryType>) {
+      return lhs.search_key < rhs.search_key;
+    } else {
+      return false;
+    }
+  }
+
+  static void async_query_batch(void *arguments) {
+    auto *args =
+        (BatchQueryArgs<ShardType, QueryType, DynamicExtension> *)arguments;
+    auto &batch = args->query_parms;
+
+    auto epoch = args->extension->get_active_epoch();
+
+    auto buffer = epoch->get_buffer();
+    auto vers = epoch->get_structure();
+
+    std::vector<size_t> order(batch.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+      return batch_order(batch[a], batch[b]);
+    });
+
+    std::vector<Parameters *> parms(batch.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      parms[i] = &batch[order[i]];
+    }
+
+    /* create the initial local queries for every query, a shard at a time */
+    std::vector<std::vector<std::pair<ShardID, ShardType *>>> shards;
+    auto local_queries = vers->get_batch_local_queries(shards, parms);
+
+    std::vector<QueryResult> output(batch.size());
+    for (size_t i = 0; i < parms.size(); i++) {
+      auto buffer_query = QueryType::local_preproc_buffer(&buffer, parms[i]);
+
+      output[order[i]] = execute_query(args->extension, parms[i], shards[i],
+                                       local_queries[i], buffer_query);
+
+      delete buffer_query;
+      for (size_t j = 0; j < local_queries[i].size(); j++) {
+        delete local_queries[i][j];
+      }
+    }
+
+    /* return the output vectors to caller via the future */
+    args->result_set.set_value(std::move(output));
+
+    /* officially end the query job, releasing the pin on the epoch */
+    args->extension->end_job(epoch);
+
     delete args;
   }
 
-  void schedule_reconstruction() {
-    auto epoch = create_new_epoch();
+  /*
+   * Estimate the number of bytes of memory that will be allocated by
+   * performing the reconstructions in tasks against structure, followed
+   * by a flush of buffer_reccnt records. Each record is assumed to cost
+   * the same as the average record currently within the structure
+   * (including auxiliary structures), and no less than a Wrapped record.
+   */
+  size_t estimate_reconstruction_memory(Structure *structure,
+                                        ReconstructionVector &tasks,
+                                        size_t buffer_reccnt) {
+    size_t rec_size = sizeof(Wrapped<RecordType>);
+    size_t reccnt = structure->get_record_count();
+    if (reccnt > 0) {
+      size_t usage =
+          structure->get_memory_usage() + structure->get_aux_memory_usage();
+      rec_size = std::max(rec_size, usage / reccnt);
+    }
+
+    return (tasks.get_total_reccnt() + buffer_reccnt) * rec_size;
+  }
+
+  /*
+   * Schedule a buffer flush, along with any reconstructions needed to make
+   * room for it, against the active epoch. The flush is deferred (and
+   * false returned) if it won't fit within the memory budget alongside the
+   * reconstructions already running, or if any of the levels it involves
+   * are reserved by a background reconstruction. A flush is never deferred
+   * for memory when no other reconstruction is running, as it would then
+   * be deferred forever.
+   *
+   * The memory of the shards being replaced is not counted as freed, as it
+   * will remain allocated until the reconstruction is complete.
+   */
+  bool schedule_reconstruction() {
+    std::unique_lock<std::mutex> lk(m_level_lk);
+
+    auto epoch = get_active_epoch();
+    auto structure = epoch->get_structure();
+    size_t buffer_reccnt = m_buffer->get_high_watermark();
+
+    auto tasks = structure->get_reconstruction_tasks(buffer_reccnt);
+    /*
+     * the free blocks retained by the shared record pool are not part of
+     * any shard, but are still allocated, and so count against the budget
+     */
+    size_t used = m_buffer->get_memory_usage() +
+                  structure->get_memory_usage() +
+                  structure->get_aux_memory_usage() +
+                  get_record_pool().get_retained();
+    size_t estimate =
+        estimate_reconstruction_memory(structure, tasks, buffer_reccnt);
+    end_job(epoch);
+
+    if (!m_sched.get_memory_governor().admits(used, estimate)) {
+      m_deferred_reconstructions.fetch_add(1);
+      return false;
+    }
+
+    /*
+     * the flush involves L0, along with every level reconstructed into
+     * to make room within it
+     */
+    level_index last_level = 0;
+    for (size_t i = 0; i < tasks.size(); i++) {
+      last_level = std::max(last_level, tasks[i].target);
+    }
+
+    if (!reserve_levels(0, last_level)) {
+      return false;
+    }
 
     ReconstructionArgs<ShardType, QueryType, L> *args =
         new ReconstructionArgs<ShardType, QueryType, L>();
-    args->epoch = epoch;
-    args->merges = epoch->get_structure()->get_reconstruction_tasks(
-        m_buffer->get_high_watermark());
+    args->epoch = nullptr;
+    args->merges = tasks;
     args->extension = this;
     args->compaction = false;
+    args->flush = true;
+    args->first_level = 0;
+    args->last_level = last_level;
     /* NOTE: args is deleted by the reconstruction job, so shouldn't be freed
      * here */
 
-    m_sched.schedule_job(reconstruction, 0, args, RECONSTRUCTION);
+    m_active_reconstructions.fetch_add(1);
+    lk.unlock();
+
+    m_sched.schedule_job(reconstruction, estimate, args, RECONSTRUCTION);
+    return true;
+  }
+
+  /*
+   * Schedule reconstructions to empty any full levels of the active
+   * epoch's structure that are not already reserved, so that they are
+   * done ahead of time, concurrently with buffer flushes, rather than
+   * holding up the flush that next needs the space. Each runs as its own
+   * job, and installs its result independently. This has no benefit in
+   * single-threaded operation, and so is skipped there.
+   */
+  void schedule_background_reconstructions() {
+    if constexpr (std::same_as<SchedType, SerialScheduler>) {
+      return;
+    }
+
+    std::vector<std::pair<ReconstructionArgs<ShardType, QueryType, L> *,
+                          size_t>>
+        jobs;
+    {
+      std::unique_lock<std::mutex> lk(m_level_lk);
+      auto epoch = get_active_epoch();
+      auto structure = epoch->get_structure();
+      auto tasks = structure->get_background_reconstruction_tasks(
+          m_buffer->get_high_watermark());
+
+      for (size_t i = 0; i < tasks.size(); i++) {
+        auto task = tasks[i];
+        if (!reserve_levels(task.sources[0], task.target)) {
+          continue;
+        }
+
+        auto args = new ReconstructionArgs<ShardType, QueryType, L>();
+        args->epoch = nullptr;
+        args->merges.add_reconstruction(task.sources[0], task.target,
+                                        task.reccnt, task.move_reccnt);
+        args->extension = this;
+        args->compaction = false;
+        args->flush = false;
+        args->first_level = task.sources[0];
+        args->last_level = task.target;
+
+        jobs.push_back(
+            {args, estimate_reconstruction_memory(structure, args->merges, 0)});
+        m_active_reconstructions.fetch_add(1);
+      }
+
+      end_job(epoch);
+    }
+
+    for (auto &job : jobs) {
+      m_sched.schedule_job(reconstruction, job.second, job.first,
+                           RECONSTRUCTION);
+    }
   }
 
   std::future<QueryResult>
@@ -699,19 +1427,95 @@ private:
     return result;
   }
 
-  int internal_append(const RecordType &rec, bool ts) {
+  std::future<std::vector<QueryResult>>
+  schedule_query_batch(std::vector<Parameters> &&query_parms) {
+    auto args =
+        new BatchQueryArgs<ShardType, QueryType, DynamicExtension>();
+    args->extension = this;
+    args->query_parms = std::move(query_parms);
+    auto result = args->result_set.get_future();
+
+    m_sched.schedule_job(async_query_batch, 0, (void *)args, QUERY);
+
+    return result;
+  }
+
+  void check_low_watermark() {
     if (m_buffer->is_at_low_watermark()) {
+      /*
+       * if the last flush was deferred, and nothing has since happened
+       * that could let it proceed, there is no point in replanning it
+       */
+      size_t generation = m_retry_generation.load();
+      if (m_deferred_generation.load() == generation) {
+        return;
+      }
+
       auto old = false;
 
       if (m_reconstruction_scheduled.compare_exchange_strong(old, true)) {
-        schedule_reconstruction();
+        /*
+         * a reconstruction may have advanced the buffer head between
+         * the watermark check and acquiring the flag, in which case
+         * there may be nothing (or very little) left in the buffer to
+         * flush.
+         */
+        if (!m_buffer->is_at_low_watermark()) {
+          m_reconstruction_scheduled.store(false);
+          return;
+        }
+
+        /*
+         * the reconstruction may be deferred if it doesn't fit within the
+         * memory budget, or if it needs levels that are being
+         * reconstructed in the background. It will be attempted again on
+         * the first insert after a running reconstruction completes, or
+         * memory is released from the budget.
+         */
+        if (!schedule_reconstruction()) {
+          m_deferred_generation.store(generation);
+          m_reconstruction_scheduled.store(false);
+        }
       }
     }
+  }
+
+  void service_pending_inserts() {
+    {
+      std::unique_lock<std::mutex> lk(m_pending_insert_lk);
+      while (!m_pending_inserts.empty()) {
+        auto &pending = m_pending_inserts.front();
+        if (!m_buffer->append(pending.rec, false)) {
+          break;
+        }
+
+        pending.result.set_value(1);
+        m_pending_inserts.pop_front();
+      }
+    }
+
+    /*
+     * the inserts above bypass the watermark check, so it needs to be
+     * done here to ensure that any remaining queued inserts will
+     * eventually be serviced by a later flush
+     */
+    check_low_watermark();
+  }
+
+  int internal_append(const RecordType &rec, bool ts) {
+    check_low_watermark();
 
     /* this will fail if the HWM is reached and return 0 */
     return m_buffer->append(rec, ts);
   }
 
+  size_t internal_append_batch(std::span<const RecordType> recs, bool ts) {
+    check_low_watermark();
+
+    /* this will insert only a prefix of recs if the HWM is reached */
+    return m_buffer->append_batch(recs.data(), recs.size(), ts);
+  }
+
 #ifdef _GNU_SOURCE
   void SetThreadAffinity() {
     if constexpr (std::same_as<SchedType, SerialScheduler>) {
@@ -767,9 +1571,16 @@ private:
         old = m_current_epoch;
         /*
          * This could happen if we get into the system during a
-         * transition. In this case, we can just back out and retry
+         * transition. In this case, we can just back out and retry.
+         * The epoch may also have been moved into m_previous_epoch
+         * since it was checked above, in which case we need to retry
+         * against the previous epoch instead, or have been retired
+         * altogether.
          */
-        if (old.epoch == nullptr) {
+        if (old.epoch == nullptr || old.epoch != epoch) {
+          if (end_retired_job(epoch)) {
+            break;
+          }
           continue;
         }
 
@@ -782,5 +1593,33 @@ private:
       }
     } while (true);
   }
+
+  /*
+   * If epoch has been retired, release one job's reference to it,
+   * deleting it if that was the last one, and return true. Otherwise,
+   * return false.
+   */
+  bool end_retired_job(_Epoch *epoch) {
+    _Epoch *to_delete = nullptr;
+    {
+      std::unique_lock<std::mutex> lock(m_retired_epoch_lk);
+      auto retired = std::find_if(
+          m_retired_epochs.begin(), m_retired_epochs.end(),
+          [epoch](const epoch_ptr &ptr) { return ptr.epoch == epoch; });
+
+      if (retired == m_retired_epochs.end()) {
+        return false;
+      }
+
+      assert(retired->refcnt > 0);
+      if (--retired->refcnt == 0) {
+        to_delete = retired->epoch;
+        m_retired_epochs.erase(retired);
+      }
+    }
+
+    delete to_delete;
+    return true;
+  }
 };
 } // namespace de
@@ -15,3 +15,4 @@
 #include "framework/interface/Record.h"
 #include "framework/interface/Shard.h"
 #include "framework/interface/Query.h"
+#include "util/Allocators.h"
@@ -119,4 +119,38 @@ concept QueryInterface =
        */
       /* { QUERY::SKIP_DELETE_FILTER } -> std::convertible_to<bool>; */
     };
+
+/*
+ * Queries whose local queries against different shards can safely be
+ * answered concurrently may opt into having the framework do so by
+ * satisfying this interface. local_query_cost should return a cheap
+ * estimate of the work needed to answer `local` against `shard`, such
+ * as the number of records it will examine. The local queries are only
+ * spread across threads if the total estimated work across all of the
+ * shards is large enough to pay for doing so.
+ */
+template <typename QUERY, typename SHARD,
+          typename LOCAL = typename QUERY::LocalQuery>
+concept ParallelQueryInterface =
+    QueryInterface<QUERY, SHARD> && requires(SHARD *shard, LOCAL *local) {
+      { QUERY::local_query_cost(shard, local) } -> std::convertible_to<size_t>;
+    };
+
+/*
+ * Queries restricted to the keys within [lower_bound, upper_bound], such
+ * as range queries and range sampling. Shards containing no keys within
+ * this range cannot contribute to the result, and so are skipped.
+ */
+template <typename QUERY, typename PARAMETERS = typename QUERY::Parameters>
+concept KeyRangeQueryInterface = requires(PARAMETERS parms) {
+  { parms.lower_bound < parms.upper_bound } -> std::convertible_to<bool>;
+};
+
+/*
+ * Queries for the records with a single key, search_key.
+ */
+template <typename QUERY, typename PARAMETERS = typename QUERY::Parameters>
+concept PointQueryInterface = requires(PARAMETERS parms) {
+  { parms.search_key < parms.search_key } -> std::convertible_to<bool>;
+};
 } // namespace de
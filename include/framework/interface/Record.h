@@ -15,6 +15,7 @@
 #include <cstring>
 
 #include "psu-util/hash.h"
+#include "util/DistanceKernels.h"
 
 namespace de {
 
@@ -171,18 +172,8 @@ template <typename V, size_t D = 2> struct CosinePoint {
   }
 
   inline double calc_distance(const CosinePoint &other) const {
-
-    double prod = 0;
-    double asquared = 0;
-    double bsquared = 0;
-
-    for (size_t i = 0; i < D; i++) {
-      prod += data[i] * other.data[i];
-      asquared += data[i] * data[i];
-      bsquared += other.data[i] * other.data[i];
-    }
-
-    return prod / std::sqrt(asquared * bsquared);
+    auto terms = simd::cosine<V, D>(data, other.data);
+    return terms.prod / std::sqrt(terms.asquared * terms.bsquared);
   }
 };
 
@@ -213,15 +204,50 @@ template <typename V, size_t D = 2> struct EuclidPoint {
   }
 
   inline double calc_distance(const EuclidPoint &other) const {
-    double dist = 0;
-    for (size_t i = 0; i < D; i++) {
-      dist += (data[i] - other.data[i]) * (data[i] - other.data[i]);
-    }
+    return std::sqrt(calc_squared_distance(other));
+  }
 
-    return std::sqrt(dist);
+  /*
+   * The square of calc_distance, which orders points the same way
+   * without the cost of the square root
+   */
+  inline double calc_squared_distance(const EuclidPoint &other) const {
+    return simd::squared_euclidean<V, D>(data, other.data);
   }
 };
 
+/*
+ * Records providing the square of their distance function, which can be
+ * used in its place when only the relative order of distances matters.
+ */
+template <typename R>
+concept SquaredDistanceInterface = NDRecordInterface<R> && requires(R r, R s) {
+  { r.calc_squared_distance(s) } -> std::convertible_to<double>;
+};
+
+/*
+ * A monotone transformation of the distance between a and b, which is
+ * cheaper to compute than calc_distance for some records. Convert it
+ * back to a distance with ordering_to_distance.
+ */
+template <NDRecordInterface R>
+static inline double ordering_distance(const R &a, const R &b) {
+  if constexpr (SquaredDistanceInterface<R>) {
+    return a.calc_squared_distance(b);
+  } else {
+    return a.calc_distance(b);
+  }
+}
+
+template <NDRecordInterface R>
+static inline double ordering_to_distance(double dist) {
+  if constexpr (SquaredDistanceInterface<R>) {
+    return std::sqrt(dist);
+  } else {
+    return dist;
+  }
+}
+
 template <RecordInterface R> struct RecordHash {
   size_t operator()(R const &rec) const {
     return psudb::hash_bytes((std::byte *)&rec, sizeof(R));
@@ -8,6 +8,7 @@
  */
 #pragma once
 
+#include "framework/scheduling/MemoryGovernor.h"
 #include "framework/scheduling/Task.h"
 
 template <typename SchedType>
@@ -15,6 +16,10 @@ concept SchedulerInterface = requires(SchedType s, size_t i, void *vp,
                                       de::Job j) {
   {SchedType(i, i)};
   {s.schedule_job(j, i, vp, i)} -> std::convertible_to<void>;
+  {s.schedule_subtask(std::function<void()>())};
   {s.shutdown()};
   {s.print_statistics()};
+  {s.get_memory_budget()} -> std::convertible_to<size_t>;
+  {s.get_reserved_memory()} -> std::convertible_to<size_t>;
+  {s.get_memory_governor()} -> std::convertible_to<de::MemoryGovernor &>;
 };
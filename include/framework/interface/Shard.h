@@ -12,6 +12,20 @@
 
 namespace de {
 
+/*
+ * A pointer to a record stored within a shard. This is usually a
+ * Wrapped<R> *, but shards that do not store their records as an
+ * array of Wrapped<R> may return a pointer-like reference instead.
+ */
+template <typename P, typename R>
+concept WrappedPointerInterface = requires(P p) {
+  {static_cast<bool>(p)};
+  { p->is_tombstone() } -> std::convertible_to<bool>;
+  { p->is_deleted() } -> std::convertible_to<bool>;
+  {p->set_delete()};
+  { *p } -> std::convertible_to<Wrapped<R>>;
+};
+
 template <typename SHARD>
 concept ShardInterface = RecordInterface<typename SHARD::RECORD> &&
     requires(SHARD shard, const std::vector<SHARD *> &shard_vector, bool b,
@@ -26,7 +40,7 @@ concept ShardInterface = RecordInterface<typename SHARD::RECORD> &&
   /* perform a lookup for a record matching rec and return a pointer to it */
   {
     shard.point_lookup(rec, b)
-    } -> std::same_as<Wrapped<typename SHARD::RECORD> *>;
+    } -> WrappedPointerInterface<typename SHARD::RECORD>;
 
   /*
    * return the number of records in the shard -- used to determine when
@@ -65,4 +79,94 @@ concept SortedShardInterface = ShardInterface<SHARD> &&
     } -> std::same_as<Wrapped<typename SHARD::RECORD> *>;
 };
 
+/*
+ * Shards storing their records using the SOA layout (see
+ * util/SoAArray.h), which expose the record arrays directly.
+ */
+template <typename SHARD>
+concept SoAShardInterface = ShardInterface<SHARD> && requires(SHARD shard) {
+  {shard.get_columns()};
+};
+
+/*
+ * Shards over key-value records, sorted on key, whose records can be
+ * read in order starting from the first record not less than a key.
+ * These support streaming range scans (see DynamicExtension::scan).
+ */
+template <typename SHARD>
+concept ScannableShardInterface =
+    ShardInterface<SHARD> && KVPInterface<typename SHARD::RECORD> &&
+    requires(SHARD shard, decltype(SHARD::RECORD::key) key, size_t index) {
+  { shard.get_lower_bound(key) } -> std::convertible_to<size_t>;
+  {
+    *shard.get_record_at(index)
+    } -> std::convertible_to<Wrapped<typename SHARD::RECORD>>;
+};
+
+/*
+ * Shards over key-value records, sorted on key, that can be split into
+ * disjoint key ranges for use in partitioned leveling (see
+ * ExtensionStructure). In addition to locating keys within the shard,
+ * such a shard must be constructable from the records in a [start, stop)
+ * index range of each of a vector of shards, so that a partition can be
+ * built directly from a portion of its inputs.
+ */
+template <typename SHARD>
+concept PartitionedShardInterface =
+    ShardInterface<SHARD> && KVPInterface<typename SHARD::RECORD> &&
+    requires(SHARD shard, const std::vector<SHARD *> &shard_vector,
+             const std::vector<std::pair<size_t, size_t>> &ranges,
+             decltype(SHARD::RECORD::key) key, size_t index) {
+  {SHARD(shard_vector, ranges)};
+
+  /* the index of the first record with a key not less than key */
+  { shard.get_lower_bound(key) } -> std::convertible_to<size_t>;
+
+  { shard.get_record_at(index)->rec.key } -> std::convertible_to<decltype(key)>;
+};
+
+/*
+ * Shards over key-value records that maintain a filter over their keys
+ * (see util/ShardFilters.h). may_contain_key returns false only if no
+ * record in the shard has the key, allowing point lookups to skip the
+ * shard without searching it.
+ */
+template <typename SHARD>
+concept KeyFilteredShardInterface =
+    ShardInterface<SHARD> && KVPInterface<typename SHARD::RECORD> &&
+    requires(SHARD shard, decltype(SHARD::RECORD::key) key) {
+  { shard.may_contain_key(key) } -> std::convertible_to<bool>;
+};
+
+/*
+ * Shards over key-value records that report the smallest and largest
+ * keys within them, allowing queries over key ranges to skip shards
+ * that they do not overlap (see InternalLevel::get_local_queries). These
+ * are only called on non-empty shards.
+ */
+template <typename SHARD>
+concept KeyRangeShardInterface =
+    ShardInterface<SHARD> && KVPInterface<typename SHARD::RECORD> &&
+    requires(SHARD shard) {
+  {
+    shard.get_min_key()
+    } -> std::convertible_to<decltype(SHARD::RECORD::key)>;
+  {
+    shard.get_max_key()
+    } -> std::convertible_to<decltype(SHARD::RECORD::key)>;
+};
+
+/*
+ * Shards that maintain a coarse map of the keys within them (see
+ * util/ZoneMap.h). may_contain_range returns false only if no record in
+ * the shard has a key within [lower, upper], which may be the case even
+ * if the range falls between the shard's smallest and largest keys.
+ */
+template <typename SHARD>
+concept ZoneMappedShardInterface =
+    KeyRangeShardInterface<SHARD> &&
+    requires(SHARD shard, decltype(SHARD::RECORD::key) key) {
+  { shard.may_contain_range(key, key) } -> std::convertible_to<bool>;
+};
+
 } // namespace de
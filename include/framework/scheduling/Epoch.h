@@ -35,9 +35,18 @@ public:
       : m_buffer(buff), m_structure(structure), m_active_merge(false),
         m_epoch_number(number), m_buffer_head(head) {
     structure->take_reference();
+    m_buffer->take_head_reference(m_buffer_head);
   }
 
   ~Epoch() {
+    /*
+     * the epoch's buffer head is pinned for its whole lifetime, so that
+     * views of it can still be created after the buffer has moved on
+     */
+    if (m_buffer) {
+      m_buffer->release_head_reference(m_buffer_head);
+    }
+
     if (m_structure) {
       m_structure->release_reference();
     }
@@ -60,7 +69,11 @@ public:
 
   Structure *get_structure() { return m_structure; }
 
-  BufView get_buffer() { return m_buffer->get_buffer_view(m_buffer_head); }
+  BufView get_buffer(bool sort_runs = false) {
+    return m_buffer->get_buffer_view(m_buffer_head, sort_runs);
+  }
+
+  size_t get_buffer_head() { return m_buffer_head; }
 
   /*
    * Returns a new Epoch object that is a copy of this one. The new object
@@ -73,6 +86,7 @@ public:
     auto epoch = new Epoch(number);
     epoch->m_buffer = m_buffer;
     epoch->m_buffer_head = m_buffer_head;
+    m_buffer->take_head_reference(m_buffer_head);
 
     if (m_structure) {
       epoch->m_structure = m_structure->copy();
@@ -107,6 +121,9 @@ public:
   }
 
   bool advance_buffer_head(size_t head) {
+    m_buffer->take_head_reference(head);
+    m_buffer->release_head_reference(m_buffer_head);
+
     m_buffer_head = head;
     return m_buffer->advance_head(m_buffer_head);
   }
@@ -10,6 +10,14 @@
  * are available threads, the excess will stall until a thread becomes
  * available and then run in the order they were received by the scheduler.
  *
+ * The size of a job is the amount of memory (in bytes) that it is
+ * expected to allocate while running. A job is only started if this
+ * can be reserved from the memory budget alongside the jobs that are
+ * already running; otherwise it is deferred until enough running jobs
+ * have finished. Deferred jobs do not block later jobs that do fit,
+ * such as queries (which have a size of 0), but are started in the
+ * order they were received relative to one another.
+ *
  * TODO: We need to set up a custom threadpool based on jthreads to support
  * thread preemption for a later phase of this project. That will allow us
  * to avoid blocking epoch transitions on long-running queries, or to pause
@@ -17,10 +25,12 @@
  */
 #pragma once
 
+#include "framework/scheduling/MemoryGovernor.h"
 #include "framework/scheduling/Task.h"
 #include "framework/scheduling/statistics.h"
 #include <chrono>
 #include <condition_variable>
+#include <deque>
 #include <thread>
 
 #include "ctpl/ctpl.h"
@@ -36,9 +46,9 @@ private:
 
 public:
   FIFOScheduler(size_t memory_budget, size_t thread_cnt)
-      : m_memory_budget((memory_budget) ? memory_budget : UINT64_MAX),
+      : m_memory(memory_budget),
         m_thrd_cnt((thread_cnt) ? thread_cnt : DEFAULT_MAX_THREADS),
-        m_used_memory(0), m_used_thrds(0), m_shutdown(false) {
+        m_used_thrds(0), m_shutdown(false) {
     m_sched_thrd = std::thread(&FIFOScheduler::run, this);
     m_sched_wakeup_thrd = std::thread(&FIFOScheduler::periodic_wakeup, this);
     m_thrd_pool.resize(m_thrd_cnt);
@@ -64,6 +74,16 @@ public:
     m_cv.notify_all();
   }
 
+  /*
+   * Run task on the thread pool as soon as a thread is available,
+   * bypassing the job queue and the memory budget. This is used by a
+   * running job to spread its own work over idle threads, and so task
+   * must not block on work that hasn't started yet.
+   */
+  void schedule_subtask(std::function<void()> task) {
+    m_thrd_pool.push([task](int) { task(); });
+  }
+
   void shutdown() {
     m_shutdown.store(true);
     m_thrd_pool.stop(true);
@@ -72,10 +92,22 @@ public:
 
   void print_statistics() { m_stats.print_statistics(); }
 
+  size_t get_memory_budget() const { return m_memory.get_budget(); }
+
+  size_t get_reserved_memory() const { return m_memory.get_reserved(); }
+
+  MemoryGovernor &get_memory_governor() { return m_memory; }
+
 private:
   psudb::LockedPriorityQueue<Task> m_task_queue;
 
-  [[maybe_unused]] size_t m_memory_budget;
+  /*
+   * jobs that have been removed from the queue, but not yet started
+   * due to insufficient memory. Only accessed by the scheduling thread.
+   */
+  std::deque<Task> m_deferred;
+
+  MemoryGovernor m_memory;
   size_t m_thrd_cnt;
 
 
@@ -87,7 +119,6 @@ private:
   std::thread m_sched_wakeup_thrd;
   ctpl::thread_pool m_thrd_pool;
 
-  std::atomic<size_t> m_used_memory;
   std::atomic<size_t> m_used_thrds;
 
   std::atomic<bool> m_shutdown;
@@ -101,12 +132,23 @@ private:
     } while (!m_shutdown.load());
   }
 
-  void schedule_next() {
-    assert(m_task_queue.size() > 0);
-    auto t = m_task_queue.pop();
+  /*
+   * Start t on the thread pool if its memory can be reserved, returning
+   * false otherwise. The reservation is released once t completes.
+   */
+  bool try_schedule(Task &t) {
+    if (!m_memory.try_reserve(t.m_size)) {
+      return false;
+    }
+
     m_stats.job_scheduled(t.m_timestamp);
+    m_thrd_pool.push([this, t](int thrd_id) mutable {
+      t(thrd_id);
+      m_memory.release(t.m_size);
+      m_cv.notify_all();
+    });
 
-    m_thrd_pool.push(t);
+    return true;
   }
 
   void run() {
@@ -114,8 +156,22 @@ private:
       std::unique_lock<std::mutex> cv_lock(m_cv_lock);
       m_cv.wait(cv_lock);
 
+      /* deferred jobs get the first chance at any freed memory */
+      while (m_deferred.size() > 0 && m_thrd_pool.n_idle() > 0 &&
+             try_schedule(m_deferred.front())) {
+        m_deferred.pop_front();
+      }
+
       while (m_task_queue.size() > 0 && m_thrd_pool.n_idle() > 0) {
-        schedule_next();
+        auto t = m_task_queue.pop();
+
+        /*
+         * a job cannot be started ahead of an earlier deferred job
+         * that also needs memory, or the earlier one could starve
+         */
+        if ((t.m_size > 0 && m_deferred.size() > 0) || !try_schedule(t)) {
+          m_deferred.push_back(t);
+        }
       }
     } while (!m_shutdown.load());
   }
@@ -0,0 +1,116 @@
+/*
+ * include/framework/scheduling/MemoryGovernor.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * Accounting for the memory budget of a framework instance. Jobs that
+ * allocate memory (i.e., reconstructions) reserve an estimate of the
+ * memory they will allocate for the duration of their execution, and
+ * the governor tracks these reservations against the budget. It is
+ * used both by the schedulers, to defer jobs whose reservation won't
+ * fit alongside those already running, and by the framework itself, to
+ * defer reconstructions (and so throttle inserts) when the memory
+ * already in use by the index leaves no room for them.
+ *
+ * The budget is a soft limit. A job is always admitted when no other
+ * reservation is held, however large its estimate, and so the memory in
+ * use may exceed the budget, rather than jobs that can never fit being
+ * deferred forever. A budget of 0 is treated as unlimited.
+ */
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+
+namespace de {
+
+class MemoryGovernor {
+public:
+  MemoryGovernor(size_t memory_budget)
+      : m_budget((memory_budget) ? memory_budget : UINT64_MAX),
+        m_reserved(0) {}
+
+  /*
+   * Attempt to reserve bytes of memory, returning true if the
+   * reservation was made and false if it would exceed the budget. A
+   * reservation is always granted when no other reservation is held,
+   * so that a job whose estimate exceeds the budget on its own can
+   * still run eventually, rather than stalling forever.
+   */
+  bool try_reserve(size_t bytes) {
+    size_t reserved = m_reserved.load();
+    do {
+      if (reserved > 0 && !fits(reserved, bytes)) {
+        return false;
+      }
+    } while (!m_reserved.compare_exchange_weak(reserved, reserved + bytes));
+
+    return true;
+  }
+
+  /*
+   * Reserve bytes of memory regardless of the budget. Used where the
+   * job cannot be deferred, such as by the serial scheduler.
+   */
+  void reserve(size_t bytes) { m_reserved.fetch_add(bytes); }
+
+  /*
+   * Release a reservation of bytes of memory. If a release callback is
+   * set, it is called afterwards, so that anything deferred for lack of
+   * memory can be retried.
+   */
+  void release(size_t bytes) {
+    assert(m_reserved.load() >= bytes);
+    m_reserved.fetch_sub(bytes);
+
+    if (bytes > 0 && m_release_callback) {
+      m_release_callback();
+    }
+  }
+
+  /*
+   * Set a function to be called after each non-empty reservation is
+   * released. This must be set before any reservations are made.
+   */
+  void set_release_callback(std::function<void()> callback) {
+    m_release_callback = std::move(callback);
+  }
+
+  /*
+   * Return true if a job reserving bytes of memory could be admitted
+   * on top of used bytes of memory that are already allocated, along
+   * with all currently held reservations. As with try_reserve, a job is
+   * always admitted when no other reservation is held, as otherwise a
+   * job that will never fit (because used alone exceeds the budget, or
+   * its own estimate does) would be deferred indefinitely.
+   */
+  bool admits(size_t used, size_t bytes) const {
+    size_t reserved = m_reserved.load();
+    if (reserved == 0) {
+      return true;
+    }
+
+    return fits(used, reserved) && fits(used + reserved, bytes);
+  }
+
+  size_t get_budget() const { return m_budget; }
+
+  size_t get_reserved() const { return m_reserved.load(); }
+
+private:
+  size_t m_budget;
+  std::atomic<size_t> m_reserved;
+  std::function<void()> m_release_callback;
+
+  /* true if a + b <= m_budget, without overflowing */
+  bool fits(size_t a, size_t b) const {
+    return a <= m_budget && b <= m_budget - a;
+  }
+};
+
+} // namespace de
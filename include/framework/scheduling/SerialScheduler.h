@@ -11,9 +11,14 @@
  * function will immediately run the job and block on its completion before
  * returning.
  *
+ * As jobs cannot be deferred, the size of each job is reserved from the
+ * memory budget for the duration of its execution regardless of
+ * whether it fits, so that the reservation can still be reported.
+ *
  */
 #pragma once
 
+#include "framework/scheduling/MemoryGovernor.h"
 #include "framework/scheduling/Task.h"
 #include "framework/scheduling/statistics.h"
 
@@ -22,9 +27,9 @@ namespace de {
 class SerialScheduler {
 public:
   SerialScheduler(size_t memory_budget, size_t thread_cnt)
-      : m_memory_budget((memory_budget) ? memory_budget : UINT64_MAX),
-        m_thrd_cnt((thread_cnt) ? thread_cnt : UINT64_MAX), m_used_memory(0),
-        m_used_thrds(0), m_counter(0) {}
+      : m_memory(memory_budget),
+        m_thrd_cnt((thread_cnt) ? thread_cnt : UINT64_MAX), m_used_thrds(0),
+        m_counter(0) {}
 
   ~SerialScheduler() = default;
 
@@ -34,18 +39,32 @@ public:
     m_stats.job_queued(ts, type, size);
     m_stats.job_scheduled(ts);
     auto t = Task(size, ts, job, args, type, &m_stats);
+
+    m_memory.reserve(size);
     t(0);
+    m_memory.release(size);
   }
 
+  /*
+   * There are no other threads to run task on, and so it is run
+   * immediately.
+   */
+  void schedule_subtask(std::function<void()> task) { task(); }
+
   void shutdown() { /* intentionally left blank */ }
 
   void print_statistics() { m_stats.print_statistics(); }
 
+  size_t get_memory_budget() const { return m_memory.get_budget(); }
+
+  size_t get_reserved_memory() const { return m_memory.get_reserved(); }
+
+  MemoryGovernor &get_memory_governor() { return m_memory; }
+
 private:
-  [[maybe_unused]] size_t m_memory_budget;
+  MemoryGovernor m_memory;
   [[maybe_unused]] size_t m_thrd_cnt;
 
-  [[maybe_unused]] size_t m_used_memory;
   [[maybe_unused]] size_t m_used_thrds;
 
   size_t m_counter;
@@ -31,6 +31,14 @@ struct ReconstructionArgs {
   ReconstructionVector merges;
   std::promise<bool> result;
   bool compaction;
+
+  /* whether the buffer is flushed following the merges */
+  bool flush;
+
+  /* the levels reserved by, and installed following, the reconstruction */
+  level_index first_level;
+  level_index last_level;
+
   void *extension;
 };
 
@@ -40,6 +48,13 @@ template <ShardInterface S, QueryInterface<S> Q, typename DE> struct QueryArgs {
   DE *extension;
 };
 
+template <ShardInterface S, QueryInterface<S> Q, typename DE>
+struct BatchQueryArgs {
+  std::promise<std::vector<typename Q::ResultType>> result_set;
+  std::vector<typename Q::Parameters> query_parms;
+  DE *extension;
+};
+
 typedef std::function<void(void *)> Job;
 
 struct Task {
@@ -9,19 +9,51 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstdlib>
 #include <functional>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "framework/interface/Record.h"
-#include "psu-ds/BloomFilter.h"
 #include "psu-util/alignment.h"
+#include "util/BlockedBloomFilter.h"
+#include "util/ScanKernels.h"
 
 namespace de {
 
 typedef std::function<void(void)> ReleaseFunction;
 
+/*
+ * Records can be located within the buffer by key, using a per-segment
+ * hash index, only if they have a key that can be hashed and compared
+ * by value. String keys are stored as pointers, and so are excluded.
+ */
+template <typename R>
+concept BufferIndexable =
+    KVPInterface<R> && !std::is_pointer_v<decltype(R::key)>;
+
+template <typename K> static size_t buffer_index_hash(const K &key) {
+  return psudb::hash_bytes((std::byte *)&key, sizeof(K));
+}
+
+/*
+ * A segment of the buffer, as seen by a BufferView. The run is the
+ * sorted order of the offsets within the segment, or nullptr if it has
+ * not been sorted. The index is an open-addressing hash table of twice
+ * the segment size, mapping each record's key to its offset (stored as
+ * offset + 1, with 0 marking an empty slot), or nullptr if the buffer
+ * does not maintain one.
+ */
+template <RecordInterface R> struct BufferSegment {
+  Wrapped<R> *data;
+  const uint32_t *run;
+  const std::atomic<uint32_t> *index;
+};
+
 template <RecordInterface R> class BufferView {
 public:
   BufferView() = default;
@@ -34,12 +66,13 @@ public:
   BufferView &operator=(BufferView &) = delete;
 
   BufferView(BufferView &&other)
-      : m_data(std::exchange(other.m_data, nullptr)),
+      : m_segments(std::move(other.m_segments)),
         m_release(std::move(other.m_release)),
         m_head(std::exchange(other.m_head, 0)),
         m_tail(std::exchange(other.m_tail, 0)),
-        m_start(std::exchange(other.m_start, 0)),
-        m_stop(std::exchange(other.m_stop, 0)),
+        m_offset(std::exchange(other.m_offset, 0)),
+        m_seg_shift(std::exchange(other.m_seg_shift, 0)),
+        m_seg_mask(std::exchange(other.m_seg_mask, 0)),
         m_cap(std::exchange(other.m_cap, 0)),
         m_approx_ts_cnt(std::exchange(other.m_approx_ts_cnt, 0)),
         m_tombstone_filter(std::exchange(other.m_tombstone_filter, nullptr)),
@@ -47,12 +80,20 @@ public:
 
   BufferView &operator=(BufferView &&other) = delete;
 
-  BufferView(Wrapped<R> *buffer, size_t cap, size_t head, size_t tail,
-             size_t tombstone_cnt, psudb::BloomFilter<R> *filter,
-             ReleaseFunction release)
-      : m_data(buffer), m_release(release), m_head(head), m_tail(tail),
-        m_start(m_head % cap), m_stop(m_tail % cap), m_cap(cap),
-        m_approx_ts_cnt(tombstone_cnt), m_tombstone_filter(filter),
+  /*
+   * The records within the view are stored across a sequence of
+   * fixed-size buffer segments, each of 2^seg_shift records. The
+   * first segment is the one containing the head record, and the
+   * view does not own any of them--the buffer will not recycle
+   * them until the release function has been called.
+   */
+  BufferView(std::vector<BufferSegment<R>> segments, size_t seg_shift,
+             size_t cap, size_t head, size_t tail, size_t tombstone_cnt,
+             BlockedBloomFilter<R> *filter, ReleaseFunction release)
+      : m_segments(std::move(segments)), m_release(release), m_head(head),
+        m_tail(tail), m_offset(head & ((1ull << seg_shift) - 1)),
+        m_seg_shift(seg_shift), m_seg_mask((1ull << seg_shift) - 1),
+        m_cap(cap), m_approx_ts_cnt(tombstone_cnt), m_tombstone_filter(filter),
         m_active(true) {}
 
   ~BufferView() {
@@ -65,8 +106,18 @@ public:
     if (m_tombstone_filter && !m_tombstone_filter->lookup(rec))
       return false;
 
+    if constexpr (BufferIndexable<R>) {
+      bool found = false;
+      for_each_with_key(rec.key, [&rec, &found](Wrapped<R> *wrec) {
+        found = wrec->rec == rec && wrec->is_tombstone();
+        return !found;
+      });
+
+      return found;
+    }
+
     for (size_t i = 0; i < get_record_count(); i++) {
-      if (m_data[to_idx(i)].rec == rec && m_data[to_idx(i)].is_tombstone()) {
+      if (get(i)->rec == rec && get(i)->is_tombstone()) {
         return true;
       }
     }
@@ -75,26 +126,23 @@ public:
   }
 
   bool delete_record(const R &rec) {
-    if (m_start < m_stop) {
-      for (size_t i = m_start; i < m_stop; i++) {
-        if (m_data[i].rec == rec) {
-          m_data[i].set_delete();
-          return true;
-        }
-      }
-    } else {
-      for (size_t i = m_start; i < m_cap; i++) {
-        if (m_data[i].rec == rec) {
-          m_data[i].set_delete();
-          return true;
+    if constexpr (BufferIndexable<R>) {
+      bool found = false;
+      for_each_with_key(rec.key, [&rec, &found](Wrapped<R> *wrec) {
+        if (wrec->rec == rec) {
+          wrec->set_delete();
+          found = true;
         }
-      }
+        return !found;
+      });
 
-      for (size_t i = 0; i < m_stop; i++) {
-        if (m_data[i].rec == rec) {
-          m_data[i].set_delete();
-          return true;
-        }
+      return found;
+    }
+
+    for (size_t i = 0; i < get_record_count(); i++) {
+      if (get(i)->rec == rec) {
+        get(i)->set_delete();
+        return true;
       }
     }
 
@@ -113,22 +161,200 @@ public:
   size_t get_tombstone_count() { return m_approx_ts_cnt; }
 
   Wrapped<R> *get(size_t i) {
-    return m_data + to_idx(i);
+    size_t idx = m_offset + i;
+    assert((idx >> m_seg_shift) < m_segments.size());
+    return m_segments[idx >> m_seg_shift].data + (idx & m_seg_mask);
   }
 
   void copy_to_buffer(psudb::byte *buffer) {
-    /* check if the region to be copied circles back to start. If so, do it in
-     * two steps */
-    if (m_start > m_stop) {
-      size_t split_idx = m_cap - m_start;
-
-      memcpy(buffer, (std::byte *)(m_data + m_start),
-             split_idx * sizeof(Wrapped<R>));
-      memcpy(buffer + (split_idx * sizeof(Wrapped<R>)), (std::byte *)m_data,
-             m_stop * sizeof(Wrapped<R>));
-    } else {
-      memcpy(buffer, (std::byte *)(m_data + m_start),
-             get_record_count() * sizeof(Wrapped<R>));
+    /* copy the records out one segment at a time */
+    size_t copied = 0;
+    size_t offset = m_offset;
+    for (size_t i = 0; copied < get_record_count(); i++) {
+      size_t cnt =
+          std::min(get_record_count() - copied, (m_seg_mask + 1) - offset);
+      memcpy(buffer + (copied * sizeof(Wrapped<R>)),
+             (std::byte *)(m_segments[i].data + offset),
+             cnt * sizeof(Wrapped<R>));
+      copied += cnt;
+      offset = 0;
+    }
+  }
+
+  /*
+   * Copy the records in the view into buffer in sorted order. Each
+   * segment's records are copied in the order given by its sorted run,
+   * if it has one, or are sorted after being copied otherwise. The
+   * resulting runs are then merged together, rather than sorting the
+   * whole buffer at once.
+   *
+   * Equal records are kept in insertion order, so that a record is
+   * always followed by any tombstones for it that were inserted later.
+   */
+  void copy_to_buffer_sorted(psudb::byte *buffer) {
+    auto recs = (Wrapped<R> *)buffer;
+    auto cmp = [](const Wrapped<R> &a, const Wrapped<R> &b) {
+      return a.rec < b.rec;
+    };
+
+    bool has_runs = false;
+    for (auto &seg : m_segments) {
+      has_runs |= seg.run != nullptr;
+    }
+
+    if (!has_runs) {
+      copy_to_buffer(buffer);
+      std::stable_sort(recs, recs + get_record_count(), cmp);
+      return;
+    }
+
+    std::vector<size_t> bounds = {0};
+    size_t copied = 0;
+    for (size_t i = 0; i < m_segments.size(); i++) {
+      size_t start = get_segment_start(i);
+      size_t stop = get_segment_stop(i);
+
+      if (m_segments[i].run) {
+        for (size_t j = 0; j <= m_seg_mask; j++) {
+          size_t idx = m_segments[i].run[j];
+          if (idx >= start && idx < stop) {
+            recs[copied++] = m_segments[i].data[idx];
+          }
+        }
+      } else {
+        memcpy(recs + copied, m_segments[i].data + start,
+               (stop - start) * sizeof(Wrapped<R>));
+        std::stable_sort(recs + copied, recs + copied + (stop - start), cmp);
+        copied += stop - start;
+      }
+
+      bounds.push_back(copied);
+    }
+
+    /* merge adjacent pairs of runs until only one remains */
+    size_t run_cnt = bounds.size() - 1;
+    for (size_t width = 1; width < run_cnt; width *= 2) {
+      for (size_t i = 0; i + width < run_cnt; i += 2 * width) {
+        std::inplace_merge(recs + bounds[i], recs + bounds[i + width],
+                           recs + bounds[std::min(i + 2 * width, run_cnt)],
+                           cmp);
+      }
+    }
+  }
+
+  /*
+   * Call f on each record in the view with a key in the range
+   * [lower, upper], stopping early if f returns false. Segments are
+   * visited in insertion order. Segments with a sorted run are binary
+   * searched, and the others are scanned (using the vectorized scan
+   * kernels, where the key type supports them).
+   *
+   * NOTE: pointer keys (i.e., strings) are compared by address here, which
+   *       does not match the order of the sorted runs, so they are always
+   *       scanned.
+   */
+  template <typename K, typename F>
+  void for_each_in_range(const K &lower, const K &upper, F &&f) {
+    for (size_t i = 0; i < m_segments.size(); i++) {
+      Wrapped<R> *data = m_segments[i].data;
+      const uint32_t *run = m_segments[i].run;
+      size_t start = get_segment_start(i);
+      size_t stop = get_segment_stop(i);
+
+      if (!std::is_pointer_v<K> && run) {
+        const uint32_t *run_end = run + m_seg_mask + 1;
+        auto pos = std::partition_point(
+            run, run_end,
+            [data, &lower](uint32_t idx) { return data[idx].rec.key < lower; });
+
+        for (; pos < run_end && data[*pos].rec.key <= upper; pos++) {
+          if (*pos >= start && *pos < stop && !f(data + *pos)) {
+            return;
+          }
+        }
+      } else if (!simd::scan_range(data + start, stop - start, lower, upper,
+                                   f)) {
+        return;
+      }
+    }
+  }
+
+  /*
+   * Count the records in the view with a key in the range [lower, upper]
+   * that have not been tagged as deleted, and the number of those that
+   * are tombstones.
+   */
+  template <typename K>
+  void count_in_range(const K &lower, const K &upper, size_t &reccnt,
+                      size_t &tscnt) {
+    reccnt = 0;
+    tscnt = 0;
+
+    for (size_t i = 0; i < m_segments.size(); i++) {
+      Wrapped<R> *data = m_segments[i].data;
+      const uint32_t *run = m_segments[i].run;
+      size_t start = get_segment_start(i);
+      size_t stop = get_segment_stop(i);
+
+      if (!std::is_pointer_v<K> && run) {
+        const uint32_t *run_end = run + m_seg_mask + 1;
+        auto pos = std::partition_point(
+            run, run_end,
+            [data, &lower](uint32_t idx) { return data[idx].rec.key < lower; });
+
+        for (; pos < run_end && data[*pos].rec.key <= upper; pos++) {
+          if (*pos >= start && *pos < stop && !data[*pos].is_deleted()) {
+            reccnt++;
+            tscnt += data[*pos].is_tombstone();
+          }
+        }
+      } else {
+        simd::count_range(data + start, stop - start, lower, upper, false,
+                          reccnt, tscnt);
+      }
+    }
+  }
+
+  /*
+   * Call f on each record in the view with the specified key, stopping
+   * early if f returns false. Segments are visited in insertion order.
+   * Segments with a hash index are probed, and the others are scanned.
+   */
+  template <typename K, typename F>
+  void for_each_with_key(const K &key, F &&f) {
+    size_t index_mask = (2ull << m_seg_shift) - 1;
+
+    for (size_t i = 0; i < m_segments.size(); i++) {
+      Wrapped<R> *data = m_segments[i].data;
+      const std::atomic<uint32_t> *index = m_segments[i].index;
+      size_t start = get_segment_start(i);
+      size_t stop = get_segment_stop(i);
+
+      if constexpr (BufferIndexable<R>) {
+        if (index) {
+          /*
+           * the index may contain records that were appended after the
+           * view was created, so offsets must still be bounds checked
+           */
+          size_t slot = buffer_index_hash(key) & index_mask;
+          uint32_t entry;
+          while ((entry = index[slot].load()) != 0) {
+            size_t idx = entry - 1;
+            if (idx >= start && idx < stop && data[idx].rec.key == key &&
+                !f(data + idx)) {
+              return;
+            }
+
+            slot = (slot + 1) & index_mask;
+          }
+
+          continue;
+        }
+      }
+
+      if (!simd::scan_range(data + start, stop - start, key, key, f)) {
+        return;
+      }
     }
   }
 
@@ -137,21 +363,26 @@ public:
   size_t get_head() { return m_head; }
 
 private:
-  Wrapped<R> *m_data;
+  std::vector<BufferSegment<R>> m_segments;
   ReleaseFunction m_release;
   size_t m_head;
   size_t m_tail;
-  size_t m_start;
-  size_t m_stop;
+  size_t m_offset;
+  size_t m_seg_shift;
+  size_t m_seg_mask;
   size_t m_cap;
   size_t m_approx_ts_cnt;
-  psudb::BloomFilter<R> *m_tombstone_filter;
+  BlockedBloomFilter<R> *m_tombstone_filter;
   bool m_active;
 
-  size_t to_idx(size_t i) {
-    size_t idx = (m_start + i >= m_cap) ? i - (m_cap - m_start) : m_start + i;
-    assert(idx < m_cap);
-    return idx;
+  /*
+   * the range of offsets within segment i that fall within the view
+   */
+  size_t get_segment_start(size_t i) { return (i == 0) ? m_offset : 0; }
+
+  size_t get_segment_stop(size_t i) {
+    return std::min(m_seg_mask + 1,
+                    m_offset + get_record_count() - (i << m_seg_shift));
   }
 };
 
@@ -40,10 +40,31 @@ class ExtensionStructure {
   typedef std::vector<level_state> state_vector;
 
 public:
+  /*
+   * A contiguous range of the levels of a structure, along with their
+   * state, starting at level first. Used to install the results of a
+   * reconstruction performed on one copy of the structure into another.
+   */
+  struct level_delta {
+    level_index first;
+    std::vector<std::shared_ptr<InternalLevel<ShardType, QueryType>>> levels;
+    state_vector state;
+  };
+
+  /*
+   * If partition_size is non-zero, and the structure uses leveling over a
+   * shard type supporting it, each level is split into key-range
+   * partitions of no more than partition_size records. Reconstructions
+   * then move only as many partitions as are needed to make room in a
+   * level, and merge them only with the partitions of the level below
+   * that overlap them, which bounds the amount of work done by each.
+   * Smaller partitions reduce the work per reconstruction, at the cost of
+   * performing reconstructions more often.
+   */
   ExtensionStructure(size_t buffer_size, size_t scale_factor,
-                     double max_delete_prop)
+                     double max_delete_prop, size_t partition_size = 0)
       : m_scale_factor(scale_factor), m_max_delete_prop(max_delete_prop),
-        m_buffer_size(buffer_size) {}
+        m_buffer_size(buffer_size), m_partition_size(partition_size) {}
 
   ~ExtensionStructure() = default;
 
@@ -64,7 +85,7 @@ public:
    */
   ExtensionStructure<ShardType, QueryType, L> *copy() {
     auto new_struct = new ExtensionStructure<ShardType, QueryType, L>(
-        m_buffer_size, m_scale_factor, m_max_delete_prop);
+        m_buffer_size, m_scale_factor, m_max_delete_prop, m_partition_size);
     for (size_t i = 0; i < m_levels.size(); i++) {
       new_struct->m_levels.push_back(m_levels[i]->clone());
     }
@@ -293,6 +314,11 @@ public:
       scratch_state = m_current_state;
     }
 
+    if (is_partitioned()) {
+      return get_partitioned_reconstruction_tasks(buffer_reccnt,
+                                                  scratch_state);
+    }
+
     ReconstructionVector reconstructions;
     size_t LOOKAHEAD = 1;
     for (size_t i = 0; i < LOOKAHEAD; i++) {
@@ -334,6 +360,38 @@ public:
     return reconstructions;
   }
 
+  /*
+   * Return the reconstruction that can be performed ahead of time to
+   * shorten the next buffer flush of buffer_reccnt records. This is the
+   * deepest reconstruction within the cascade that the flush would
+   * trigger, and so only work that the flush would have to do anyway
+   * is returned--running it early doesn't change the resulting layout.
+   * Reconstructions out of level 0 are excluded, as they are handled
+   * by the flush itself.
+   *
+   * The returned reconstruction doesn't depend on any other pending
+   * reconstruction, and so can be run concurrently with those that
+   * don't involve its levels. Once it completes, calling this function
+   * again will return the next reconstruction up the cascade. Under
+   * BSM, every reconstruction involves all of the levels above its
+   * target, and so none are returned.
+   */
+  ReconstructionVector
+  get_background_reconstruction_tasks(size_t buffer_reccnt) {
+    ReconstructionVector tasks;
+
+    if constexpr (L == LayoutPolicy::BSM) {
+      return tasks;
+    }
+
+    auto flush_tasks = get_reconstruction_tasks(buffer_reccnt);
+    if (flush_tasks.size() > 0 && flush_tasks[0].sources[0] > 0) {
+      tasks.add_reconstruction(flush_tasks[0]);
+    }
+
+    return tasks;
+  }
+
   /*
    *
    */
@@ -457,9 +515,15 @@ public:
    * placing it in base_level. The two levels should be sequential--i.e. no
    * levels are skipped in the reconstruction process--otherwise the
    * tombstone ordering invariant may be violated.
+   *
+   * If the levels are partitioned, only partitions containing at least
+   * move_reccnt records are moved out of incoming_level (all of them, if
+   * move_reccnt is 0), and merged with the overlapping partitions of
+   * base_level. Otherwise, move_reccnt is ignored.
    */
   inline void reconstruction(level_index base_level,
-                             level_index incoming_level) {
+                             level_index incoming_level,
+                             size_t move_reccnt = 0) {
     size_t shard_capacity = (L == LayoutPolicy::LEVELING) ? 1 : m_scale_factor;
 
     if (base_level >= (level_index) m_levels.size()) {
@@ -471,6 +535,11 @@ public:
           {0, calc_level_record_capacity(base_level), 0, shard_capacity});
     }
 
+    if (is_partitioned()) {
+      partitioned_reconstruction(base_level, incoming_level, move_reccnt);
+      return;
+    }
+
     if constexpr (L == LayoutPolicy::LEVELING) {
       /* if the base level has a shard, merge the base and incoming together to
        * make a new one */
@@ -507,6 +576,42 @@ public:
         0, calc_level_record_capacity(incoming_level), 0, shard_capacity};
   }
 
+  /*
+   * Return the levels within [first, last], along with their state. Any
+   * levels in the range that don't exist are omitted.
+   */
+  level_delta get_level_delta(level_index first, level_index last) {
+    level_delta delta;
+    delta.first = first;
+
+    for (level_index i = first;
+         i <= last && i < (level_index)m_levels.size(); i++) {
+      delta.levels.push_back(m_levels[i]);
+      delta.state.push_back(m_current_state[i]);
+    }
+
+    return delta;
+  }
+
+  /*
+   * Replace the levels of the structure covered by delta with those in
+   * delta, adding new levels to the bottom of the structure as needed.
+   */
+  void apply_level_delta(const level_delta &delta) {
+    for (size_t i = 0; i < delta.levels.size(); i++) {
+      level_index idx = delta.first + i;
+      assert(idx <= (level_index)m_levels.size());
+
+      if (idx == (level_index)m_levels.size()) {
+        m_levels.push_back(delta.levels[i]);
+        m_current_state.push_back(delta.state[i]);
+      } else {
+        m_levels[idx] = delta.levels[i];
+        m_current_state[idx] = delta.state[i];
+      }
+    }
+  }
+
   bool take_reference() {
     m_refcnt.fetch_add(1);
     return true;
@@ -533,10 +638,32 @@ public:
     return queries;
   }
 
+  /*
+   * As get_local_queries, but for a batch of queries. The local queries
+   * for parms[i] are returned in the ith vector, and the shards they
+   * are over are appended to shards[i].
+   */
+  std::vector<std::vector<typename QueryType::LocalQuery *>>
+  get_batch_local_queries(
+      std::vector<std::vector<std::pair<ShardID, ShardType *>>> &shards,
+      std::vector<typename QueryType::Parameters *> &parms) {
+
+    std::vector<std::vector<typename QueryType::LocalQuery *>> queries(
+        parms.size());
+    shards.resize(parms.size());
+
+    for (auto &level : m_levels) {
+      level->get_batch_local_queries(shards, queries, parms);
+    }
+
+    return queries;
+  }
+
 private:
   size_t m_scale_factor;
   double m_max_delete_prop;
   size_t m_buffer_size;
+  size_t m_partition_size;
 
   std::atomic<size_t> m_refcnt;
 
@@ -549,6 +676,120 @@ private:
    */
   state_vector m_current_state;
 
+  /*
+   * Return true if the levels of the structure are split into key-range
+   * partitions. This requires the leveling layout policy, and a shard
+   * type that supports partitioning.
+   */
+  constexpr bool is_partitioned() const {
+    if constexpr (L == LayoutPolicy::LEVELING &&
+                  PartitionedShardInterface<ShardType>) {
+      return m_partition_size > 0;
+    }
+
+    return false;
+  }
+
+  /*
+   * Determine the reconstructions needed to make room for a flush of
+   * buffer_reccnt records into a partitioned structure. Each level that
+   * can't hold the records coming into it moves just enough records
+   * (in the form of partitions) into the level below to make room for
+   * them, which may in turn require room to be made there. The tasks are
+   * returned in the order in which they must be performed, starting with
+   * the deepest level.
+   */
+  ReconstructionVector
+  get_partitioned_reconstruction_tasks(size_t buffer_reccnt,
+                                       state_vector &scratch_state) {
+    std::vector<ReconstructionTask> tasks;
+
+    if (scratch_state.size() == 0) {
+      grow(scratch_state);
+    }
+
+    size_t incoming_reccnt = buffer_reccnt;
+    for (level_index i = 0;
+         !can_reconstruct_with(i, incoming_reccnt, scratch_state); i++) {
+      if (i + 1 == (level_index)scratch_state.size()) {
+        grow(scratch_state);
+      }
+
+      size_t move_reccnt = std::min(scratch_state[i].reccnt,
+                                    scratch_state[i].reccnt + incoming_reccnt -
+                                        scratch_state[i].reccap);
+      size_t reccnt =
+          move_reccnt + estimate_overlap(i, i + 1, move_reccnt, scratch_state);
+      tasks.push_back({{i}, i + 1, reccnt, move_reccnt});
+
+      scratch_state[i].reccnt -= move_reccnt;
+      scratch_state[i + 1].reccnt += move_reccnt;
+      scratch_state[i + 1].shardcnt =
+          std::max<size_t>(scratch_state[i + 1].shardcnt, 1);
+
+      incoming_reccnt = move_reccnt;
+    }
+
+    ReconstructionVector reconstructions;
+    for (auto task = tasks.rbegin(); task != tasks.rend(); task++) {
+      reconstructions.add_reconstruction(task->sources[0], task->target,
+                                         task->reccnt, task->move_reccnt);
+    }
+
+    return reconstructions;
+  }
+
+  /*
+   * Estimate the number of records in target_level that will be merged
+   * with move_reccnt records moved into it from source_level, assuming
+   * that the levels have similar key distributions. For unpartitioned
+   * levels, this is the whole target level.
+   */
+  size_t estimate_overlap(level_index source_level, level_index target_level,
+                          size_t move_reccnt, state_vector &state) {
+    if (target_level >= (level_index)state.size()) {
+      return 0;
+    }
+
+    size_t target_reccnt = state[target_level].reccnt;
+    size_t source_reccnt = state[source_level].reccnt;
+    if (!is_partitioned() || source_reccnt == 0 ||
+        move_reccnt >= source_reccnt) {
+      return target_reccnt;
+    }
+
+    return (size_t)((double)target_reccnt * move_reccnt / source_reccnt);
+  }
+
+  /*
+   * Move partitions containing at least move_reccnt records (or all of
+   * them, if move_reccnt is 0) from incoming_level into base_level,
+   * merging them with the partitions of base_level that they overlap.
+   * The partitions moved are those that require the least rewriting of
+   * base_level, as determined by InternalLevel::select_partitions.
+   */
+  void partitioned_reconstruction(level_index base_level,
+                                  level_index incoming_level,
+                                  size_t move_reccnt) {
+    if constexpr (PartitionedShardInterface<ShardType>) {
+      auto source = m_levels[incoming_level];
+      auto [first, last] =
+          source->select_partitions(m_levels[base_level].get(), move_reccnt);
+
+      m_levels[base_level] =
+          InternalLevel<ShardType, QueryType>::partitioned_reconstruction(
+              m_levels[base_level].get(), source.get(), first, last,
+              m_partition_size);
+      m_levels[incoming_level] = source->clone_without_shards(first, last);
+
+      for (auto idx : {base_level, incoming_level}) {
+        m_current_state[idx] = {m_levels[idx]->get_record_count(),
+                                calc_level_record_capacity(idx),
+                                m_levels[idx]->get_shard_count(), 1};
+      }
+    }
+  }
+
   /*
    * Add a new level to the scratch state and return its index.
    *
@@ -613,7 +854,14 @@ private:
       auto temp_level = new InternalLevel<ShardType, QueryType>(0, 1);
       temp_level->append_buffer(std::move(buffer));
 
-      if (old_level->get_shard_count() > 0) {
+      if (is_partitioned()) {
+        if constexpr (PartitionedShardInterface<ShardType>) {
+          m_levels[0] =
+              InternalLevel<ShardType, QueryType>::partitioned_reconstruction(
+                  old_level, temp_level, 0, 1, m_partition_size);
+        }
+        delete temp_level;
+      } else if (old_level->get_shard_count() > 0) {
         m_levels[0] = InternalLevel<ShardType, QueryType>::reconstruction(
             old_level, temp_level);
         delete temp_level;
@@ -15,6 +15,8 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <limits>
 #include <memory>
 #include <vector>
 
@@ -77,6 +79,130 @@ public:
     return std::shared_ptr<InternalLevel>(res);
   }
 
+  /*
+   * Merge the records of the shards within [first, last) of new_level
+   * with those of the shards of base_level whose key ranges overlap them,
+   * splitting the result into key-range partitions of no more than
+   * partition_size records, and return a new level containing these along
+   * with the remaining shards of base_level, in key order. This is used
+   * for reconstructions under the leveling layout policy when levels are
+   * partitioned, in which case the shards of each level have disjoint
+   * key ranges and are stored in key order.
+   *
+   * If none of the shards of base_level overlap the incoming ones, the
+   * incoming shards are moved into the new level as is, rather than being
+   * rebuilt, unless they are too large.
+   *
+   * No changes are made to the levels provided as arguments.
+   */
+  static std::shared_ptr<InternalLevel>
+  partitioned_reconstruction(InternalLevel *base_level,
+                             InternalLevel *new_level, size_t first,
+                             size_t last, size_t partition_size)
+    requires PartitionedShardInterface<ShardType>
+  {
+    assert(base_level->m_level_no > new_level->m_level_no ||
+           (base_level->m_level_no == 0 && new_level->m_level_no == 0));
+    assert(partition_size > 0);
+
+    std::vector<std::shared_ptr<ShardType>> incoming;
+    for (size_t i = first; i < last && i < new_level->m_shard_cnt; i++) {
+      if (new_level->m_shards[i] &&
+          new_level->m_shards[i]->get_record_count() > 0) {
+        incoming.push_back(new_level->m_shards[i]);
+      }
+    }
+
+    if (incoming.size() == 0) {
+      return base_level->clone();
+    }
+
+    auto lower = first_key(incoming.front().get());
+    auto upper = last_key(incoming.back().get());
+
+    auto res = new InternalLevel(base_level->m_level_no, 0);
+
+    /* the partitions entirely below the incoming records are unaffected */
+    size_t i = 0;
+    while (i < base_level->m_shard_cnt &&
+           last_key(base_level->m_shards[i].get()) < lower) {
+      res->append_partition(base_level->m_shards[i++]);
+    }
+
+    std::vector<ShardType *> shards;
+    for (auto &shard : incoming) {
+      shards.push_back(shard.get());
+    }
+
+    size_t overlap_start = i;
+    while (i < base_level->m_shard_cnt &&
+           first_key(base_level->m_shards[i].get()) <= upper) {
+      shards.push_back(base_level->m_shards[i++].get());
+    }
+
+    if (i == overlap_start) {
+      for (auto &shard : incoming) {
+        if (shard->get_record_count() <= partition_size) {
+          res->append_partition(shard);
+        } else {
+          res->split_into_partitions({shard.get()}, partition_size);
+        }
+      }
+    } else {
+      res->split_into_partitions(shards, partition_size);
+    }
+
+    /* as are those entirely above them */
+    while (i < base_level->m_shard_cnt) {
+      res->append_partition(base_level->m_shards[i++]);
+    }
+
+    return std::shared_ptr<InternalLevel>(res);
+  }
+
+  /*
+   * Select a run of consecutive shards from this (partitioned) level
+   * containing at least reccnt records, to be merged into target_level,
+   * and return it as a [first, last) range of shard indices. Of the
+   * possible runs, the one whose key range overlaps the fewest records in
+   * target_level relative to its own size is chosen, to minimize the
+   * amount of rewriting that the merge requires. If reccnt is 0, or the
+   * level doesn't contain enough records, all of the shards are selected.
+   */
+  std::pair<size_t, size_t> select_partitions(InternalLevel *target_level,
+                                              size_t reccnt)
+    requires PartitionedShardInterface<ShardType>
+  {
+    std::pair<size_t, size_t> selected = {0, m_shard_cnt};
+    if (reccnt == 0 || reccnt >= get_record_count()) {
+      return selected;
+    }
+
+    double selected_cost = std::numeric_limits<double>::max();
+    for (size_t start = 0; start < m_shard_cnt; start++) {
+      size_t stop = start;
+      size_t run_reccnt = 0;
+      while (stop < m_shard_cnt && run_reccnt < reccnt) {
+        run_reccnt += m_shards[stop++]->get_record_count();
+      }
+
+      if (run_reccnt < reccnt) {
+        break;
+      }
+
+      size_t overlap = target_level->get_overlapping_record_count(
+          first_key(m_shards[start].get()),
+          last_key(m_shards[stop - 1].get()));
+      double cost = (double)overlap / (double)run_reccnt;
+      if (cost < selected_cost) {
+        selected = {start, stop};
+        selected_cost = cost;
+      }
+    }
+
+    return selected;
+  }
+
   /*
    * Create a new shard combining the records from all of
    * the shards in level, and append this new shard into
@@ -164,7 +290,7 @@ public:
       std::vector<typename QueryType::LocalQuery *> &local_queries,
       typename QueryType::Parameters *query_parms) {
     for (size_t i = 0; i < m_shard_cnt; i++) {
-      if (m_shards[i]) {
+      if (m_shards[i] && may_overlap(m_shards[i].get(), query_parms)) {
         auto local_query =
             QueryType::local_preproc(m_shards[i].get(), query_parms);
         shards.push_back({{m_level_no, (ssize_t)i}, m_shards[i].get()});
@@ -173,6 +299,67 @@ public:
     }
   }
 
+  /*
+   * Create the local queries on each shard of this level for every query
+   * within a batch, appending the shards searched by query_parms[i] to
+   * shards[i] and their local queries to local_queries[i]. As with
+   * get_local_queries, shards that cannot overlap a query are skipped
+   * for it. The batch is processed one shard at a time, so that each
+   * shard's index stays in cache across the queries (which should be
+   * sorted by key to make the most of this).
+   */
+  void get_batch_local_queries(
+      std::vector<std::vector<std::pair<ShardID, ShardType *>>> &shards,
+      std::vector<std::vector<typename QueryType::LocalQuery *>> &local_queries,
+      std::vector<typename QueryType::Parameters *> &query_parms) {
+    for (size_t i = 0; i < m_shard_cnt; i++) {
+      if (!m_shards[i]) {
+        continue;
+      }
+
+      for (size_t j = 0; j < query_parms.size(); j++) {
+        if (may_overlap(m_shards[i].get(), query_parms[j])) {
+          local_queries[j].emplace_back(
+              QueryType::local_preproc(m_shards[i].get(), query_parms[j]));
+          shards[j].push_back({{m_level_no, (ssize_t)i}, m_shards[i].get()});
+        }
+      }
+    }
+  }
+
+  /*
+   * Return false if shard cannot contain any records with keys matching
+   * the query, in which case its local query can be skipped. This uses
+   * the shard's key range and zone map, where the shard has them, for
+   * queries over a range of keys or a single key.
+   */
+  static bool may_overlap(ShardType *shard,
+                          typename QueryType::Parameters *query_parms) {
+    if constexpr (KeyRangeQueryInterface<QueryType>) {
+      return may_contain_range(shard, query_parms->lower_bound,
+                               query_parms->upper_bound);
+    } else if constexpr (PointQueryInterface<QueryType>) {
+      return may_contain_range(shard, query_parms->search_key,
+                               query_parms->search_key);
+    }
+
+    return true;
+  }
+
+  template <typename K>
+  static bool may_contain_range(ShardType *shard, const K &lower,
+                                const K &upper) {
+    if constexpr (ZoneMappedShardInterface<ShardType>) {
+      return shard->may_contain_range(lower, upper);
+    } else if constexpr (KeyRangeShardInterface<ShardType>) {
+      return shard->get_record_count() > 0 &&
+             !(upper < shard->get_min_key()) &&
+             !(shard->get_max_key() < lower);
+    }
+
+    return true;
+  }
+
   bool check_tombstone(size_t shard_stop, const RecordType &rec) {
     if (m_shard_cnt == 0)
       return false;
@@ -271,6 +458,23 @@ public:
     return (double)tscnt / (double)(tscnt + reccnt);
   }
 
+  /*
+   * Return a copy of this level without the shards in [first, last).
+   */
+  std::shared_ptr<InternalLevel> clone_without_shards(size_t first,
+                                                      size_t last) {
+    size_t shard_cnt = m_shard_cnt - std::min(m_shard_cnt, last - first);
+    auto new_level = std::make_shared<InternalLevel>(
+        m_level_no, std::max<size_t>(shard_cnt, 1));
+    for (size_t i = 0; i < m_shard_cnt; i++) {
+      if (i < first || i >= last) {
+        new_level->m_shards[new_level->m_shard_cnt++] = m_shards[i];
+      }
+    }
+
+    return new_level;
+  }
+
   std::shared_ptr<InternalLevel> clone() {
     auto new_level =
         std::make_shared<InternalLevel>(m_level_no, m_shards.size());
@@ -290,6 +494,164 @@ private:
 
   std::vector<std::shared_ptr<ShardType>> m_shards;
   ShardType *m_pending_shard;
+
+  /*
+   * Add shard to the end of the level, growing the level's capacity if
+   * needed. Used for building partitioned levels, which do not have a
+   * fixed number of shards.
+   */
+  void append_partition(std::shared_ptr<ShardType> shard) {
+    if (m_shard_cnt == m_shards.size()) {
+      m_shards.push_back(shard);
+    } else {
+      m_shards[m_shard_cnt] = shard;
+    }
+
+    ++m_shard_cnt;
+  }
+
+  /*
+   * Build partitions from the records of shards, splitting them at keys
+   * chosen so that each contains no more than partition_size records,
+   * and that the partitions are as close to evenly sized as possible.
+   * The partitions are appended to the level in key order, and any that
+   * are empty once tombstones and deleted records are removed are
+   * dropped.
+   *
+   * NOTE: records sharing a key are never split across partitions, and
+   *       so a partition may exceed partition_size if a single key has
+   *       more records than this.
+   */
+  void split_into_partitions(std::vector<ShardType *> const &shards,
+                             size_t partition_size)
+    requires PartitionedShardInterface<ShardType>
+  {
+    std::vector<std::pair<size_t, size_t>> ranges(shards.size());
+    size_t remaining = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+      ranges[i] = {0, shards[i]->get_record_count()};
+      remaining += ranges[i].second;
+    }
+
+    while (remaining > 0) {
+      size_t partition_cnt = (remaining + partition_size - 1) / partition_size;
+      size_t target = (remaining + partition_cnt - 1) / partition_cnt;
+
+      /*
+       * Find the key that splits off the largest number of records not
+       * exceeding target, considering every remaining key as a candidate
+       */
+      std::vector<size_t> split(shards.size());
+      size_t split_cnt = remaining;
+      if (partition_cnt > 1) {
+        split_cnt = 0;
+        for (size_t i = 0; i < shards.size(); i++) {
+          auto [start, stop] = ranges[i];
+          if (start == stop) {
+            continue;
+          }
+
+          size_t cnt = count_below(shards, ranges, key_at(shards[i], start));
+          if (cnt > target) {
+            continue;
+          }
+
+          /* the count is non-decreasing in the index of the candidate key */
+          size_t low = start;
+          size_t high = stop - 1;
+          while (low < high) {
+            size_t mid = low + (high - low + 1) / 2;
+            size_t mid_cnt =
+                count_below(shards, ranges, key_at(shards[i], mid));
+            if (mid_cnt <= target) {
+              low = mid;
+              cnt = mid_cnt;
+            } else {
+              high = mid - 1;
+            }
+          }
+
+          if (cnt > split_cnt) {
+            split_cnt = cnt;
+            for (size_t j = 0; j < shards.size(); j++) {
+              split[j] = std::max(ranges[j].first,
+                                  shards[j]->get_lower_bound(
+                                      key_at(shards[i], low)));
+            }
+          }
+        }
+      }
+
+      /* if no key splits the records, they all go into one partition */
+      if (split_cnt == 0 || split_cnt == remaining) {
+        split_cnt = remaining;
+        for (size_t j = 0; j < shards.size(); j++) {
+          split[j] = ranges[j].second;
+        }
+      }
+
+      std::vector<std::pair<size_t, size_t>> partition_ranges(shards.size());
+      for (size_t j = 0; j < shards.size(); j++) {
+        partition_ranges[j] = {ranges[j].first, split[j]};
+        ranges[j].first = split[j];
+      }
+
+      auto partition = std::make_shared<ShardType>(shards, partition_ranges);
+      if (partition->get_record_count() > 0) {
+        append_partition(partition);
+      }
+
+      remaining -= split_cnt;
+    }
+  }
+
+  /*
+   * Return the number of records within ranges of shards with a key
+   * less than key
+   */
+  template <typename K>
+  static size_t count_below(std::vector<ShardType *> const &shards,
+                            std::vector<std::pair<size_t, size_t>> const &ranges,
+                            const K &key) {
+    size_t cnt = 0;
+    for (size_t i = 0; i < shards.size(); i++) {
+      auto [start, stop] = ranges[i];
+      if (start < stop) {
+        size_t idx = shards[i]->get_lower_bound(key);
+        cnt += std::min(std::max(idx, start), stop) - start;
+      }
+    }
+
+    return cnt;
+  }
+
+  /*
+   * Return the number of records within the shards of this level whose
+   * key ranges overlap [lower, upper]
+   */
+  template <typename K>
+  size_t get_overlapping_record_count(const K &lower, const K &upper) {
+    size_t cnt = 0;
+    for (size_t i = 0; i < m_shard_cnt; i++) {
+      if (m_shards[i] && m_shards[i]->get_record_count() > 0 &&
+          last_key(m_shards[i].get()) >= lower &&
+          first_key(m_shards[i].get()) <= upper) {
+        cnt += m_shards[i]->get_record_count();
+      }
+    }
+
+    return cnt;
+  }
+
+  static auto key_at(ShardType *shard, size_t idx) {
+    return shard->get_record_at(idx)->rec.key;
+  }
+
+  static auto first_key(ShardType *shard) { return key_at(shard, 0); }
+
+  static auto last_key(ShardType *shard) {
+    return key_at(shard, shard->get_record_count() - 1);
+  }
 };
 
 } // namespace de
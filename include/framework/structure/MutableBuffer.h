@@ -18,86 +18,240 @@
  */
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <bit>
 #include <cassert>
 #include <cstdlib>
+#include <deque>
 #include <immintrin.h>
+#include <mutex>
+#include <vector>
 
 #include "framework/interface/Record.h"
 #include "framework/structure/BufferView.h"
-#include "psu-ds/BloomFilter.h"
 #include "psu-util/alignment.h"
+#include "util/BlockedBloomFilter.h"
 #include "util/bf_config.h"
 
 namespace de {
 
+/*
+ * The buffer's records are stored within a chain of fixed-size
+ * segments, rather than a single ring. Records are addressed by
+ * their absolute (monotonically increasing) index, with the segment
+ * containing index i being number i / segment_size. Threads locate
+ * segments through a ring of segment pointers (the window), indexed by
+ * segment number, which holds every segment that has not been recycled.
+ * The segments covering [head, head + hwm] are provisioned before the
+ * head is advanced, and all retained segments are also kept, in order,
+ * in a list. A BufferView holds pointers to the segments covering its
+ * records, and pins the segment containing its head, using an atomic
+ * reference count within the segment, so that it and all later segments
+ * are not recycled until the view is released. Creating and releasing
+ * views is therefore lock-free; the lock is only needed to provision
+ * and recycle segments.
+ *
+ * As a result, advancing the head never needs to wait on readers. A
+ * slow reader will keep the segments behind the head alive for longer
+ * than usual, but the segments beyond the head are always available
+ * for new inserts.
+ *
+ * Optionally, the buffer can also maintain a sorted run for each
+ * segment. Runs are built lazily, off the insert path: the first view
+ * requesting them (i.e., one created for a flush or a sorted scan) over
+ * a segment after all of its records have been published sorts the
+ * segment's slot offsets (the records themselves are left in place).
+ * Views then expose any runs that have been built, so that buffer
+ * queries can binary search the full segments, and flushes can merge
+ * the runs rather than sorting the whole buffer. Other views, such as
+ * those used for deletes and tombstone checks, never sort, and views
+ * created while another thread is sorting a segment simply scan it.
+ *
+ * The buffer can also maintain a hash index over each segment, mapping
+ * record keys to their offsets, which is filled in as records are
+ * appended. This makes point lookups, tombstone checks, and tagged
+ * deletes within the buffer constant time per segment. As the index
+ * belongs to its segment, it is reset along with it when the segment
+ * is recycled after the head has moved past it.
+ */
 template <RecordInterface R> class MutableBuffer {
   friend class BufferView<R>;
 
-  struct buffer_head {
-    size_t head_idx;
-    size_t refcnt;
+  struct Segment {
+    Wrapped<R> *data;
+
+    /*
+     * for each slot, one more than the index of the last record
+     * published into it
+     */
+    std::atomic<size_t> *published;
+    std::atomic<size_t> number;
+
+    /*
+     * the number of views and head references pinning the segment, or
+     * RETIRED once it has been recycled
+     */
+    std::atomic<size_t> pins;
+
+    /*
+     * the offsets of the segment's records in sorted order, valid
+     * only once sorted is set
+     */
+    uint32_t *order;
+    std::atomic<bool> sorted;
+
+    /* set by the thread that has claimed the sorting of the segment */
+    std::atomic<bool> sorting;
+
+    /* the hash index over the segment's keys, if one is maintained */
+    std::atomic<uint32_t> *index;
+  };
+
+  /*
+   * a ring of segment pointers, indexed by segment number. It is
+   * replaced by a larger one if a retained segment would otherwise be
+   * overwritten in it.
+   */
+  struct Window {
+    size_t mask;
+    std::atomic<Segment *> *slots;
   };
 
+  static constexpr size_t RETIRED = SIZE_MAX;
+
 public:
   MutableBuffer(size_t low_watermark, size_t high_watermark,
-                size_t capacity = 0)
+                size_t capacity = 0, bool sorted_runs = false,
+                bool hash_index = false)
       : m_lwm(low_watermark), m_hwm(high_watermark),
-        m_cap((capacity == 0) ? 2 * high_watermark : capacity), m_tail(0),
-        m_head({0, 0}), m_old_head({high_watermark, 0}),
-        m_data(new Wrapped<R>[m_cap]()),
+        m_cap((capacity == 0) ? 2 * high_watermark : capacity),
+        m_sorted_runs(sorted_runs),
+        m_hash_index(hash_index && BufferIndexable<R>),
+        m_seg_shift(std::bit_width(
+                        std::bit_floor(std::max<size_t>(m_hwm / 4, 1))) -
+                    1),
+        m_seg_size(1ull << m_seg_shift), m_seg_mask(m_seg_size - 1),
+        m_tail(0), m_visible_tail(0), m_head(0),
+        m_window(new_window(std::bit_ceil((m_cap >> m_seg_shift) + 3))),
+        m_first_segment(0), m_segment_cnt(0),
         m_tombstone_filter(
-            new psudb::BloomFilter<R>(BF_FPR, m_hwm, BF_HASH_FUNCS)),
-        m_tscnt(0), m_old_tscnt(0), m_active_head_advance(false) {
+            new BlockedBloomFilter<R>(BF_FPR, m_hwm, BF_HASH_FUNCS)),
+        m_tscnt(0) {
     assert(m_cap > m_hwm);
     assert(m_hwm >= m_lwm);
+
+    provision_segments(0);
   }
 
   ~MutableBuffer() {
-    delete[] m_data;
+    for (auto seg : m_segments) {
+      free_segment(seg);
+    }
+
+    for (auto seg : m_segment_pool) {
+      free_segment(seg);
+    }
+
+    free_window(m_window.load());
+    for (auto window : m_old_windows) {
+      free_window(window);
+    }
+
     delete m_tombstone_filter;
   }
 
   int append(const R &rec, bool tombstone = false) {
-    int32_t tail = 0;
-    if ((tail = try_advance_tail()) == -1) {
+    size_t reserved = 0;
+    int64_t tail = 0;
+    if ((tail = try_advance_tail(1, reserved)) == -1) {
       return 0;
     }
 
-    Wrapped<R> wrec;
-    wrec.rec = rec;
-    wrec.header = 0;
-    if (tombstone)
-      wrec.set_tombstone();
-
-    // FIXME: because of the mod, it isn't correct to use `pos`
-    //        as the ordering timestamp in the header anymore.
-    size_t pos = tail % m_cap;
-
-    m_data[pos] = wrec;
-    m_data[pos].set_timestamp(pos);
+    write_record(get_segment(tail), tail, rec, tombstone);
 
     if (tombstone) {
       m_tscnt.fetch_add(1);
-      if (m_tombstone_filter)
-        m_tombstone_filter->insert(rec);
     }
 
-    m_data[pos].set_visible();
+    publish(tail, 1);
 
     return 1;
   }
 
+  /*
+   * Append up to cnt records from recs into the buffer as a single
+   * operation. The space for the whole batch is reserved with one
+   * update of the tail pointer, and the records are then copied into
+   * the reserved range (which may span several segments). If the batch
+   * would exceed the high watermark, only the prefix of the batch that
+   * fits is appended. Returns the number of records appended, which
+   * will be 0 if the buffer is full.
+   */
+  size_t append_batch(const R *recs, size_t cnt, bool tombstone = false) {
+    if (cnt == 0) {
+      return 0;
+    }
+
+    size_t reserved = 0;
+    int64_t tail = 0;
+    if ((tail = try_advance_tail(cnt, reserved)) == -1) {
+      return 0;
+    }
+
+    /*
+     * split the reserved range at segment boundaries, so that each
+     * part can be filled with a simple sequential loop
+     */
+    size_t i = 0;
+    while (i < reserved) {
+      size_t idx = tail + i;
+      size_t part = std::min(reserved - i, m_seg_size - (idx & m_seg_mask));
+
+      Segment *seg = get_segment(idx);
+      for (size_t j = 0; j < part; j++) {
+        write_record(seg, idx + j, recs[i + j], tombstone);
+      }
+
+      i += part;
+    }
+
+    if (tombstone) {
+      m_tscnt.fetch_add(reserved);
+    }
+
+    publish(tail, reserved);
+
+    return reserved;
+  }
+
+  /*
+   * NOTE: truncate assumes that there are no outstanding views of
+   *       the buffer.
+   */
   bool truncate() {
+    std::unique_lock<std::mutex> lock(m_segment_lk);
+
+    while (m_segments.size() > 0) {
+      m_segments.front()->pins.store(RETIRED);
+      m_segment_pool.push_back(m_segments.front());
+      m_segments.pop_front();
+    }
+
     m_tscnt.store(0);
     m_tail.store(0);
+    m_visible_tail.store(0);
+    m_head.store(0);
+    m_first_segment = 0;
+    provision_segments(0);
+
     if (m_tombstone_filter)
       m_tombstone_filter->clear();
 
     return true;
   }
 
-  size_t get_record_count() { return m_tail.load() - m_head.load().head_idx; }
+  size_t get_record_count() { return m_tail.load() - m_head.load(); }
 
   size_t get_capacity() { return m_cap; }
 
@@ -115,86 +269,104 @@ public:
     return get_buffer_view().check_tombstone(rec);
   }
 
-  size_t get_memory_usage() { return m_cap * sizeof(Wrapped<R>); }
+  /*
+   * Returns the memory allocated for all segments, including those
+   * retained for readers and those waiting in the pool to be reused.
+   */
+  size_t get_memory_usage() {
+    std::unique_lock<std::mutex> lock(m_segment_lk);
+    size_t slot_size = sizeof(Wrapped<R>) + sizeof(std::atomic<size_t>);
+    if (m_sorted_runs) {
+      slot_size += sizeof(uint32_t);
+    }
+
+    if (m_hash_index) {
+      slot_size += 2 * sizeof(std::atomic<uint32_t>);
+    }
+
+    return m_segment_cnt * m_seg_size * slot_size;
+  }
 
   size_t get_aux_memory_usage() {
     return m_tombstone_filter->get_memory_usage();
   }
 
-  BufferView<R> get_buffer_view(size_t target_head) {
-    size_t head = get_head(target_head);
-    auto f = std::bind(release_head_reference, (void *)this, head);
+  /*
+   * Returns a view of the buffer beginning at target_head. The target
+   * must either be the current head, or a head that is pinned by
+   * some other reference (see take_head_reference), as the records
+   * behind the current head are otherwise free to be recycled. If
+   * sort_runs is true, the sorted runs of any full segments within the
+   * view that lack them are built first.
+   */
+  BufferView<R> get_buffer_view(size_t target_head, bool sort_runs = false) {
+    [[maybe_unused]] bool pinned = pin_segment(target_head >> m_seg_shift);
+    assert(pinned);
 
-    return BufferView<R>(m_data, m_cap, head, m_tail.load(), m_tscnt.load(),
-                         m_tombstone_filter, f);
+    return create_view(target_head, sort_runs);
   }
 
-  BufferView<R> get_buffer_view() {
-    size_t head = get_head(m_head.load().head_idx);
-    auto f = std::bind(release_head_reference, (void *)this, head);
+  BufferView<R> get_buffer_view(bool sort_runs = false) {
+    /*
+     * the head may advance, and its segment be recycled, between
+     * loading it and pinning its segment, in which case the pin is
+     * retried against the new head
+     */
+    size_t head;
+    do {
+      head = m_head.load();
+      if (pin_segment(head >> m_seg_shift)) {
+        if (m_head.load() == head) {
+          break;
+        }
+
+        unpin_segment(head >> m_seg_shift);
+      }
+    } while (true);
 
-    return BufferView<R>(m_data, m_cap, head, m_tail.load(), m_tscnt.load(),
-                         m_tombstone_filter, f);
+    return create_view(head, sort_runs);
   }
 
   /*
-   * Advance the buffer following a reconstruction. Move current
-   * head and head_refcnt into old_head and old_head_refcnt, then
-   * assign new_head to old_head.
+   * Advance the buffer following a reconstruction. The segments
+   * needed to accept a further high watermark worth of records beyond
+   * new_head are provisioned first, and then the head is moved.
+   * Records behind the new head remain accessible to any existing
+   * views (and to any pinned heads), and so this never needs to wait
+   * for readers to finish.
    */
   bool advance_head(size_t new_head) {
-    assert(new_head > m_head.load().head_idx);
-    assert(new_head <= m_tail.load());
-
-    /* refuse to advance head while there is an old with one references */
-    if (m_old_head.load().refcnt > 0) {
-      // fprintf(stderr, "[W]: Refusing to advance head due to remaining
-      // reference counts\n");
-      return false;
-    }
+    std::unique_lock<std::mutex> lock(m_segment_lk);
 
-    m_active_head_advance.store(true);
-
-    buffer_head new_hd = {new_head, 0};
-    buffer_head cur_hd;
-
-    /* replace current head with new head */
-    do {
-      cur_hd = m_head.load();
-    } while (!m_head.compare_exchange_strong(cur_hd, new_hd));
+    assert(new_head >= m_head.load());
+    assert(new_head <= m_tail.load());
 
-    /* move the current head into the old head */
-    m_old_head.store(cur_hd);
+    /*
+     * releasing a pin does not recycle anything, so segments released
+     * since the last advance are recycled here, ahead of provisioning,
+     * so that they can be reused
+     */
+    recycle_segments();
+    provision_segments(new_head);
+    m_head.store(new_head);
+    recycle_segments();
 
-    m_active_head_advance.store(false);
     return true;
   }
 
   /*
-   * FIXME: If target_head does not match *either* the old_head or the
-   * current_head, this routine will loop infinitely.
+   * Pin the records from head onward, so that views beginning at head
+   * can continue to be created after the buffer's head has moved
+   * past it. head must be the current head, or already be pinned. Each
+   * call must be matched by a call to release_head_reference.
    */
-  size_t get_head(size_t target_head) {
-    buffer_head cur_hd, new_hd;
-    bool head_acquired = false;
-
-    do {
-      if (m_old_head.load().head_idx == target_head) {
-        cur_hd = m_old_head.load();
-        cur_hd.head_idx = target_head;
-        new_hd = {cur_hd.head_idx, cur_hd.refcnt + 1};
-        head_acquired = m_old_head.compare_exchange_strong(cur_hd, new_hd);
-      } else if (m_head.load().head_idx == target_head) {
-        cur_hd = m_head.load();
-        cur_hd.head_idx = target_head;
-        new_hd = {cur_hd.head_idx, cur_hd.refcnt + 1};
-        head_acquired = m_head.compare_exchange_strong(cur_hd, new_hd);
-      }
-    } while (!head_acquired);
-
-    return new_hd.head_idx;
+  void take_head_reference(size_t head) {
+    [[maybe_unused]] bool pinned = pin_segment(head >> m_seg_shift);
+    assert(pinned);
   }
 
+  void release_head_reference(size_t head) { unpin_segment(head >> m_seg_shift); }
+
   void set_low_watermark(size_t lwm) {
     assert(lwm < m_hwm);
     m_lwm = lwm;
@@ -205,94 +377,455 @@ public:
   void set_high_watermark(size_t hwm) {
     assert(hwm > m_lwm);
     assert(hwm < m_cap);
+
+    std::unique_lock<std::mutex> lock(m_segment_lk);
     m_hwm = hwm;
+    provision_segments(m_head.load());
   }
 
   size_t get_high_watermark() { return m_hwm; }
 
   size_t get_tail() { return m_tail.load(); }
 
+  bool has_sorted_runs() { return m_sorted_runs; }
+
+  bool has_hash_index() { return m_hash_index; }
+
   /*
    * Note: this returns the available physical storage capacity,
    * *not* now many more records can be inserted before the
-   * HWM is reached. It considers the old_head to be "free"
-   * when it has no remaining references. This should be true,
-   * but a buggy framework implementation may violate the
-   * assumption.
+   * HWM is reached. Records behind the head are counted against
+   * the capacity for as long as there remain views (or pinned
+   * heads) referencing them. Because such records no longer block
+   * inserts, they can exceed the nominal capacity, in which case
+   * this returns 0.
    */
   size_t get_available_capacity() {
-    if (m_old_head.load().refcnt == 0) {
-      return m_cap - (m_tail.load() - m_head.load().head_idx);
-    }
+    std::unique_lock<std::mutex> lock(m_segment_lk);
+    size_t used = m_tail.load() - get_oldest_head();
 
-    return m_cap - (m_tail.load() - m_old_head.load().head_idx);
+    return (used >= m_cap) ? 0 : m_cap - used;
   }
 
 private:
-  int64_t try_advance_tail() {
-    size_t old_value = m_tail.load();
-
-    /* if full, fail to advance the tail */
-    if (old_value - m_head.load().head_idx >= m_hwm) {
-      return -1;
-    }
+  /*
+   * Attempt to reserve cnt contiguous slots at the tail of the buffer.
+   * If fewer than cnt slots remain below the high watermark, only the
+   * remaining slots are reserved. Returns the index of the first
+   * reserved slot and stores the number of reserved slots in
+   * reserved, or returns -1 if the buffer is full.
+   *
+   * NOTE: the reservation is done using a CAS, rather than a
+   *       fetch-add, so that a reservation which would cross the
+   *       high watermark can be clamped, rather than having to be
+   *       rolled back after other threads may have already reserved
+   *       the slots past it.
+   */
+  int64_t try_advance_tail(size_t cnt, size_t &reserved) {
+    size_t old_value;
 
-    while (!m_tail.compare_exchange_strong(old_value, old_value + 1)) {
-      /* if full, stop trying and fail to advance the tail */
-      if (m_tail.load() >= m_hwm) {
+    do {
+      /*
+       * the head must be loaded before the tail, to ensure that
+       * head <= tail when computing the record count
+       */
+      size_t head = m_head.load();
+      old_value = m_tail.load();
+
+      /* if full, fail to advance the tail */
+      if (old_value - head >= m_hwm) {
         return -1;
       }
 
+      reserved = std::min(cnt, m_hwm - (old_value - head));
+      if (m_tail.compare_exchange_strong(old_value, old_value + reserved)) {
+        break;
+      }
+
       _mm_pause();
-    }
+    } while (true);
 
     return old_value;
   }
 
-  size_t to_idx(size_t i, size_t head) { return (head + i) % m_cap; }
+  /*
+   * Make the records in [start, start + cnt) visible to new buffer
+   * views. Each slot is marked as published, and then the visible tail
+   * is advanced over the longest fully published prefix. A range that
+   * finishes copying before a range reserved ahead of it is left for
+   * the thread publishing the earlier range to pick up, so that views
+   * always cover a fully written prefix of the buffer without any
+   * thread having to wait on another.
+   */
+  void publish(size_t start, size_t cnt) {
+    for (size_t i = 0; i < cnt; i++) {
+      size_t idx = start + i;
+      get_segment(idx)->published[idx & m_seg_mask].store(idx + 1);
+    }
 
-  static void release_head_reference(void *buff, size_t head) {
-    MutableBuffer<R> *buffer = (MutableBuffer<R> *)buff;
+    size_t visible = m_visible_tail.load();
+    while (true) {
+      size_t end = visible;
+      while (get_segment(end)->published[end & m_seg_mask].load() == end + 1) {
+        end++;
+      }
+
+      if (end == visible) {
+        break;
+      }
+
+      if (m_visible_tail.compare_exchange_strong(visible, end)) {
+        break;
+      }
+    }
+  }
+
+  /*
+   * Build the sorted run for a fully published segment, unless another
+   * thread has already claimed it. The segment must be pinned by the
+   * caller.
+   */
+  void sort_segment(Segment *seg) {
+    bool unclaimed = false;
+    if (!seg->sorting.compare_exchange_strong(unclaimed, true)) {
+      return;
+    }
+
+    for (size_t i = 0; i < m_seg_size; i++) {
+      seg->order[i] = i;
+    }
 
-    buffer_head cur_hd, new_hd;
+    /* equal records are kept in insertion (i.e., offset) order */
+    Wrapped<R> *data = seg->data;
+    std::sort(seg->order, seg->order + m_seg_size,
+              [data](uint32_t a, uint32_t b) {
+                return data[a].rec < data[b].rec ||
+                       (data[a].rec == data[b].rec && a < b);
+              });
+    seg->sorted.store(true);
+  }
+
+  void write_record(Segment *seg, size_t idx, const R &rec, bool tombstone) {
+    size_t offset = idx & m_seg_mask;
+    Wrapped<R> *slot = seg->data + offset;
+
+    Wrapped<R> wrec;
+    wrec.rec = rec;
+    wrec.header = 0;
+    if (tombstone)
+      wrec.set_tombstone();
+
+    /*
+     * NOTE: no timestamp is recorded in the header, as the position of
+     *       the record already orders it relative to the other records
+     *       in the buffer, and is used directly for that purpose when
+     *       the buffer is sorted.
+     */
+    *slot = wrec;
+
+    if (tombstone && m_tombstone_filter) {
+      m_tombstone_filter->insert(rec);
+    }
+
+    slot->set_visible();
+
+    if constexpr (BufferIndexable<R>) {
+      if (m_hash_index) {
+        index_record(seg, offset);
+      }
+    }
+  }
+
+  /*
+   * Add the record at offset within seg to the segment's hash index,
+   * using linear probing. The index has twice as many slots as the
+   * segment has records, so there is always an empty slot to claim.
+   */
+  void index_record(Segment *seg, size_t offset) {
+    size_t mask = 2 * m_seg_size - 1;
+    size_t slot = buffer_index_hash(seg->data[offset].rec.key) & mask;
+
+    uint32_t empty = 0;
+    while (!seg->index[slot].compare_exchange_strong(empty, offset + 1)) {
+      empty = 0;
+      slot = (slot + 1) & mask;
+    }
+  }
+
+  /*
+   * Returns the segment containing record idx. This is only valid
+   * for records within [head, head + hwm] of the current head, or
+   * within a pinned segment or any segment after it.
+   */
+  Segment *get_segment(size_t idx) { return lookup_segment(idx >> m_seg_shift); }
+
+  Segment *lookup_segment(size_t number) {
+    Window *window = m_window.load();
+    return window->slots[number & window->mask].load();
+  }
+
+  /*
+   * Attempt to pin segment number, returning false if it has already
+   * been recycled. A pin and the retirement of the segment by
+   * recycle_segments are both made by a CAS on its pin count, and so
+   * cannot both succeed.
+   */
+  bool pin_segment(size_t number) {
+    Segment *seg = lookup_segment(number);
+    if (!seg) {
+      return false;
+    }
+
+    size_t pins = seg->pins.load();
     do {
-      if (buffer->m_old_head.load().head_idx == head) {
-        cur_hd = buffer->m_old_head;
-        if (cur_hd.refcnt == 0)
-          continue;
-        new_hd = {cur_hd.head_idx, cur_hd.refcnt - 1};
-        if (buffer->m_old_head.compare_exchange_strong(cur_hd, new_hd)) {
-          break;
-        }
+      if (pins == RETIRED) {
+        return false;
+      }
+    } while (!seg->pins.compare_exchange_weak(pins, pins + 1));
+
+    /*
+     * the slot may have held a recycled segment that has since been
+     * provisioned again, under a different number
+     */
+    if (seg->number.load() != number) {
+      seg->pins.fetch_sub(1);
+      return false;
+    }
+
+    return true;
+  }
+
+  /*
+   * Release a pin on segment number. The segment is not recycled here,
+   * even if this was its last pin, but on the next advance of the head.
+   */
+  void unpin_segment(size_t number) {
+    Segment *seg = lookup_segment(number);
+    assert(seg->number.load() == number);
+    assert(seg->pins.load() > 0 && seg->pins.load() != RETIRED);
+
+    seg->pins.fetch_sub(1);
+  }
+
+  /*
+   * Ensure that every segment covering [head, head + hwm] has been
+   * allocated and installed in the window. Must be called with
+   * m_segment_lk held.
+   *
+   * NOTE: a slot in the window is only reused once the segment in it
+   *       has been recycled. If the slot is still held by a retained
+   *       segment (because a view has pinned segments far behind the
+   *       head), the window is first replaced with a larger one.
+   */
+  void provision_segments(size_t head) {
+    size_t last = (head + m_hwm) >> m_seg_shift;
+    size_t next = m_first_segment + m_segments.size();
+
+    for (; next <= last; next++) {
+      Segment *seg = nullptr;
+      if (m_segment_pool.size() > 0) {
+        seg = m_segment_pool.back();
+        m_segment_pool.pop_back();
       } else {
-        cur_hd = buffer->m_head;
-        if (cur_hd.refcnt == 0)
-          continue;
-        new_hd = {cur_hd.head_idx, cur_hd.refcnt - 1};
+        seg = new Segment();
+        seg->data = new Wrapped<R>[m_seg_size]();
+        seg->published = new std::atomic<size_t>[m_seg_size]();
+        seg->order = (m_sorted_runs) ? new uint32_t[m_seg_size] : nullptr;
+        seg->index = (m_hash_index)
+                         ? new std::atomic<uint32_t>[2 * m_seg_size]()
+                         : nullptr;
+        m_segment_cnt++;
+      }
 
-        if (buffer->m_head.compare_exchange_strong(cur_hd, new_hd)) {
-          break;
+      /*
+       * a recycled segment may hold published markers from a
+       * truncated buffer, which could match the new indices
+       */
+      for (size_t i = 0; i < m_seg_size; i++) {
+        seg->published[i].store(0);
+      }
+
+      if (seg->index) {
+        for (size_t i = 0; i < 2 * m_seg_size; i++) {
+          seg->index[i].store(0);
         }
       }
-      _mm_pause();
-    } while (true);
+
+      seg->number.store(next);
+      seg->sorted.store(false);
+      seg->sorting.store(false);
+      m_segments.push_back(seg);
+
+      /*
+       * the slot may also hold a stale pointer to a segment that has
+       * since been reused under a number belonging to a different slot
+       */
+      Window *window = m_window.load();
+      Segment *old = window->slots[next & window->mask].load();
+      if (old && old != seg && old->pins.load() != RETIRED &&
+          (old->number.load() & window->mask) == (next & window->mask)) {
+        grow_window();
+        window = m_window.load();
+      }
+
+      window->slots[next & window->mask].store(seg);
+      seg->pins.store(0);
+    }
+  }
+
+  /*
+   * Replace the window with one twice the size, holding all retained
+   * segments. The old window is kept until the buffer is destroyed, as
+   * other threads may still be reading through it. Must be called with
+   * m_segment_lk held.
+   */
+  void grow_window() {
+    Window *old = m_window.load();
+    Window *window = new_window(2 * (old->mask + 1));
+
+    for (auto seg : m_segments) {
+      if (seg->pins.load() != RETIRED) {
+        window->slots[seg->number.load() & window->mask].store(seg);
+      }
+    }
+
+    m_window.store(window);
+    m_old_windows.push_back(old);
+  }
+
+  /*
+   * Return all unpinned segments that lie entirely behind the head, up
+   * to the first pinned segment, to the pool. Each is retired by a CAS
+   * of its pin count, so a concurrent attempt to pin it will fail. Must
+   * be called with m_segment_lk held.
+   *
+   * NOTE: recycled segments are never freed until the buffer is
+   *       destroyed, because a thread publishing records may still
+   *       briefly read through a stale pointer to one.
+   */
+  void recycle_segments() {
+    size_t head = m_head.load() >> m_seg_shift;
+    while (m_first_segment < head) {
+      size_t unpinned = 0;
+      if (!m_segments.front()->pins.compare_exchange_strong(unpinned,
+                                                            RETIRED)) {
+        break;
+      }
+
+      m_segment_pool.push_back(m_segments.front());
+      m_segments.pop_front();
+      m_first_segment++;
+    }
+  }
+
+  /*
+   * The start of the first pinned segment behind the head, or the head
+   * if there is none. Must be called with m_segment_lk held.
+   */
+  size_t get_oldest_head() {
+    size_t head = m_head.load();
+    for (auto seg : m_segments) {
+      size_t number = seg->number.load();
+      if (number >= head >> m_seg_shift) {
+        break;
+      }
+
+      if (seg->pins.load() > 0) {
+        return number << m_seg_shift;
+      }
+    }
+
+    return head;
+  }
+
+  /*
+   * Create a view beginning at head, whose segment must already have
+   * been pinned on the view's behalf. The pin is released along with
+   * the view.
+   */
+  BufferView<R> create_view(size_t head, bool sort_runs) {
+    size_t tail = m_visible_tail.load();
+    assert(tail >= head);
+
+    std::vector<BufferSegment<R>> segments;
+    if (tail > head) {
+      size_t first = head >> m_seg_shift;
+      size_t last = (tail - 1) >> m_seg_shift;
+      segments.reserve(last - first + 1);
+      for (size_t i = first; i <= last; i++) {
+        auto seg = lookup_segment(i);
+        assert(seg->number.load() == i);
+
+        /* segments within the view are pinned along with its head */
+        if (sort_runs && m_sorted_runs && !seg->sorted.load() &&
+            ((i + 1) << m_seg_shift) <= tail) {
+          sort_segment(seg);
+        }
+
+        segments.push_back(
+            {seg->data, (seg->sorted.load()) ? seg->order : nullptr,
+             seg->index});
+      }
+    }
+
+    auto f = std::bind(release_view_reference, (void *)this, head);
+
+    return BufferView<R>(std::move(segments), m_seg_shift, m_cap, head, tail,
+                         m_tscnt.load(), m_tombstone_filter, f);
+  }
+
+  static void release_view_reference(void *buff, size_t head) {
+    MutableBuffer<R> *buffer = (MutableBuffer<R> *)buff;
+    buffer->release_head_reference(head);
+  }
+
+  static Window *new_window(size_t size) {
+    return new Window{size - 1, new std::atomic<Segment *>[size]()};
+  }
+
+  static void free_window(Window *window) {
+    delete[] window->slots;
+    delete window;
+  }
+
+  static void free_segment(Segment *seg) {
+    delete[] seg->data;
+    delete[] seg->published;
+    delete[] seg->order;
+    delete[] seg->index;
+    delete seg;
   }
 
   size_t m_lwm;
   size_t m_hwm;
   size_t m_cap;
+  bool m_sorted_runs;
+  bool m_hash_index;
+
+  size_t m_seg_shift;
+  size_t m_seg_size;
+  size_t m_seg_mask;
 
   alignas(64) std::atomic<size_t> m_tail;
+  alignas(64) std::atomic<size_t> m_visible_tail;
+  alignas(64) std::atomic<size_t> m_head;
 
-  alignas(64) std::atomic<buffer_head> m_head;
-  alignas(64) std::atomic<buffer_head> m_old_head;
+  std::atomic<Window *> m_window;
+  std::vector<Window *> m_old_windows;
 
-  Wrapped<R> *m_data;
-  psudb::BloomFilter<R> *m_tombstone_filter;
-  alignas(64) std::atomic<size_t> m_tscnt;
-  size_t m_old_tscnt;
+  /*
+   * all segments that have not been recycled, in order, and the number
+   * of the first of them. Protected, along with the pool and the
+   * replaced windows, by m_segment_lk.
+   */
+  std::deque<Segment *> m_segments;
+  size_t m_first_segment;
+  std::vector<Segment *> m_segment_pool;
+  size_t m_segment_cnt;
+  std::mutex m_segment_lk;
 
-  alignas(64) std::atomic<bool> m_active_head_advance;
+  BlockedBloomFilter<R> *m_tombstone_filter;
+  alignas(64) std::atomic<size_t> m_tscnt;
 };
 
 } // namespace de
@@ -0,0 +1,123 @@
+/*
+ * include/framework/structure/StagingLane.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * A small, single-producer staging area for inserts. When many threads
+ * insert into the same DynamicExtension, every insert contends on the
+ * buffer's tail pointer. A thread can instead insert through its own
+ * StagingLane, which accumulates records locally and publishes them into
+ * the buffer in chunks, using a single tail reservation per chunk.
+ *
+ * Records held in a lane have not yet been inserted into the index,
+ * and so are not visible to queries until the lane is published. Once
+ * published, the records become visible together, as part of the
+ * buffer's visible prefix.
+ *
+ * A StagingLane is not thread-safe, and is intended to be owned by
+ * exactly one inserting thread.
+ */
+#pragma once
+
+#include <cassert>
+#include <cstdlib>
+#include <span>
+#include <vector>
+
+#include "framework/interface/Record.h"
+
+namespace de {
+
+template <typename ExtensionType, RecordInterface R> class StagingLane {
+public:
+  StagingLane(ExtensionType *extension, size_t capacity)
+      : m_extension(extension), m_capacity(capacity) {
+    assert(m_capacity > 0);
+    m_records.reserve(m_capacity);
+  }
+
+  /*
+   * Any records remaining in the lane are published before it is
+   * destroyed. If the buffer cannot take all of them, the rest are
+   * inserted one at a time through insert_wait, which sleeps until a
+   * flush has made room, rather than spinning. Callers that cannot
+   * block here should flush the lane themselves beforehand.
+   */
+  ~StagingLane() {
+    if (flush()) {
+      return;
+    }
+
+    for (auto &rec : m_records) {
+      m_extension->insert_wait(rec);
+    }
+  }
+
+  StagingLane(const StagingLane &) = delete;
+  StagingLane &operator=(const StagingLane &) = delete;
+
+  /*
+   * Stage a record for insertion, publishing the lane into the buffer
+   * once it fills up. Returns 1 if the record was staged, and 0 if the
+   * lane is full and could not be published because the buffer has
+   * reached its high water mark. In this case, the insert should be
+   * retried, exactly as with DynamicExtension::insert.
+   */
+  int insert(const R &rec) {
+    if (m_records.size() >= m_capacity && publish() == 0) {
+      return 0;
+    }
+
+    m_records.push_back(rec);
+
+    if (m_records.size() >= m_capacity) {
+      publish();
+    }
+
+    return 1;
+  }
+
+  /*
+   * Attempt to publish all staged records into the buffer. Returns
+   * true if the lane is empty afterwards, and false if some records
+   * remain staged because the buffer reached its high water mark.
+   */
+  bool flush() {
+    while (m_records.size() > 0) {
+      if (publish() == 0) {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  size_t get_staged_count() { return m_records.size(); }
+
+  size_t get_capacity() { return m_capacity; }
+
+private:
+  ExtensionType *m_extension;
+  size_t m_capacity;
+  std::vector<R> m_records;
+
+  /*
+   * Insert as many staged records as the buffer will accept in one
+   * batch, and return the number of records that were published.
+   */
+  size_t publish() {
+    if (m_records.size() == 0) {
+      return 0;
+    }
+
+    size_t cnt = m_extension->insert_batch(
+        std::span<const R>(m_records.data(), m_records.size()));
+    m_records.erase(m_records.begin(), m_records.begin() + cnt);
+
+    return cnt;
+  }
+};
+
+} // namespace de
@@ -17,4 +17,78 @@ enum class LayoutPolicy { LEVELING, TEIRING, BSM };
 
 enum class DeletePolicy { TOMBSTONE, TAGGING };
 
+/*
+ * The configuration of a DynamicExtension, passed to its constructor.
+ * The watermarks and scale factor must always be given, and the
+ * remaining fields are optional. Designated initializers are the
+ * intended way to construct one, e.g.,
+ *
+ *   DE({.buffer_low_watermark = 100, .buffer_high_watermark = 1000,
+ *       .scale_factor = 2, .thread_cnt = 4})
+ */
+struct ExtensionConfiguration {
+  /*
+   * The number of records that can be inserted before a buffer flush
+   * is initiated
+   */
+  size_t buffer_low_watermark;
+
+  /*
+   * The maximum buffer capacity, inserts will begin to fail once this
+   * number is reached, until the buffer flush has completed. Has no
+   * effect in single-threaded operation
+   */
+  size_t buffer_high_watermark;
+
+  /*
+   * The rate at which the capacity of levels grows; should be at least
+   * 2 for reasonable performance
+   */
+  size_t scale_factor;
+
+  /*
+   * A soft limit on the number of bytes of memory used by the index,
+   * or 0 for no limit. A reconstruction will be deferred if the memory
+   * it is estimated to allocate would not fit within the budget
+   * alongside the memory already used by the index and reserved by
+   * other running reconstructions. While reconstructions are deferred
+   * the buffer cannot be flushed, and so inserts will begin to fail
+   * once it reaches its high watermark. A flush is always allowed to
+   * run once no other reconstruction is running, even if it exceeds the
+   * budget, so inserts are throttled rather than stopped, and the index
+   * may grow past the budget.
+   */
+  size_t memory_budget = 0;
+
+  /*
+   * The maximum number of threads available to the framework's
+   * scheduler for use in answering queries and performing compactions
+   * and flushes, etc.
+   */
+  size_t thread_cnt = 16;
+
+  /*
+   * If true, the buffer will maintain sorted runs of its records, built
+   * when they are first flushed or scanned, which are used to accelerate
+   * buffer queries and flushes
+   */
+  bool sorted_buffer = false;
+
+  /*
+   * If true, the buffer will maintain a hash index over its records'
+   * keys, which is used to accelerate point lookups and deletes against
+   * the buffer
+   */
+  bool hashed_buffer = false;
+
+  /*
+   * If non-zero, each level is split into key-range partitions of at
+   * most this many records, and reconstructions merge only the
+   * partitions needed to make room in a level with those that they
+   * overlap in the next, bounding the work done by each. Only supported
+   * under leveling, for shards satisfying PartitionedShardInterface
+   */
+  size_t partition_size = 0;
+};
+
 } // namespace de
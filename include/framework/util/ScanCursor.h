@@ -0,0 +1,209 @@
+/*
+ * include/framework/util/ScanCursor.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * A cursor for streaming the records within a key range out of the
+ * shards and buffer of a single epoch, in key order, as returned by
+ * DynamicExtension::scan. Rather than gathering every matching record
+ * from each shard and then merging them, the cursor merges the shards
+ * lazily, reading only as far into each as is needed to produce the
+ * next record. Tombstones (and tagged deletes) are applied as the
+ * records are merged, in the same way as rq::Query.
+ *
+ * The buffer's records are copied out when the cursor is opened, so it
+ * does not hold up the buffer. It does, however, hold a reference to the
+ * epoch that it was opened against, which prevents the shards of that
+ * epoch from being freed. Cursors should therefore be short-lived, and
+ * the reference is dropped as soon as the cursor is exhausted or closed.
+ */
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "framework/interface/Shard.h"
+#include "util/LoserTree.h"
+
+namespace de {
+
+template <ScannableShardInterface S> class ScanCursor {
+  typedef typename S::RECORD R;
+  typedef decltype(R::key) K;
+
+public:
+  /*
+   * Open a cursor over the records with keys in [lower, upper] within
+   * shards and buffer. If limit is non-zero, at most limit records will
+   * be returned. release is called once the cursor no longer needs the
+   * shards.
+   */
+  ScanCursor(const std::vector<S *> &shards, BufferView<R> &buffer,
+             const K &lower, const K &upper, size_t limit,
+             std::function<void()> release)
+      : m_upper(upper), m_limit(limit), m_returned(0),
+        m_release(std::move(release)), m_tree(shards.size() + 1) {
+
+    for (size_t i = 0; i < buffer.get_record_count(); i++) {
+      auto rec = buffer.get(i);
+      if (rec->rec.key >= lower && rec->rec.key <= upper) {
+        m_buffer_records.push_back(*rec);
+        m_buffer_records.back().header &= 3;
+      }
+    }
+    std::sort(m_buffer_records.begin(), m_buffer_records.end());
+
+    m_runs.push_back({nullptr, 0, m_buffer_records.size(), {}});
+    for (auto shard : shards) {
+      m_runs.push_back({shard, shard->get_lower_bound(lower),
+                        shard->get_record_count(), {}});
+    }
+
+    for (size_t i = 0; i < m_runs.size(); i++) {
+      m_tree.set_head(i, load(i) ? &m_runs[i].head : nullptr);
+    }
+    m_tree.build();
+
+    if (m_tree.empty()) {
+      close();
+    }
+  }
+
+  ~ScanCursor() { close(); }
+
+  ScanCursor(const ScanCursor &) = delete;
+  ScanCursor &operator=(const ScanCursor &) = delete;
+
+  /*
+   * Moving a cursor transfers its hold on the shards, leaving the
+   * moved-from cursor closed. The loser tree holds pointers to the heads
+   * within m_runs, which remain valid as moving the vector keeps its
+   * storage.
+   */
+  ScanCursor(ScanCursor &&other)
+      : m_upper(std::move(other.m_upper)), m_limit(other.m_limit),
+        m_returned(other.m_returned),
+        m_release(std::exchange(other.m_release, nullptr)),
+        m_buffer_records(std::move(other.m_buffer_records)),
+        m_runs(std::move(other.m_runs)), m_tree(std::move(other.m_tree)) {}
+
+  ScanCursor &operator=(ScanCursor &&other) {
+    if (this != &other) {
+      close();
+
+      m_upper = std::move(other.m_upper);
+      m_limit = other.m_limit;
+      m_returned = other.m_returned;
+      m_release = std::exchange(other.m_release, nullptr);
+      m_buffer_records = std::move(other.m_buffer_records);
+      m_runs = std::move(other.m_runs);
+      m_tree = std::move(other.m_tree);
+    }
+
+    return *this;
+  }
+
+  /*
+   * Store the next record in rec, returning false (and leaving rec
+   * unchanged) once there are no more records, or the limit has been
+   * reached.
+   */
+  bool next(R &rec) {
+    while (m_release && !m_tree.empty()) {
+      if (m_limit > 0 && m_returned >= m_limit) {
+        break;
+      }
+
+      Wrapped<R> now = m_runs[m_tree.top()].head;
+      advance(m_tree.top());
+
+      if (now.is_tombstone()) {
+        continue;
+      }
+
+      /* cancel now against a matching tombstone immediately after it */
+      if (!m_tree.empty()) {
+        auto next = m_tree.head(m_tree.top());
+        if (next->is_tombstone() && next->rec == now.rec) {
+          advance(m_tree.top());
+          continue;
+        }
+      }
+
+      if (now.is_deleted()) {
+        continue;
+      }
+
+      rec = now.rec;
+      m_returned++;
+      return true;
+    }
+
+    close();
+    return false;
+  }
+
+  /* the number of records returned so far */
+  size_t get_returned_count() const { return m_returned; }
+
+  /*
+   * Stop the scan, releasing the cursor's hold on the shards. Further
+   * calls to next will return false.
+   */
+  void close() {
+    if (m_release) {
+      m_release();
+      m_release = nullptr;
+    }
+  }
+
+private:
+  struct run {
+    /* nullptr for the buffer's records */
+    S *shard;
+    size_t idx;
+    size_t stop;
+
+    /* a copy of the record at idx */
+    Wrapped<R> head;
+  };
+
+  K m_upper;
+  size_t m_limit;
+  size_t m_returned;
+  std::function<void()> m_release;
+
+  std::vector<Wrapped<R>> m_buffer_records;
+  std::vector<run> m_runs;
+  LoserTree<Wrapped<R>> m_tree;
+
+  /*
+   * Read the record at the current position of run i into its head,
+   * returning false if the run is past the end of its records or the
+   * key range.
+   */
+  bool load(size_t i) {
+    auto &r = m_runs[i];
+    if (r.idx >= r.stop) {
+      return false;
+    }
+
+    r.head = (r.shard) ? (Wrapped<R>)*r.shard->get_record_at(r.idx)
+                       : m_buffer_records[r.idx];
+    r.head.header &= 3;
+
+    return r.head.rec.key <= m_upper;
+  }
+
+  /* advance run i, which must currently hold the smallest head */
+  void advance(size_t i) {
+    m_runs[i].idx++;
+    m_tree.replace_top(load(i) ? &m_runs[i].head : nullptr);
+  }
+};
+
+} // namespace de
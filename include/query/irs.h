@@ -28,7 +28,7 @@ public:
     gsl_rng *rng;
   };
 
-  struct LocalQuery {
+  struct LocalQuery : ScratchAllocated {
     size_t lower_idx;
     size_t upper_idx;
     size_t total_weight;
@@ -36,7 +36,7 @@ public:
     Parameters global_parms;
   };
 
-  struct LocalQueryBuffer {
+  struct LocalQueryBuffer : ScratchAllocated {
     BufferView<R> *buffer;
 
     size_t cutoff;
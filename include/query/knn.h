@@ -14,13 +14,11 @@
 #pragma once
 
 #include "framework/QueryRequirements.h"
-#include "psu-ds/PriorityQueue.h"
+#include "util/KNNCandidates.h"
 
 namespace de {
 namespace knn {
 
-using psudb::PriorityQueue;
-
 template <ShardInterface S> class Query {
   typedef typename S::RECORD R;
 
@@ -30,11 +28,11 @@ public:
     size_t k;
   };
 
-  struct LocalQuery {
+  struct LocalQuery : ScratchAllocated {
     Parameters global_parms;
   };
 
-  struct LocalQueryBuffer {
+  struct LocalQueryBuffer : ScratchAllocated {
     BufferView<R> *buffer;
     Parameters global_parms;
   };
@@ -66,36 +64,27 @@ public:
     return;
   }
 
-  static LocalResultType local_query(S *shard, LocalQuery *query) {
-    LocalResultType results;
-
-    Wrapped<R> wrec;
-    wrec.rec = query->global_parms.point;
-    wrec.header = 0;
-
-    PriorityQueue<Wrapped<R>, DistCmpMax<Wrapped<R>>> pq(query->global_parms.k,
-                                                         &wrec);
+  /*
+   * the number of records in the shard, as an upper bound; the fraction
+   * of a metric tree visited by a search depends upon the data, and
+   * grows quickly with its dimensionality
+   */
+  static size_t local_query_cost(S *shard, LocalQuery *query) {
+    return shard->get_record_count();
+  }
 
-    shard->search(query->global_parms.point, query->global_parms.k, pq);
+  static LocalResultType local_query(S *shard, LocalQuery *query) {
+    KNNCandidates<R> candidates(query->global_parms.point,
+                                query->global_parms.k);
 
-    while (pq.size() > 0) {
-      results.emplace_back(pq.peek().data);
-      pq.pop();
-    }
+    shard->search(candidates);
 
-    return results;
+    return candidates.get_results();
   }
 
   static LocalResultType local_query_buffer(LocalQueryBuffer *query) {
-
-    LocalResultType results;
-
-    Wrapped<R> wrec;
-    wrec.rec = query->global_parms.point;
-    wrec.header = 0;
-
-    PriorityQueue<Wrapped<R>, DistCmpMax<Wrapped<R>>> pq(query->global_parms.k,
-                                                         &wrec);
+    KNNCandidates<R> candidates(query->global_parms.point,
+                                query->global_parms.k);
 
     for (size_t i = 0; i < query->buffer->get_record_count(); i++) {
       // Skip over deleted records (under tagging)
@@ -103,54 +92,24 @@ public:
         continue;
       }
 
-      if (pq.size() < query->global_parms.k) {
-        pq.push(query->buffer->get(i));
-      } else {
-        double head_dist = pq.peek().data->rec.calc_distance(wrec.rec);
-        double cur_dist = (query->buffer->get(i))->rec.calc_distance(wrec.rec);
-
-        if (cur_dist < head_dist) {
-          pq.pop();
-          pq.push(query->buffer->get(i));
-        }
-      }
+      candidates.consider(query->buffer->get(i));
     }
 
-    while (pq.size() > 0) {
-      results.emplace_back(pq.peek().data);
-      pq.pop();
-    }
-
-    return results;
+    return candidates.get_results();
   }
 
   static void combine(std::vector<LocalResultType> const &local_results,
                       Parameters *parms, ResultType &output) {
-
-    Wrapped<R> wrec;
-    wrec.rec = parms->point;
-    wrec.header = 0;
-    PriorityQueue<Wrapped<R>, DistCmpMax<Wrapped<R>>> pq(parms->k, &wrec);
+    KNNCandidates<R> candidates(parms->point, parms->k);
 
     for (size_t i = 0; i < local_results.size(); i++) {
       for (size_t j = 0; j < local_results[i].size(); j++) {
-        if (pq.size() < parms->k) {
-          pq.push(local_results[i][j]);
-        } else {
-          double head_dist = pq.peek().data->rec.calc_distance(wrec.rec);
-          double cur_dist = local_results[i][j]->rec.calc_distance(wrec.rec);
-
-          if (cur_dist < head_dist) {
-            pq.pop();
-            pq.push(local_results[i][j]);
-          }
-        }
+        candidates.consider(local_results[i][j]);
       }
     }
 
-    while (pq.size() > 0) {
-      output.emplace_back(pq.peek().data->rec);
-      pq.pop();
+    for (auto rec : candidates.get_results()) {
+      output.emplace_back(rec->rec);
     }
   }
 
@@ -29,11 +29,11 @@ public:
     decltype(R::key) search_key;
   };
 
-  struct LocalQuery {
+  struct LocalQuery : ScratchAllocated {
     Parameters global_parms;
   };
 
-  struct LocalQueryBuffer {
+  struct LocalQueryBuffer : ScratchAllocated {
     BufferView<R> *buffer;
     Parameters global_parms;
   };
@@ -68,6 +68,13 @@ public:
   static LocalResultType local_query(S *shard, LocalQuery *query) {
     LocalResultType result;
 
+    /* skip the search if the shard's key filter rules the key out */
+    if constexpr (KeyFilteredShardInterface<S>) {
+      if (!shard->may_contain_key(query->global_parms.search_key)) {
+        return result;
+      }
+    }
+
     auto r = shard->point_lookup({query->global_parms.search_key, 0});
 
     if (r) {
@@ -80,14 +87,11 @@ public:
   static LocalResultType local_query_buffer(LocalQueryBuffer *query) {
     LocalResultType result;
 
-    for (size_t i = 0; i < query->buffer->get_record_count(); i++) {
-      auto rec = query->buffer->get(i);
-
-      if (rec->rec.key == query->global_parms.search_key) {
-        result.push_back(*rec);
-        return result;
-      }
-    }
+    auto key = query->global_parms.search_key;
+    query->buffer->for_each_with_key(key, [&result](Wrapped<R> *rec) {
+      result.push_back(*rec);
+      return false;
+    });
 
     return result;
   }
@@ -11,7 +11,10 @@
  */
 #pragma once
 
+#include <algorithm>
+
 #include "framework/QueryRequirements.h"
+#include "util/ScanKernels.h"
 
 namespace de {
 namespace rc {
@@ -25,13 +28,13 @@ public:
     decltype(R::key) upper_bound;
   };
 
-  struct LocalQuery {
+  struct LocalQuery : ScratchAllocated {
     size_t start_idx;
     size_t stop_idx;
     Parameters global_parms;
   };
 
-  struct LocalQueryBuffer {
+  struct LocalQueryBuffer : ScratchAllocated {
     BufferView<R> *buffer;
     Parameters global_parms;
   };
@@ -75,6 +78,21 @@ public:
     return;
   }
 
+  /*
+   * roughly the number of records in the range within the shard, which
+   * SoA shards count a bitmap word (64 records) at a time
+   */
+  static size_t local_query_cost(S *shard, LocalQuery *query) {
+    size_t stop = shard->get_lower_bound(query->global_parms.upper_bound);
+    size_t cnt = (stop > query->start_idx) ? stop - query->start_idx : 0;
+
+    if constexpr (SoAShardInterface<S>) {
+      return cnt / 64;
+    }
+
+    return cnt;
+  }
+
   static LocalResultType local_query(S *shard, LocalQuery *query) {
     LocalResultType result = {0, 0};
 
@@ -87,50 +105,65 @@ public:
       return result;
     }
 
-    auto ptr = shard->get_record_at(query->start_idx);
-
     /*
-     * roll the pointer forward to the first record that is
-     * greater than or equal to the lower bound.
+     * for SOA shards, only the key and flag arrays need to be touched to
+     * produce the count
      */
-    while (ptr < shard->get_data() + query->stop_idx &&
-           ptr->rec.key < query->global_parms.lower_bound) {
-      ptr++;
-    }
+    if constexpr (SoAShardInterface<S>) {
+      auto columns = shard->get_columns();
+      size_t idx = query->start_idx;
+      while (idx < query->stop_idx &&
+             columns->key(idx) < query->global_parms.lower_bound) {
+        idx++;
+      }
 
-    while (ptr < shard->get_data() + query->stop_idx &&
-           ptr->rec.key <= query->global_parms.upper_bound) {
+      /*
+       * the records in [idx, hi) are all within the range, so the counts
+       * can be taken directly from the flag bitmaps, a word at a time
+       */
+      size_t hi = std::upper_bound(columns->get_keys() + idx,
+                                   columns->get_keys() + query->stop_idx,
+                                   query->global_parms.upper_bound) -
+                  columns->get_keys();
 
-      if (!ptr->is_deleted()) {
-        result.record_count++;
+      auto &deletes = columns->get_deletes();
+      result.record_count += (hi - idx) - deletes.count(idx, hi);
+      result.tombstone_count +=
+          columns->get_tombstones().count_and_not(deletes, idx, hi);
 
-        if (ptr->is_tombstone()) {
-          result.tombstone_count++;
-        }
+      return result;
+    } else {
+      auto ptr = shard->get_record_at(query->start_idx);
+
+      /*
+       * roll the pointer forward to the first record that is
+       * greater than or equal to the lower bound.
+       */
+      while (ptr < shard->get_data() + query->stop_idx &&
+             ptr->rec.key < query->global_parms.lower_bound) {
+        ptr++;
       }
 
-      ptr++;
-    }
+      /*
+       * count the remaining records in bulk, stopping at the first block
+       * containing a key past the upper bound
+       */
+      simd::count_range(ptr, (shard->get_data() + query->stop_idx) - ptr,
+                        query->global_parms.lower_bound,
+                        query->global_parms.upper_bound, true,
+                        result.record_count, result.tombstone_count);
 
-    return result;
+      return result;
+    }
   }
 
   static LocalResultType
   local_query_buffer(LocalQueryBuffer *query) {
 
     LocalResultType result = {0, 0};
-    for (size_t i = 0; i < query->buffer->get_record_count(); i++) {
-      auto rec = query->buffer->get(i);
-      if (rec->rec.key >= query->global_parms.lower_bound &&
-          rec->rec.key <= query->global_parms.upper_bound) {
-        if (!rec->is_deleted()) {
-          result.record_count++;
-          if (rec->is_tombstone()) {
-            result.tombstone_count++;
-          }
-        }
-      }
-    }
+    query->buffer->count_in_range(query->global_parms.lower_bound,
+                                  query->global_parms.upper_bound,
+                                  result.record_count, result.tombstone_count);
 
     return result;
   }
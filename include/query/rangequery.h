@@ -27,13 +27,13 @@ public:
     decltype(R::key) upper_bound;
   };
 
-  struct LocalQuery {
+  struct LocalQuery : ScratchAllocated {
     size_t start_idx;
     size_t stop_idx;
     Parameters global_parms;
   };
 
-  struct LocalQueryBuffer {
+  struct LocalQueryBuffer : ScratchAllocated {
     BufferView<R> *buffer;
     Parameters global_parms;
   };
@@ -69,6 +69,12 @@ public:
     return;
   }
 
+  /* roughly the number of records in the range within the shard */
+  static size_t local_query_cost(S *shard, LocalQuery *query) {
+    size_t stop = shard->get_lower_bound(query->global_parms.upper_bound);
+    return (stop > query->start_idx) ? stop - query->start_idx : 0;
+  }
+
   static LocalResultType local_query(S *shard, LocalQuery *query) {
     LocalResultType result;
 
@@ -81,36 +87,56 @@ public:
       return result;
     }
 
-    auto ptr = shard->get_record_at(query->start_idx);
-
     /*
-     * roll the pointer forward to the first record that is
-     * greater than or equal to the lower bound.
+     * for SOA shards, scan the key array and only materialize the
+     * records falling within the range
      */
-    while (ptr < shard->get_data() + query->stop_idx &&
-           ptr->rec.key < query->global_parms.lower_bound) {
-      ptr++;
-    }
+    if constexpr (SoAShardInterface<S>) {
+      auto columns = shard->get_columns();
+      size_t idx = query->start_idx;
+      while (idx < query->stop_idx &&
+             columns->key(idx) < query->global_parms.lower_bound) {
+        idx++;
+      }
 
-    while (ptr < shard->get_data() + query->stop_idx &&
-           ptr->rec.key <= query->global_parms.upper_bound) {
-      result.emplace_back(*ptr);
-      ptr++;
-    }
+      while (idx < query->stop_idx &&
+             columns->key(idx) <= query->global_parms.upper_bound) {
+        result.emplace_back(columns->get(idx));
+        idx++;
+      }
 
-    return result;
+      return result;
+    } else {
+      auto ptr = shard->get_record_at(query->start_idx);
+
+      /*
+       * roll the pointer forward to the first record that is
+       * greater than or equal to the lower bound.
+       */
+      while (ptr < shard->get_data() + query->stop_idx &&
+             ptr->rec.key < query->global_parms.lower_bound) {
+        ptr++;
+      }
+
+      while (ptr < shard->get_data() + query->stop_idx &&
+             ptr->rec.key <= query->global_parms.upper_bound) {
+        result.emplace_back(*ptr);
+        ptr++;
+      }
+
+      return result;
+    }
   }
 
   static LocalResultType local_query_buffer(LocalQueryBuffer *query) {
 
     LocalResultType result;
-    for (size_t i = 0; i < query->buffer->get_record_count(); i++) {
-      auto rec = query->buffer->get(i);
-      if (rec->rec.key >= query->global_parms.lower_bound &&
-          rec->rec.key <= query->global_parms.upper_bound) {
-        result.emplace_back(*rec);
-      }
-    }
+    query->buffer->for_each_in_range(query->global_parms.lower_bound,
+                                     query->global_parms.upper_bound,
+                                     [&result](Wrapped<R> *rec) {
+                                       result.emplace_back(*rec);
+                                       return true;
+                                     });
 
     return result;
   }
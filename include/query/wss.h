@@ -26,14 +26,14 @@ public:
     gsl_rng *rng;
   };
 
-  struct LocalQuery {
+  struct LocalQuery : ScratchAllocated {
     size_t sample_size;
     decltype(R::weight) total_weight;
 
     Parameters global_parms;
   };
 
-  struct LocalQueryBuffer {
+  struct LocalQueryBuffer : ScratchAllocated {
     BufferView<R> *buffer;
 
     size_t sample_size;
@@ -19,12 +19,11 @@
 #include "framework/ShardRequirements.h"
 
 #include "psu-ds/Alias.h"
-#include "psu-ds/BloomFilter.h"
+#include "util/BlockedBloomFilter.h"
 #include "util/bf_config.h"
 #include "util/SortedMerge.h"
 
 using psudb::CACHELINE_SIZE;
-using psudb::BloomFilter;
 using psudb::byte;
 
 namespace de {
@@ -47,25 +46,23 @@ public:
         , m_reccnt(0)
         , m_tombstone_cnt(0)
         , m_alloc_size(0)
-        , m_bf(new BloomFilter<R>(BF_FPR, buffer.get_tombstone_count(), BF_HASH_FUNCS)) {
+        , m_bf(new BlockedBloomFilter<R>(BF_FPR, buffer.get_tombstone_count(), BF_HASH_FUNCS)) {
                        
 
-        m_alloc_size = psudb::sf_aligned_alloc(CACHELINE_SIZE, 
-                                               buffer.get_record_count() * 
-                                                 sizeof(Wrapped<R>), 
-                                               (byte**) &m_data);
+        m_alloc_size = pooled_aligned_alloc(buffer.get_record_count() * 
+                                              sizeof(Wrapped<R>), 
+                                            (byte**) &m_data);
 
-        auto res = sorted_array_from_bufferview<R>(std::move(buffer), m_data, m_bf);
+        std::vector<W> weights;
+        auto res = sorted_array_from_bufferview<R>(std::move(buffer), m_data, m_bf,
+            [this, &weights](const Wrapped<R> &rec) {
+                weights.emplace_back(rec.rec.weight);
+                m_total_weight += rec.rec.weight;
+            });
         m_reccnt = res.record_count;
         m_tombstone_cnt = res.tombstone_count;
 
         if (m_reccnt > 0) {
-            std::vector<W> weights;
-            for (size_t i=0; i<m_reccnt; i++) {
-                weights.emplace_back(m_data[i].rec.weight);
-                m_total_weight += m_data[i].rec.weight;
-            }
-
             build_alias_structure(weights);
         }
     }
@@ -83,28 +80,26 @@ public:
         size_t tombstone_count = 0;
         auto cursors = build_cursor_vec<R, Alias>(shards, &attemp_reccnt, &tombstone_count);
 
-        m_bf = new BloomFilter<R>(BF_FPR, tombstone_count, BF_HASH_FUNCS);
-        m_alloc_size = psudb::sf_aligned_alloc(CACHELINE_SIZE, 
-                                               attemp_reccnt * sizeof(Wrapped<R>),
-                                               (byte **) &m_data);
+        m_bf = new BlockedBloomFilter<R>(BF_FPR, tombstone_count, BF_HASH_FUNCS);
+        m_alloc_size = pooled_aligned_alloc(attemp_reccnt * sizeof(Wrapped<R>),
+                                            (byte **) &m_data);
 
-        auto res = sorted_array_merge<R>(cursors, m_data, m_bf);
+        std::vector<W> weights;
+        auto res = sorted_array_merge<R>(cursors, m_data, m_bf,
+            [this, &weights](const Wrapped<R> &rec) {
+                weights.emplace_back(rec.rec.weight);
+                m_total_weight += rec.rec.weight;
+            });
         m_reccnt = res.record_count;
         m_tombstone_cnt = res.tombstone_count;
 
         if (m_reccnt > 0) {
-            std::vector<W> weights;
-            for (size_t i=0; i<m_reccnt; i++) {
-                weights.emplace_back(m_data[i].rec.weight);
-                m_total_weight += m_data[i].rec.weight;
-            }
-
             build_alias_structure(weights);
         }
    }
 
     ~Alias() {
-        free(m_data);
+        pooled_free(m_data);
         delete m_alias;
         delete m_bf;
     }
@@ -200,6 +195,6 @@ private:
     size_t m_reccnt;
     size_t m_tombstone_cnt;
     size_t m_alloc_size;
-    BloomFilter<R> *m_bf;
+    BlockedBloomFilter<R> *m_bf;
 };
 }
@@ -6,7 +6,10 @@
  *
  * Distributed under the Modified BSD License.
  *
- * A shard shim around an in-memory ISAM tree.
+ * A shard shim around an in-memory ISAM tree. The records can be stored
+ * either as an array of Wrapped<R> (the default), or using the SOA
+ * layout from util/SoAArray.h, in which case the leaves of the tree
+ * are formed from the key array alone.
  *
  * TODO: The code in this file is very poorly commented.
  */
@@ -17,17 +20,22 @@
 
 #include "framework/ShardRequirements.h"
 
-#include "psu-ds/BloomFilter.h"
+#include "util/ParallelBuild.h"
+#include "util/ShardFilters.h"
+#include "util/SoAArray.h"
 #include "util/SortedMerge.h"
+#include "util/ZoneMap.h"
 #include "util/bf_config.h"
 
-using psudb::BloomFilter;
 using psudb::byte;
 using psudb::CACHELINE_SIZE;
 
 namespace de {
 
-template <KVPInterface R> class ISAMTree {
+template <KVPInterface R, RecordLayout L = RecordLayout::AOS> class ISAMTree {
+  static_assert(L == RecordLayout::AOS || SoARecordInterface<R>,
+                "record type does not support the SOA layout");
+
 private:
   typedef decltype(R::key) K;
   typedef decltype(R::value) V;
@@ -43,22 +51,35 @@ private:
 
   static_assert(sizeof(InternalNode) == NODE_SZ, "node size does not match");
 
-  constexpr static size_t LEAF_FANOUT = NODE_SZ / sizeof(R);
+  constexpr static size_t LEAF_FANOUT =
+      NODE_SZ / ((L == RecordLayout::SOA) ? sizeof(K) : sizeof(R));
+
+  /* the minimum number of internal nodes built by each thread */
+  constexpr static size_t INTERNAL_BUILD_GRAIN = 4096;
 
 public:
   typedef R RECORD;
 
   ISAMTree(BufferView<R> buffer)
-      : m_bf(nullptr), m_isam_nodes(nullptr), m_root(nullptr), m_reccnt(0),
-        m_tombstone_cnt(0), m_internal_node_cnt(0), m_deleted_cnt(0),
-        m_alloc_size(0) {
-    m_alloc_size = psudb::sf_aligned_alloc(
-        CACHELINE_SIZE, buffer.get_record_count() * sizeof(Wrapped<R>),
-        (byte **)&m_data);
-
-    auto res = sorted_array_from_bufferview(std::move(buffer), m_data, m_bf);
+      : m_bf(nullptr), m_key_bf(nullptr), m_isam_nodes(nullptr),
+        m_root(nullptr), m_reccnt(0), m_tombstone_cnt(0),
+        m_internal_node_cnt(0), m_deleted_cnt(0), m_alloc_size(0),
+        m_data(nullptr) {
+    merge_info res;
+    if constexpr (L == RecordLayout::SOA) {
+      m_alloc_size = m_columns.allocate(buffer.get_record_count());
+      res = sorted_array_from_bufferview(std::move(buffer), m_columns);
+    } else {
+      m_alloc_size = pooled_aligned_alloc(
+          buffer.get_record_count() * sizeof(Wrapped<R>), (byte **)&m_data);
+      res = sorted_array_from_bufferview(std::move(buffer), m_data);
+    }
+
     m_reccnt = res.record_count;
     m_tombstone_cnt = res.tombstone_count;
+    build_shard_filters<R>(this, m_reccnt, m_tombstone_cnt, &m_bf,
+                           &m_key_bf);
+    m_zones = ZoneMap<K>(m_reccnt, [this](size_t i) { return key_at(i); });
 
     if (m_reccnt > 0) {
       build_internal_levels();
@@ -66,35 +87,60 @@ public:
   }
 
   ISAMTree(std::vector<ISAMTree *> const &shards)
-      : m_bf(nullptr), m_isam_nodes(nullptr), m_root(nullptr), m_reccnt(0),
-        m_tombstone_cnt(0), m_internal_node_cnt(0), m_deleted_cnt(0),
-        m_alloc_size(0) {
+      : m_bf(nullptr), m_key_bf(nullptr), m_isam_nodes(nullptr),
+        m_root(nullptr), m_reccnt(0), m_tombstone_cnt(0),
+        m_internal_node_cnt(0), m_deleted_cnt(0), m_alloc_size(0),
+        m_data(nullptr) {
     size_t attemp_reccnt = 0;
     size_t tombstone_count = 0;
-    auto cursors =
-        build_cursor_vec<R, ISAMTree>(shards, &attemp_reccnt, &tombstone_count);
 
-    m_bf = nullptr;
-    m_alloc_size = psudb::sf_aligned_alloc(
-        CACHELINE_SIZE, attemp_reccnt * sizeof(Wrapped<R>), (byte **)&m_data);
+    if constexpr (L == RecordLayout::SOA) {
+      auto cursors = build_soa_cursor_vec<R, ISAMTree>(shards, &attemp_reccnt,
+                                                       &tombstone_count);
+      merge_cursors(cursors, attemp_reccnt);
+    } else {
+      auto cursors = build_cursor_vec<R, ISAMTree>(shards, &attemp_reccnt,
+                                                   &tombstone_count);
+      merge_cursors(cursors, attemp_reccnt);
+    }
+  }
 
-    auto res = sorted_array_merge<R>(cursors, m_data, m_bf);
-    m_reccnt = res.record_count;
-    m_tombstone_cnt = res.tombstone_count;
+  /*
+   * Construct a tree from only the records in the [start, stop) index
+   * range given in ranges for each of shards, as is done when building
+   * the key-range partitions of a level.
+   */
+  ISAMTree(std::vector<ISAMTree *> const &shards,
+           std::vector<std::pair<size_t, size_t>> const &ranges)
+      : m_bf(nullptr), m_key_bf(nullptr), m_isam_nodes(nullptr),
+        m_root(nullptr), m_reccnt(0), m_tombstone_cnt(0),
+        m_internal_node_cnt(0), m_deleted_cnt(0), m_alloc_size(0),
+        m_data(nullptr) {
+    size_t attemp_reccnt = 0;
+    size_t tombstone_count = 0;
 
-    if (m_reccnt > 0) {
-      build_internal_levels();
+    if constexpr (L == RecordLayout::SOA) {
+      auto cursors = build_soa_cursor_vec<R, ISAMTree>(
+          shards, ranges, &attemp_reccnt, &tombstone_count);
+      merge_cursors(cursors, attemp_reccnt);
+    } else {
+      auto cursors = build_cursor_vec<R, ISAMTree>(
+          shards, ranges, &attemp_reccnt, &tombstone_count);
+      merge_cursors(cursors, attemp_reccnt);
     }
   }
 
   ~ISAMTree() {
-    free(m_data);
-    free(m_isam_nodes);
+    pooled_free(m_data);
+    pooled_free(m_isam_nodes);
     delete m_bf;
+    delete m_key_bf;
   }
 
-  Wrapped<R> *point_lookup(const R &rec, bool filter = false) {
-    if (filter && !m_bf->lookup(rec)) {
+  Wrapped<R> *point_lookup(const R &rec, bool filter = false)
+    requires(L == RecordLayout::AOS)
+  {
+    if (filter && m_bf && !m_bf->lookup(rec.key)) {
       return nullptr;
     }
 
@@ -113,7 +159,36 @@ public:
     return nullptr;
   }
 
-  Wrapped<R> *get_data() const { return m_data; }
+  WrappedRef<R> point_lookup(const R &rec, bool filter = false)
+    requires(L == RecordLayout::SOA)
+  {
+    if (filter && m_bf && !m_bf->lookup(rec.key)) {
+      return {};
+    }
+
+    size_t idx = get_lower_bound(rec.key);
+    while (idx < m_reccnt && m_columns.key(idx) == rec.key) {
+      auto ref = m_columns.ref(idx);
+      if (ref.rec == rec) {
+        return ref;
+      }
+      idx++;
+    }
+
+    return {};
+  }
+
+  Wrapped<R> *get_data() const
+    requires(L == RecordLayout::AOS)
+  {
+    return m_data;
+  }
+
+  const SoAArray<R> *get_columns() const
+    requires(L == RecordLayout::SOA)
+  {
+    return &m_columns;
+  }
 
   size_t get_record_count() const { return m_reccnt; }
 
@@ -121,7 +196,34 @@ public:
 
   size_t get_memory_usage() const { return m_internal_node_cnt * NODE_SZ; }
 
-  size_t get_aux_memory_usage() const { return (m_bf) ? m_bf->memory_usage() : 0; }
+  size_t get_aux_memory_usage() const {
+    return ((m_bf) ? m_bf->memory_usage() : 0) +
+           ((m_key_bf) ? m_key_bf->memory_usage() : 0) +
+           m_zones.get_memory_usage();
+  }
+
+  /*
+   * Return false if no record within the shard has the specified key,
+   * according to the shard's key filter. A return value of true means
+   * that the key may be present.
+   */
+  bool may_contain_key(const K &key) const {
+    return !m_key_bf || m_key_bf->lookup(key);
+  }
+
+  /* the smallest and largest keys within the shard, which must not be empty */
+  const K &get_min_key() const { return key_at(0); }
+
+  const K &get_max_key() const { return key_at(m_reccnt - 1); }
+
+  /*
+   * Return false if no record within the shard has a key within [lower,
+   * upper], according to the shard's zone map. A return value of true
+   * means that such a record may be present.
+   */
+  bool may_contain_range(const K &lower, const K &upper) const {
+    return m_zones.overlaps(lower, upper);
+  }
 
   /* SortedShardInterface methods */
   size_t get_lower_bound(const K &key) const {
@@ -140,11 +242,11 @@ public:
                        now->child[INTERNAL_FANOUT - 1]);
     }
 
-    const Wrapped<R> *pos = reinterpret_cast<const Wrapped<R> *>(now);
-    while (pos < m_data + m_reccnt && pos->rec.key < key)
-      pos++;
+    size_t idx = leaf_index(reinterpret_cast<const byte *>(now));
+    while (idx < m_reccnt && key_at(idx) < key)
+      idx++;
 
-    return pos - m_data;
+    return idx;
   }
 
   size_t get_upper_bound(const K &key) const {
@@ -163,87 +265,171 @@ public:
                        now->child[INTERNAL_FANOUT - 1]);
     }
 
-    const Wrapped<R> *pos = reinterpret_cast<const Wrapped<R> *>(now);
-    while (pos < m_data + m_reccnt && pos->rec.key <= key)
-      pos++;
+    size_t idx = leaf_index(reinterpret_cast<const byte *>(now));
+    while (idx < m_reccnt && key_at(idx) <= key)
+      idx++;
 
-    return pos - m_data;
+    return idx;
   }
 
-  const Wrapped<R> *get_record_at(size_t idx) const {
+  const Wrapped<R> *get_record_at(size_t idx) const
+    requires(L == RecordLayout::AOS)
+  {
     return (idx < m_reccnt) ? m_data + idx : nullptr;
   }
 
+  WrappedRef<R> get_record_at(size_t idx) const
+    requires(L == RecordLayout::SOA)
+  {
+    return (idx < m_reccnt) ? m_columns.ref(idx) : WrappedRef<R>();
+  }
+
 private:
+  /*
+   * Merge the records of cursors, of which there are at most reccnt, into
+   * the tree's record array, and build the internal levels over them.
+   */
+  template <typename C>
+  void merge_cursors(std::vector<C> &cursors, size_t reccnt) {
+    merge_info res;
+    if constexpr (L == RecordLayout::SOA) {
+      m_alloc_size = m_columns.allocate(reccnt);
+      res = sorted_array_merge<R>(cursors, m_columns);
+    } else {
+      m_alloc_size =
+          pooled_aligned_alloc(reccnt * sizeof(Wrapped<R>), (byte **)&m_data);
+      res = sorted_array_merge<R>(cursors, m_data);
+    }
+
+    m_reccnt = res.record_count;
+    m_tombstone_cnt = res.tombstone_count;
+    build_shard_filters<R>(this, m_reccnt, m_tombstone_cnt, &m_bf,
+                           &m_key_bf);
+    m_zones = ZoneMap<K>(m_reccnt, [this](size_t i) { return key_at(i); });
+
+    if (m_reccnt > 0) {
+      build_internal_levels();
+    }
+  }
+
+  /*
+   * Build the internal nodes of the tree, one level at a time starting
+   * from the level above the leaves. As every node but the last of a
+   * level is full, the children of each node can be determined from its
+   * index, and so the nodes of a level are built in parallel when the
+   * calling thread has a BuildContext installed.
+   */
   void build_internal_levels() {
     size_t n_leaf_nodes =
         m_reccnt / LEAF_FANOUT + (m_reccnt % LEAF_FANOUT != 0);
 
+    std::vector<size_t> level_node_cnts;
     size_t level_node_cnt = n_leaf_nodes;
     size_t node_cnt = 0;
     do {
       level_node_cnt = level_node_cnt / INTERNAL_FANOUT +
                        (level_node_cnt % INTERNAL_FANOUT != 0);
+      level_node_cnts.push_back(level_node_cnt);
       node_cnt += level_node_cnt;
     } while (level_node_cnt > 1);
 
-    m_alloc_size += psudb::sf_aligned_calloc(CACHELINE_SIZE, node_cnt, NODE_SZ,
-                                             (byte **)&m_isam_nodes);
+    m_alloc_size +=
+        pooled_aligned_calloc(node_cnt, NODE_SZ, (byte **)&m_isam_nodes);
     m_internal_node_cnt = node_cnt;
 
-    InternalNode *current_node = m_isam_nodes;
+    InternalNode *level_start = m_isam_nodes;
+    parallel_for(level_node_cnts[0], INTERNAL_BUILD_GRAIN,
+                 [&](size_t start, size_t stop) {
+                   for (size_t j = start; j < stop; j++) {
+                     build_leaf_parent(level_start + j, j);
+                   }
+                 });
+
+    for (size_t l = 1; l < level_node_cnts.size(); l++) {
+      InternalNode *children = level_start;
+      size_t child_cnt = level_node_cnts[l - 1];
+      level_start += child_cnt;
+
+      parallel_for(level_node_cnts[l], INTERNAL_BUILD_GRAIN,
+                   [&](size_t start, size_t stop) {
+                     for (size_t j = start; j < stop; j++) {
+                       build_internal_parent(level_start + j, children,
+                                             child_cnt, j);
+                     }
+                   });
+    }
 
-    const Wrapped<R> *leaf_base = m_data;
-    const Wrapped<R> *leaf_stop = m_data + m_reccnt;
-    while (leaf_base < leaf_stop) {
-      size_t fanout = 0;
-      for (size_t i = 0; i < INTERNAL_FANOUT; ++i) {
-        auto rec_ptr = leaf_base + LEAF_FANOUT * i;
-        if (rec_ptr >= leaf_stop)
-          break;
-        const Wrapped<R> *sep_key =
-            std::min(rec_ptr + LEAF_FANOUT - 1, leaf_stop - 1);
-        current_node->keys[i] = sep_key->rec.key;
-        current_node->child[i] = (byte *)rec_ptr;
-        ++fanout;
-      }
-      current_node++;
-      leaf_base += fanout * LEAF_FANOUT;
+    assert(level_node_cnts.back() == 1);
+    m_root = level_start;
+  }
+
+  /*
+   * Fill in node, the idx'th node of the lowest internal level, whose
+   * children are leaves
+   */
+  void build_leaf_parent(InternalNode *node, size_t idx) {
+    size_t leaf_base = idx * INTERNAL_FANOUT * LEAF_FANOUT;
+    for (size_t i = 0; i < INTERNAL_FANOUT; ++i) {
+      size_t rec_idx = leaf_base + LEAF_FANOUT * i;
+      if (rec_idx >= m_reccnt)
+        break;
+      size_t sep_idx = std::min(rec_idx + LEAF_FANOUT - 1, m_reccnt - 1);
+      node->keys[i] = key_at(sep_idx);
+      node->child[i] = (byte *)leaf_ptr(rec_idx);
     }
+  }
 
-    auto level_start = m_isam_nodes;
-    auto level_stop = current_node;
-    auto current_level_node_cnt = level_stop - level_start;
-    while (current_level_node_cnt > 1) {
-      auto now = level_start;
-      while (now < level_stop) {
-        size_t child_cnt = 0;
-        for (size_t i = 0; i < INTERNAL_FANOUT; ++i) {
-          auto node_ptr = now + i;
-          ++child_cnt;
-          if (node_ptr >= level_stop)
-            break;
-          current_node->keys[i] = node_ptr->keys[INTERNAL_FANOUT - 1];
-          current_node->child[i] = (byte *)node_ptr;
-        }
-        now += child_cnt;
-        current_node++;
-      }
-      level_start = level_stop;
-      level_stop = current_node;
-      current_level_node_cnt = level_stop - level_start;
+  /*
+   * Fill in node, the idx'th node of an internal level above the level
+   * containing the child_cnt nodes starting at children
+   */
+  void build_internal_parent(InternalNode *node, InternalNode *children,
+                             size_t child_cnt, size_t idx) {
+    for (size_t i = 0; i < INTERNAL_FANOUT; ++i) {
+      size_t child_idx = idx * INTERNAL_FANOUT + i;
+      if (child_idx >= child_cnt)
+        break;
+      node->keys[i] = children[child_idx].keys[INTERNAL_FANOUT - 1];
+      node->child[i] = (byte *)(children + child_idx);
     }
+  }
 
-    assert(current_level_node_cnt == 1);
-    m_root = level_start;
+  /*
+   * The leaves of the tree are the record array for the AOS layout, and
+   * the key array for the SOA layout. These return the address of the
+   * idx'th entry of the leaves, and the index of a leaf entry address.
+   */
+  const byte *leaf_ptr(size_t idx) const {
+    if constexpr (L == RecordLayout::SOA) {
+      return (const byte *)(m_columns.get_keys() + idx);
+    } else {
+      return (const byte *)(m_data + idx);
+    }
+  }
+
+  size_t leaf_index(const byte *ptr) const {
+    if constexpr (L == RecordLayout::SOA) {
+      return (const K *)ptr - m_columns.get_keys();
+    } else {
+      return (const Wrapped<R> *)ptr - m_data;
+    }
+  }
+
+  const K &key_at(size_t idx) const {
+    if constexpr (L == RecordLayout::SOA) {
+      return m_columns.key(idx);
+    } else {
+      return m_data[idx].rec.key;
+    }
   }
 
   bool is_leaf(const byte *ptr) const {
-    return ptr >= (const byte *)m_data &&
-           ptr < (const byte *)(m_data + m_reccnt);
+    return ptr >= leaf_ptr(0) && ptr < leaf_ptr(m_reccnt);
   }
 
-  psudb::BloomFilter<R> *m_bf;
+  BlockedBloomFilter<K> *m_bf;
+  BlockedBloomFilter<K> *m_key_bf;
+  ZoneMap<K> m_zones;
   InternalNode *m_isam_nodes;
   InternalNode *m_root;
   size_t m_reccnt;
@@ -253,5 +439,6 @@ private:
   size_t m_alloc_size;
 
   Wrapped<R> *m_data;
+  SoAArray<R> m_columns;
 };
 } // namespace de
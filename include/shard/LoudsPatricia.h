@@ -17,9 +17,6 @@
 #include "util/SortedMerge.h"
 
 using psudb::CACHELINE_SIZE;
-using psudb::BloomFilter;
-using psudb::PriorityQueue;
-using psudb::queue_record;
 using psudb::byte;
 
 namespace de {
@@ -43,43 +40,13 @@ public:
 
         m_louds = new louds::Patricia();
 
-        size_t cnt = 0;
-        std::vector<std::string> keys;
-        keys.reserve(buffer.get_record_count());
-
-        /*
-         * Copy the contents of the buffer view into a temporary buffer, and
-         * sort them. We still need to iterate over these temporary records to 
-         * apply tombstone/deleted record filtering, as well as any possible
-         * per-record processing that is required by the shard being built.
-         */
-        auto temp_buffer = new Wrapped<R>[buffer.get_record_count()]();
-        for (size_t i=0; i<buffer.get_record_count(); i++) {
-            temp_buffer[i] = *(buffer.get(i));
-        }
-
-        auto base = temp_buffer;
-        auto stop = base + buffer.get_record_count();
-        std::sort(base, stop, std::less<Wrapped<R>>());
-
-        for (size_t i=0; i<buffer.get_record_count(); i++) {
-            if (temp_buffer[i].is_deleted() || !temp_buffer[i].is_visible() || temp_buffer[i].rec.key == "") {
-                continue;
-            }
-
-            m_data[cnt] = temp_buffer[i];
-            m_data[cnt].clear_timestamp();
-
-            m_louds->add(std::string(m_data[cnt].rec.key));
-            cnt++;
-        }
+        auto info = sorted_array_from_bufferview<R>(std::move(buffer), m_data, nullptr,
+            [this](const Wrapped<R> &rec) { m_louds->add(std::string(rec.rec.key)); });
 
-        m_reccnt = cnt;
+        m_reccnt = info.record_count;
         if (m_reccnt > 0) {
             m_louds->build();
         }
-
-        delete[] temp_buffer;
     }
 
     LoudsPatricia(std::vector<LoudsPatricia*> &shards) 
@@ -96,44 +63,10 @@ public:
 
         m_louds = new louds::Patricia();
 
-        // FIXME: For smaller cursor arrays, it may be more efficient to skip
-        //        the priority queue and just do a scan.
-        PriorityQueue<Wrapped<R>> pq(cursors.size());
-        for (size_t i=0; i<cursors.size(); i++) {
-            pq.push(cursors[i].ptr, i);
-        }
-
-        while (pq.size()) {
-            auto now = pq.peek();
-            auto next = pq.size() > 1 ? pq.peek(1) : queue_record<Wrapped<R>>{nullptr, 0};
-            /* 
-             * if the current record is not a tombstone, and the next record is
-             * a tombstone that matches the current one, then the current one
-             * has been deleted, and both it and its tombstone can be skipped
-             * over.
-             */
-            if (!now.data->is_tombstone() && next.data != nullptr &&
-                now.data->rec == next.data->rec && next.data->is_tombstone()) {
-                
-                pq.pop(); pq.pop();
-                auto& cursor1 = cursors[now.version];
-                auto& cursor2 = cursors[next.version];
-                if (advance_cursor(cursor1)) pq.push(cursor1.ptr, now.version);
-                if (advance_cursor(cursor2)) pq.push(cursor2.ptr, next.version);
-            } else {
-                auto& cursor = cursors[now.version];
-                /* skip over records that have been deleted via tagging */
-                if (!cursor.ptr->is_deleted() && cursor.ptr->rec.key != "") {
-                    m_data[m_reccnt] = *cursor.ptr;
-                    m_louds->add(std::string(m_data[m_reccnt].rec.key));
-                    m_reccnt++;
-                }
-                pq.pop();
-                
-                if (advance_cursor(cursor)) pq.push(cursor.ptr, now.version);
-            }
-        }
+        auto info = sorted_array_merge<R>(cursors, m_data, nullptr,
+            [this](const Wrapped<R> &rec) { m_louds->add(std::string(rec.rec.key)); });
 
+        m_reccnt = info.record_count;
         if (m_reccnt > 0) {
             m_louds->build();
         }
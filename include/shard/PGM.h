@@ -7,32 +7,36 @@
  * Distributed under the Modified BSD License.
  *
  * A shard shim around the static version of the PGM learned
- * index.
+ * index. The records can be stored either as an array of Wrapped<R>
+ * (the default), or using the SOA layout from util/SoAArray.h, in
+ * which case the index is built directly over the key array.
  *
  * TODO: The code in this file is very poorly commented.
  */
 #pragma once
 
 
+#include <iterator>
 #include <vector>
 
 #include "framework/ShardRequirements.h"
 
 #include "pgm/pgm_index.hpp"
-#include "psu-ds/BloomFilter.h"
+#include "util/ShardFilters.h"
+#include "util/SoAArray.h"
 #include "util/SortedMerge.h"
+#include "util/ZoneMap.h"
 #include "util/bf_config.h"
 
 using psudb::CACHELINE_SIZE;
-using psudb::BloomFilter;
-using psudb::PriorityQueue;
-using psudb::queue_record;
 using psudb::byte;
 
 namespace de {
 
-template <RecordInterface R, size_t epsilon=128>
+template <KVPInterface R, size_t epsilon=128, RecordLayout L=RecordLayout::AOS>
 class PGM {
+    static_assert(L == RecordLayout::AOS || SoARecordInterface<R>,
+                  "record type does not support the SOA layout");
 public:
     typedef R RECORD;
 private:
@@ -41,156 +45,73 @@ private:
 
 public:
     PGM(BufferView<R> buffer)
-        : m_bf(nullptr)
+        : m_data(nullptr)
+        , m_bf(nullptr)
+        , m_key_bf(nullptr)
         , m_reccnt(0)
         , m_tombstone_cnt(0)
         , m_alloc_size(0) {
 
-        m_alloc_size = psudb::sf_aligned_alloc(CACHELINE_SIZE, 
-                                               buffer.get_record_count() * 
-                                                 sizeof(Wrapped<R>), 
-                                               (byte**) &m_data);
-
-        std::vector<K> keys;
-        /*
-         * Copy the contents of the buffer view into a temporary buffer, and
-         * sort them. We still need to iterate over these temporary records to 
-         * apply tombstone/deleted record filtering, as well as any possible
-         * per-record processing that is required by the shard being built.
-         */
-        auto temp_buffer = (Wrapped<R> *) psudb::sf_aligned_calloc(CACHELINE_SIZE, 
-                                                                   buffer.get_record_count(), 
-                                                                   sizeof(Wrapped<R>));
-        buffer.copy_to_buffer((byte *) temp_buffer);
-
-        auto base = temp_buffer;
-        auto stop = base + buffer.get_record_count();
-        std::sort(base, stop, std::less<Wrapped<R>>());
-
         merge_info info = {0, 0};
 
-        /* 
-         * Iterate over the temporary buffer to process the records, copying
-         * them into buffer as needed
-         */
-        while (base < stop) {
-            if (!base->is_tombstone() && (base + 1 < stop)
-                && base->rec == (base + 1)->rec  && (base + 1)->is_tombstone()) {
-                base += 2;
-                continue;
-            } else if (base->is_deleted()) {
-                base += 1;
-                continue;
-            }
-
-            // FIXME: this shouldn't be necessary, but the tagged record
-            // bypass doesn't seem to be working on this code-path, so this
-            // ensures that tagged records from the buffer are able to be
-            // dropped, eventually. It should only need to be &= 1
-            base->header &= 3;
-            keys.emplace_back(base->rec.key);
-            m_data[info.record_count++] = *base;
-
-            if (base->is_tombstone()) {
-                info.tombstone_count++;
-                if (m_bf){
-                    m_bf->insert(base->rec);
-                }
-            }
-
-            base++;
+        if constexpr (L == RecordLayout::SOA) {
+            m_alloc_size = m_columns.allocate(buffer.get_record_count());
+            info = sorted_array_from_bufferview(std::move(buffer), m_columns);
+        } else {
+            m_alloc_size = pooled_aligned_alloc(buffer.get_record_count() * 
+                                                  sizeof(Wrapped<R>), 
+                                                (byte**) &m_data);
+            info = sorted_array_from_bufferview(std::move(buffer), m_data);
         }
 
-        free(temp_buffer);
-
         m_reccnt = info.record_count;
         m_tombstone_cnt = info.tombstone_count;
-
-        if (m_reccnt > 0) {
-            m_pgm = pgm::PGMIndex<K, epsilon>(keys);
-        }
+        build_shard_filters<R>(this, m_reccnt, m_tombstone_cnt, &m_bf, &m_key_bf);
+        m_zones = ZoneMap<K>(m_reccnt, [this](size_t i) { return key_at(i); });
+        build_index();
     }
 
     PGM(std::vector<PGM*> const &shards)
         : m_data(nullptr)
         , m_bf(nullptr)
+        , m_key_bf(nullptr)
         , m_reccnt(0)
         , m_tombstone_cnt(0)
         , m_alloc_size(0) {
         
         size_t attemp_reccnt = 0;
         size_t tombstone_count = 0;
-        auto cursors = build_cursor_vec<R, PGM>(shards, &attemp_reccnt, &tombstone_count);
-
-        m_alloc_size = psudb::sf_aligned_alloc(CACHELINE_SIZE, 
-                                               attemp_reccnt * sizeof(Wrapped<R>),
-                                               (byte **) &m_data);
-        std::vector<K> keys;
-
-        // FIXME: For smaller cursor arrays, it may be more efficient to skip
-        //        the priority queue and just do a scan.
-        PriorityQueue<Wrapped<R>> pq(cursors.size());
-        for (size_t i=0; i<cursors.size(); i++) {
-            pq.push(cursors[i].ptr, i);
-        }
-
         merge_info info = {0, 0};
-        while (pq.size()) {
-            auto now = pq.peek();
-            auto next = pq.size() > 1 ? pq.peek(1) : queue_record<Wrapped<R>>{nullptr, 0};
-            /* 
-             * if the current record is not a tombstone, and the next record is
-             * a tombstone that matches the current one, then the current one
-             * has been deleted, and both it and its tombstone can be skipped
-             * over.
-             */
-            if (!now.data->is_tombstone() && next.data != nullptr &&
-                now.data->rec == next.data->rec && next.data->is_tombstone()) {
-                
-                pq.pop(); pq.pop();
-                auto& cursor1 = cursors[now.version];
-                auto& cursor2 = cursors[next.version];
-                if (advance_cursor(cursor1)) pq.push(cursor1.ptr, now.version);
-                if (advance_cursor(cursor2)) pq.push(cursor2.ptr, next.version);
-            } else {
-                auto& cursor = cursors[now.version];
-                /* skip over records that have been deleted via tagging */
-                if (!cursor.ptr->is_deleted()) {
-                    keys.emplace_back(cursor.ptr->rec.key);
-                    m_data[info.record_count++] = *cursor.ptr;
-
-                    /*  
-                     * if the record is a tombstone, increment the ts count and 
-                     * insert it into the bloom filter if one has been
-                     * provided.
-                     */
-                    if (cursor.ptr->is_tombstone()) {
-                        info.tombstone_count++;
-                        if (m_bf) {
-                            m_bf->insert(cursor.ptr->rec);
-                        }
-                    }
-                }
-                pq.pop();
-                
-                if (advance_cursor(cursor)) pq.push(cursor.ptr, now.version);
-            }
+
+        if constexpr (L == RecordLayout::SOA) {
+            auto cursors = build_soa_cursor_vec<R, PGM>(shards, &attemp_reccnt, &tombstone_count);
+            m_alloc_size = m_columns.allocate(attemp_reccnt);
+            info = sorted_array_merge<R>(cursors, m_columns);
+        } else {
+            auto cursors = build_cursor_vec<R, PGM>(shards, &attemp_reccnt, &tombstone_count);
+            m_alloc_size = pooled_aligned_alloc(attemp_reccnt * sizeof(Wrapped<R>),
+                                                (byte **) &m_data);
+            info = sorted_array_merge<R>(cursors, m_data);
         }
 
         m_reccnt = info.record_count;
         m_tombstone_cnt = info.tombstone_count;
-
-        if (m_reccnt > 0) {
-            m_pgm = pgm::PGMIndex<K, epsilon>(keys);
-        }
+        build_shard_filters<R>(this, m_reccnt, m_tombstone_cnt, &m_bf, &m_key_bf);
+        m_zones = ZoneMap<K>(m_reccnt, [this](size_t i) { return key_at(i); });
+        build_index();
    }
 
     ~PGM() {
-        free(m_data);
+        pooled_free(m_data);
         delete m_bf;
+        delete m_key_bf;
     }
 
-    Wrapped<R> *point_lookup(const R &rec, bool filter=false) {
+    Wrapped<R> *point_lookup(const R &rec, bool filter=false) requires(L == RecordLayout::AOS) {
+        if (filter && m_bf && !m_bf->lookup(rec.key)) {
+            return nullptr;
+        }
+
         size_t idx = get_lower_bound(rec.key);
         if (idx >= m_reccnt) {
             return nullptr;
@@ -205,9 +126,30 @@ public:
         return nullptr;
     }
 
-    Wrapped<R>* get_data() const {
+    WrappedRef<R> point_lookup(const R &rec, bool filter=false) requires(L == RecordLayout::SOA) {
+        if (filter && m_bf && !m_bf->lookup(rec.key)) {
+            return {};
+        }
+
+        size_t idx = get_lower_bound(rec.key);
+        while (idx < m_reccnt && m_columns.key(idx) == rec.key) {
+            auto ref = m_columns.ref(idx);
+            if (ref.rec == rec) {
+                return ref;
+            }
+            idx++;
+        }
+
+        return {};
+    }
+
+    Wrapped<R>* get_data() const requires(L == RecordLayout::AOS) {
         return m_data;
     }
+
+    const SoAArray<R>* get_columns() const requires(L == RecordLayout::SOA) {
+        return &m_columns;
+    }
     
     size_t get_record_count() const {
         return m_reccnt;
@@ -217,18 +159,52 @@ public:
         return m_tombstone_cnt;
     }
 
-    const Wrapped<R>* get_record_at(size_t idx) const {
+    const Wrapped<R>* get_record_at(size_t idx) const requires(L == RecordLayout::AOS) {
         if (idx >= m_reccnt) return nullptr;
         return m_data + idx;
     }
 
+    WrappedRef<R> get_record_at(size_t idx) const requires(L == RecordLayout::SOA) {
+        if (idx >= m_reccnt) return {};
+        return m_columns.ref(idx);
+    }
+
 
     size_t get_memory_usage() {
         return m_pgm.size_in_bytes();
     }
 
     size_t get_aux_memory_usage() {
-        return (m_bf) ? m_bf->memory_usage() : 0;
+        return ((m_bf) ? m_bf->memory_usage() : 0) +
+               ((m_key_bf) ? m_key_bf->memory_usage() : 0) +
+               m_zones.get_memory_usage();
+    }
+
+    /*
+     * Return false if no record within the shard has the specified key,
+     * according to the shard's key filter. A return value of true means
+     * that the key may be present.
+     */
+    bool may_contain_key(const K &key) const {
+        return !m_key_bf || m_key_bf->lookup(key);
+    }
+
+    /* the smallest and largest keys within the shard, which must not be empty */
+    const K &get_min_key() const {
+        return key_at(0);
+    }
+
+    const K &get_max_key() const {
+        return key_at(m_reccnt - 1);
+    }
+
+    /*
+     * Return false if no record within the shard has a key within [lower,
+     * upper], according to the shard's zone map. A return value of true
+     * means that such a record may be present.
+     */
+    bool may_contain_range(const K &lower, const K &upper) const {
+        return m_zones.overlaps(lower, upper);
     }
 
     size_t get_lower_bound(const K& key) const {
@@ -244,7 +220,7 @@ public:
          * amount, perform a linear scan to locate the record.
          */
         if (bound.hi - bound.lo < 256) {
-            while (idx < bound.hi && m_data[idx].rec.key < key) {
+            while (idx < bound.hi && key_at(idx) < key) {
                 idx++;
             }
         } else {
@@ -254,7 +230,7 @@ public:
 
             while (idx < max) {
                 size_t mid = (idx + max) / 2;
-                if (key > m_data[mid].rec.key) {
+                if (key > key_at(mid)) {
                     idx = mid + 1;
                 } else {
                     max = mid;
@@ -275,7 +251,7 @@ public:
          * We may have walked one passed the actual lower bound, so check
          * the index before the current one to see if it is the actual bound
          */
-        if (m_data[idx].rec.key > key && idx > 0 && m_data[idx-1].rec.key <= key) {
+        if (key_at(idx) > key && idx > 0 && key_at(idx-1) <= key) {
             return idx-1;
         }
 
@@ -283,18 +259,76 @@ public:
          * Otherwise, check idx. If it is a valid bound, then return it,
          * otherwise return "not found".
          */
-        return (m_data[idx].rec.key >= key) ? idx : m_reccnt;
+        return (key_at(idx) >= key) ? idx : m_reccnt;
     }
 
 private:
+    /*
+     * A random access iterator over the keys of an array of Wrapped<R>,
+     * allowing the PGM to be built directly over the records without
+     * first copying their keys out into a separate array.
+     */
+    struct key_iterator {
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef K value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const K* pointer;
+        typedef const K& reference;
+
+        const Wrapped<R> *ptr;
+
+        reference operator*() const { return ptr->rec.key; }
+        reference operator[](difference_type i) const { return ptr[i].rec.key; }
+
+        key_iterator &operator++() { ptr++; return *this; }
+        key_iterator &operator--() { ptr--; return *this; }
+        key_iterator operator++(int) { return {ptr++}; }
+        key_iterator operator--(int) { return {ptr--}; }
+
+        key_iterator &operator+=(difference_type n) { ptr += n; return *this; }
+        key_iterator &operator-=(difference_type n) { ptr -= n; return *this; }
+        key_iterator operator+(difference_type n) const { return {ptr + n}; }
+        key_iterator operator-(difference_type n) const { return {ptr - n}; }
+        difference_type operator-(const key_iterator &other) const { return ptr - other.ptr; }
+
+        auto operator<=>(const key_iterator &other) const = default;
+    };
+
+    /*
+     * Build the PGM over the keys of the records, once they have been
+     * written into the shard.
+     */
+    void build_index() {
+        if (m_reccnt == 0) {
+            return;
+        }
+
+        if constexpr (L == RecordLayout::SOA) {
+            auto keys = m_columns.get_keys();
+            m_pgm = pgm::PGMIndex<K, epsilon>(keys, keys + m_reccnt);
+        } else {
+            m_pgm = pgm::PGMIndex<K, epsilon>(key_iterator{m_data},
+                                              key_iterator{m_data + m_reccnt});
+        }
+    }
+
+    const K &key_at(size_t idx) const {
+        if constexpr (L == RecordLayout::SOA) {
+            return m_columns.key(idx);
+        } else {
+            return m_data[idx].rec.key;
+        }
+    }
+
     Wrapped<R>* m_data;
-    BloomFilter<R> *m_bf;
+    BlockedBloomFilter<K> *m_bf;
+    BlockedBloomFilter<K> *m_key_bf;
+    ZoneMap<K> m_zones;
     size_t m_reccnt;
     size_t m_tombstone_cnt;
     size_t m_alloc_size;
-    K m_max_key;
-    K m_min_key;
     pgm::PGMIndex<K, epsilon> m_pgm;
+    SoAArray<R> m_columns;
 };
 
 }
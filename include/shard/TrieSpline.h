@@ -5,7 +5,9 @@
  *
  * Distributed under the Modified BSD License.
  *
- * A shard shim around the TrieSpline learned index.
+ * A shard shim around the TrieSpline learned index. The records can be
+ * stored either as an array of Wrapped<R> (the default), or using the
+ * SOA layout from util/SoAArray.h.
  *
  * TODO: The code in this file is very poorly commented.
  */
@@ -16,20 +18,21 @@
 
 #include "framework/ShardRequirements.h"
 #include "ts/builder.h"
-#include "psu-ds/BloomFilter.h"
 #include "util/bf_config.h"
+#include "util/ShardFilters.h"
+#include "util/SoAArray.h"
 #include "util/SortedMerge.h"
+#include "util/ZoneMap.h"
 
 using psudb::CACHELINE_SIZE;
-using psudb::BloomFilter;
-using psudb::PriorityQueue;
-using psudb::queue_record;
 using psudb::byte;
 
 namespace de {
 
-template <KVPInterface R, size_t E=1024>
+template <KVPInterface R, size_t E=1024, RecordLayout L=RecordLayout::AOS>
 class TrieSpline {
+    static_assert(L == RecordLayout::AOS || SoARecordInterface<R>,
+                  "record type does not support the SOA layout");
 public:
     typedef R RECORD;
 private:
@@ -38,114 +41,65 @@ private:
 
 public:
     TrieSpline(BufferView<R> buffer)
-        : m_reccnt(0)
+        : m_data(nullptr)
+        , m_reccnt(0)
         , m_tombstone_cnt(0)
         , m_alloc_size(0)
         , m_max_key(0)
         , m_min_key(0)
         , m_bf(nullptr)
+        , m_key_bf(nullptr)
     {
-        m_alloc_size = psudb::sf_aligned_alloc(CACHELINE_SIZE, 
-                                               buffer.get_record_count() * 
-                                                 sizeof(Wrapped<R>), 
-                                               (byte**) &m_data);
-
-        /*
-         * Copy the contents of the buffer view into a temporary buffer, and
-         * sort them. We still need to iterate over these temporary records to 
-         * apply tombstone/deleted record filtering, as well as any possible
-         * per-record processing that is required by the shard being built.
-         */
-        auto temp_buffer = (Wrapped<R> *) psudb::sf_aligned_calloc(CACHELINE_SIZE, 
-                                                                   buffer.get_record_count(), 
-                                                                   sizeof(Wrapped<R>));
-        buffer.copy_to_buffer((byte *) temp_buffer);
-
-        auto base = temp_buffer;
-        auto stop = base + buffer.get_record_count();
-        std::sort(base, stop, std::less<Wrapped<R>>());
-
-        auto tmp_min_key = temp_buffer[0].rec.key;
-        auto tmp_max_key = temp_buffer[buffer.get_record_count() - 1].rec.key;
-        auto bldr = ts::Builder<K>(tmp_min_key, tmp_max_key, E);
-
         merge_info info = {0, 0};
 
-        m_min_key = tmp_max_key;
-        m_max_key = tmp_min_key;
+        if constexpr (L == RecordLayout::SOA) {
+            m_alloc_size = m_columns.allocate(buffer.get_record_count());
+            info = sorted_array_from_bufferview(std::move(buffer), m_columns);
+        } else {
+            m_alloc_size = pooled_aligned_alloc(buffer.get_record_count() * 
+                                                  sizeof(Wrapped<R>), 
+                                                (byte**) &m_data);
+            info = sorted_array_from_bufferview(std::move(buffer), m_data);
+        }
 
-        /* 
-         * Iterate over the temporary buffer to process the records, copying
-         * them into buffer as needed
+        m_reccnt = info.record_count;
+        m_tombstone_cnt = info.tombstone_count;
+        build_shard_filters<R>(this, m_reccnt, m_tombstone_cnt, &m_bf, &m_key_bf);
+        m_zones = ZoneMap<K>(m_reccnt, [this](size_t i) { return key_at(i); });
+
+        /*
+         * the spline builder needs the key range up front, which isn't
+         * known until the buffer has been sorted, so it is built over
+         * the records afterwards
          */
-        while (base < stop) {
-            if (!base->is_tombstone() && (base + 1 < stop)
-                && base->rec == (base + 1)->rec  && (base + 1)->is_tombstone()) {
-                base += 2;
-                continue;
-            } else if (base->is_deleted()) {
-                base += 1;
-                continue;
-            }
+        if (m_reccnt > 0) {
+            m_min_key = key_at(0);
+            m_max_key = key_at(m_reccnt - 1);
 
-            // FIXME: this shouldn't be necessary, but the tagged record
-            // bypass doesn't seem to be working on this code-path, so this
-            // ensures that tagged records from the buffer are able to be
-            // dropped, eventually. It should only need to be &= 1
-            base->header &= 3;
-            bldr.AddKey(base->rec.key);
-            m_data[info.record_count++] = *base;
-
-            if (base->is_tombstone()) {
-                info.tombstone_count++;
-                if (m_bf){
-                    m_bf->insert(base->rec);
-                }
+            auto bldr = ts::Builder<K>(m_min_key, m_max_key, E);
+            for (size_t i=0; i<m_reccnt; i++) {
+                bldr.AddKey(key_at(i));
             }
 
-            if (base->rec.key < m_min_key) {
-                m_min_key = base->rec.key;
-            } 
-
-            if (base->rec.key > m_max_key) {
-                m_max_key = base->rec.key;
+            if (m_reccnt > 50) {
+                m_ts = bldr.Finalize();
             }
-
-            base++;
-        }
-
-        free(temp_buffer);
-
-        m_reccnt = info.record_count;
-        m_tombstone_cnt = info.tombstone_count;
-
-        if (m_reccnt > 50) {
-            m_ts = bldr.Finalize();
         }
     }
 
     TrieSpline(std::vector<TrieSpline*> const &shards) 
-        : m_reccnt(0)
+        : m_data(nullptr)
+        , m_reccnt(0)
         , m_tombstone_cnt(0)
         , m_alloc_size(0)
         , m_max_key(0)
         , m_min_key(0)
         , m_bf(nullptr)
+        , m_key_bf(nullptr)
     {
         size_t attemp_reccnt = 0;
         size_t tombstone_count = 0;
-        auto cursors = build_cursor_vec<R, TrieSpline>(shards, &attemp_reccnt, &tombstone_count);
-        
-        m_alloc_size = psudb::sf_aligned_alloc(CACHELINE_SIZE, 
-                                               attemp_reccnt * sizeof(Wrapped<R>),
-                                               (byte **) &m_data);
-
-        // FIXME: For smaller cursor arrays, it may be more efficient to skip
-        //        the priority queue and just do a scan.
-        PriorityQueue<Wrapped<R>> pq(cursors.size());
-        for (size_t i=0; i<cursors.size(); i++) {
-            pq.push(cursors[i].ptr, i);
-        }
+        merge_info info = {0, 0};
 
         auto tmp_max_key = shards[0]->m_max_key;
         auto tmp_min_key = shards[0]->m_min_key;
@@ -160,77 +114,56 @@ public:
             }
         }
 
+        /* 
+         * the key range of the inputs bounds that of the output, so the
+         * spline can be built as the records are merged
+         */
         auto bldr = ts::Builder<K>(tmp_min_key, tmp_max_key, E);
 
         m_max_key = tmp_min_key;
         m_min_key = tmp_max_key;
 
-        merge_info info = {0, 0};
-        while (pq.size()) {
-            auto now = pq.peek();
-            auto next = pq.size() > 1 ? pq.peek(1) : queue_record<Wrapped<R>>{nullptr, 0};
-            /* 
-             * if the current record is not a tombstone, and the next record is
-             * a tombstone that matches the current one, then the current one
-             * has been deleted, and both it and its tombstone can be skipped
-             * over.
-             */
-            if (!now.data->is_tombstone() && next.data != nullptr &&
-                now.data->rec == next.data->rec && next.data->is_tombstone()) {
-                
-                pq.pop(); pq.pop();
-                auto& cursor1 = cursors[now.version];
-                auto& cursor2 = cursors[next.version];
-                if (advance_cursor(cursor1)) pq.push(cursor1.ptr, now.version);
-                if (advance_cursor(cursor2)) pq.push(cursor2.ptr, next.version);
-            } else {
-                auto& cursor = cursors[now.version];
-                /* skip over records that have been deleted via tagging */
-                if (!cursor.ptr->is_deleted()) {
-                    bldr.AddKey(cursor.ptr->rec.key);
-                    m_data[info.record_count++] = *cursor.ptr;
-
-                    /*  
-                     * if the record is a tombstone, increment the ts count and 
-                     * insert it into the bloom filter if one has been
-                     * provided.
-                     */
-                    if (cursor.ptr->is_tombstone()) {
-                        info.tombstone_count++;
-                        if (m_bf) {
-                            m_bf->insert(cursor.ptr->rec);
-                        }
-                    }
-
-                    if (cursor.ptr->rec.key < m_min_key) {
-                        m_min_key = cursor.ptr->rec.key;
-                    }
-
-                    if (cursor.ptr->rec.key > m_max_key) {
-                        m_max_key = cursor.ptr->rec.key;
-                    }
-                }
-                pq.pop();
-                
-                if (advance_cursor(cursor)) pq.push(cursor.ptr, now.version);
+        auto add_key = [&](const Wrapped<R> &rec) {
+            bldr.AddKey(rec.rec.key);
+
+            if (rec.rec.key < m_min_key) {
+                m_min_key = rec.rec.key;
             }
-        }
 
-        m_reccnt = info.record_count;
-        m_tombstone_cnt = info.tombstone_count;
+            if (rec.rec.key > m_max_key) {
+                m_max_key = rec.rec.key;
+            }
+        };
 
-        if (m_reccnt > 50) {
+        if constexpr (L == RecordLayout::SOA) {
+            auto cursors = build_soa_cursor_vec<R, TrieSpline>(shards, &attemp_reccnt, &tombstone_count);
+            m_alloc_size = m_columns.allocate(attemp_reccnt);
+            info = sorted_array_merge<R>(cursors, m_columns, nullptr, add_key);
+        } else {
+            auto cursors = build_cursor_vec<R, TrieSpline>(shards, &attemp_reccnt, &tombstone_count);
+            m_alloc_size = pooled_aligned_alloc(attemp_reccnt * sizeof(Wrapped<R>),
+                                                (byte **) &m_data);
+            info = sorted_array_merge<R>(cursors, m_data, nullptr, add_key);
+        }
+
+        if (info.record_count > 50) {
             m_ts = bldr.Finalize();
         }
+
+        m_reccnt = info.record_count;
+        m_tombstone_cnt = info.tombstone_count;
+        build_shard_filters<R>(this, m_reccnt, m_tombstone_cnt, &m_bf, &m_key_bf);
+        m_zones = ZoneMap<K>(m_reccnt, [this](size_t i) { return key_at(i); });
     }
 
     ~TrieSpline() {
-        free(m_data);
+        pooled_free(m_data);
         delete m_bf;
+        delete m_key_bf;
     }
 
-    Wrapped<R> *point_lookup(const R &rec, bool filter=false) {
-        if (filter && m_bf && !m_bf->lookup(rec)) {
+    Wrapped<R> *point_lookup(const R &rec, bool filter=false) requires(L == RecordLayout::AOS) {
+        if (filter && m_bf && !m_bf->lookup(rec.key)) {
             return nullptr;
         }
 
@@ -248,9 +181,30 @@ public:
         return nullptr;
     }
 
-    Wrapped<R>* get_data() const {
+    WrappedRef<R> point_lookup(const R &rec, bool filter=false) requires(L == RecordLayout::SOA) {
+        if (filter && m_bf && !m_bf->lookup(rec.key)) {
+            return {};
+        }
+
+        size_t idx = get_lower_bound(rec.key);
+        while (idx < m_reccnt && m_columns.key(idx) == rec.key) {
+            auto ref = m_columns.ref(idx);
+            if (ref.rec == rec) {
+                return ref;
+            }
+            idx++;
+        }
+
+        return {};
+    }
+
+    Wrapped<R>* get_data() const requires(L == RecordLayout::AOS) {
         return m_data;
     }
+
+    const SoAArray<R>* get_columns() const requires(L == RecordLayout::SOA) {
+        return &m_columns;
+    }
     
     size_t get_record_count() const {
         return m_reccnt;
@@ -260,25 +214,59 @@ public:
         return m_tombstone_cnt;
     }
 
-    const Wrapped<R>* get_record_at(size_t idx) const {
+    const Wrapped<R>* get_record_at(size_t idx) const requires(L == RecordLayout::AOS) {
         if (idx >= m_reccnt) return nullptr;
         return m_data + idx;
     }
 
+    WrappedRef<R> get_record_at(size_t idx) const requires(L == RecordLayout::SOA) {
+        if (idx >= m_reccnt) return {};
+        return m_columns.ref(idx);
+    }
+
 
     size_t get_memory_usage() {
         return m_ts.GetSize();
     }
 
     size_t get_aux_memory_usage() {
-        return (m_bf) ? m_bf->memory_usage() : 0;
+        return ((m_bf) ? m_bf->memory_usage() : 0) +
+               ((m_key_bf) ? m_key_bf->memory_usage() : 0) +
+               m_zones.get_memory_usage();
+    }
+
+    /*
+     * Return false if no record within the shard has the specified key,
+     * according to the shard's key filter. A return value of true means
+     * that the key may be present.
+     */
+    bool may_contain_key(const K &key) const {
+        return !m_key_bf || m_key_bf->lookup(key);
+    }
+
+    /* the smallest and largest keys within the shard, which must not be empty */
+    const K &get_min_key() const {
+        return m_min_key;
+    }
+
+    const K &get_max_key() const {
+        return m_max_key;
+    }
+
+    /*
+     * Return false if no record within the shard has a key within [lower,
+     * upper], according to the shard's zone map. A return value of true
+     * means that such a record may be present.
+     */
+    bool may_contain_range(const K &lower, const K &upper) const {
+        return m_zones.overlaps(lower, upper);
     }
 
     size_t get_lower_bound(const K& key) const {
         if (m_reccnt < 50) {
             size_t bd = m_reccnt;
             for (size_t i=0; i<m_reccnt; i++) {
-                if (m_data[i].rec.key >= key) {
+                if (key_at(i) >= key) {
                     bd = i;
                     break;
                 }
@@ -297,7 +285,7 @@ public:
         // If the region to search is less than some pre-specified
         // amount, perform a linear scan to locate the record.
         if (bound.end - bound.begin < 256) {
-            while (idx < bound.end && m_data[idx].rec.key < key) {
+            while (idx < bound.end && key_at(idx) < key) {
                 idx++;
             }
         } else {
@@ -307,7 +295,7 @@ public:
 
             while (idx < max) {
                 size_t mid = (idx + max) / 2;
-                if (key > m_data[mid].rec.key) {
+                if (key > key_at(mid)) {
                     idx = mid + 1;
                 } else {
                     max = mid;
@@ -319,7 +307,7 @@ public:
             return m_reccnt;
         }
 
-        if (m_data[idx].rec.key > key && idx > 0 && m_data[idx-1].rec.key <= key) {
+        if (key_at(idx) > key && idx > 0 && key_at(idx-1) <= key) {
             return idx-1;
         }
 
@@ -327,6 +315,13 @@ public:
     }
 
 private:
+    const K &key_at(size_t idx) const {
+        if constexpr (L == RecordLayout::SOA) {
+            return m_columns.key(idx);
+        } else {
+            return m_data[idx].rec.key;
+        }
+    }
 
     Wrapped<R>* m_data;
     size_t m_reccnt;
@@ -335,6 +330,9 @@ private:
     K m_max_key;
     K m_min_key;
     ts::TrieSpline<K> m_ts;
-    BloomFilter<R> *m_bf;
+    BlockedBloomFilter<K> *m_bf;
+    BlockedBloomFilter<K> *m_key_bf;
+    ZoneMap<K> m_zones;
+    SoAArray<R> m_columns;
 };
 }
@@ -8,6 +8,12 @@
  * A shard shim around a VPTree for high-dimensional metric similarity
  * search.
  *
+ * The tree is stored flat, with its nodes in an array in breadth-first
+ * order and the records themselves permuted into the order of the tree,
+ * so that each node's vantage point is the first record of the range
+ * it covers, and each leaf covers a contiguous run of records. Searches
+ * walk the node array iteratively, and so touch only these two arrays.
+ *
  * FIXME: Does not yet support the tombstone delete policy.
  * TODO: The code in this file is very poorly commented.
  */
@@ -17,10 +23,10 @@
 
 #include <unordered_map>
 #include "framework/ShardRequirements.h"
-#include "psu-ds/PriorityQueue.h"
+#include "util/Allocators.h"
+#include "util/KNNCandidates.h"
 
 using psudb::CACHELINE_SIZE;
-using psudb::PriorityQueue;
 using psudb::byte;
 
 namespace de {
@@ -31,36 +37,40 @@ public:
     typedef R RECORD;
 
 private:
+    /*
+     * A node covers the records in [start, stop]. For internal nodes,
+     * the record at start is the vantage point, and the children are
+     * stored as indexes into the node array, with 0 (the root, which is
+     * never a child) marking a missing child.
+     */
     struct vpnode {
         size_t start;
         size_t stop;
-        bool leaf;
-
         double radius;
-        vpnode *inside;
-        vpnode *outside;
-
-        vpnode() : start(0), stop(0), leaf(false), radius(0.0), inside(nullptr), outside(nullptr) {}
-
-        ~vpnode() {
-            delete inside;
-            delete outside;
-        }
+        size_t inside;
+        size_t outside;
+        bool leaf;
     };
 
+    /* an entry on the explicit stack used for searching the tree */
+    struct search_frame {
+        size_t node;
 
+        /* a lower bound on the distance to any record in the node */
+        double bound;
+    };
 
 public:
     VPTree(BufferView<R> buffer)
-    : m_reccnt(0), m_tombstone_cnt(0), m_node_cnt(0), m_root(nullptr) {
+    : m_reccnt(0), m_tombstone_cnt(0) {
 
 
-        m_alloc_size = psudb::sf_aligned_alloc(CACHELINE_SIZE, 
-                                               buffer.get_record_count() * 
-                                                 sizeof(Wrapped<R>), 
-                                               (byte**) &m_data);
+        m_alloc_size = pooled_aligned_alloc(buffer.get_record_count() *
+                                              sizeof(Wrapped<R>),
+                                            (byte**) &m_data);
 
-        m_ptrs = new vp_ptr[buffer.get_record_count()];
+        pooled_aligned_alloc(buffer.get_record_count() * sizeof(vp_ptr),
+                             (byte **) &m_ptrs);
         m_reccnt = 0;
 
         // FIXME: will eventually need to figure out tombstones
@@ -81,23 +91,22 @@ public:
         }
 
         if (m_reccnt > 0) {
-            m_root = build_vptree();
+            build_vptree();
             build_map();
         }
     }
 
-    VPTree(std::vector<VPTree*> shards) 
-    : m_reccnt(0), m_tombstone_cnt(0), m_node_cnt(0), m_root(nullptr) {
+    VPTree(std::vector<VPTree*> shards)
+    : m_reccnt(0), m_tombstone_cnt(0) {
 
         size_t attemp_reccnt = 0;
         for (size_t i=0; i<shards.size(); i++) {
             attemp_reccnt += shards[i]->get_record_count();
         }
 
-        m_alloc_size = psudb::sf_aligned_alloc(CACHELINE_SIZE, 
-                                               attemp_reccnt * sizeof(Wrapped<R>),
-                                               (byte **) &m_data);
-        m_ptrs = new vp_ptr[attemp_reccnt];
+        m_alloc_size = pooled_aligned_alloc(attemp_reccnt * sizeof(Wrapped<R>),
+                                            (byte **) &m_data);
+        pooled_aligned_alloc(attemp_reccnt * sizeof(vp_ptr), (byte **) &m_ptrs);
 
         // FIXME: will eventually need to figure out tombstones
         //        this one will likely require the multi-pass
@@ -116,15 +125,16 @@ public:
         }
 
         if (m_reccnt > 0) {
-            m_root = build_vptree();
+            build_vptree();
             build_map();
         }
    }
 
     ~VPTree() {
-        free(m_data);
-        delete m_root;
-        delete[] m_ptrs;
+        pooled_free(m_data);
+
+        /* only still allocated if the tree was never built */
+        pooled_free(m_ptrs);
     }
 
     Wrapped<R> *point_lookup(const R &rec, bool filter=false) {
@@ -137,19 +147,26 @@ public:
 
             return m_data + idx->second;
         } else {
-            vpnode *node = m_root;
+            if (m_nodes.size() == 0) {
+                return nullptr;
+            }
 
-            while (!node->leaf && m_ptrs[node->start].ptr->rec != rec) {
-                if (rec.calc_distance((m_ptrs[node->start].ptr->rec)) >= node->radius) {
-                    node = node->outside;
-                } else {
-                    node = node->inside;
+            size_t node = 0;
+            while (!m_nodes[node].leaf) {
+                auto &n = m_nodes[node];
+                if (m_data[n.start].rec == rec) {
+                    return m_data + n.start;
+                }
+
+                node = (rec.calc_distance(m_data[n.start].rec) >= n.radius) ? n.outside : n.inside;
+                if (node == 0) {
+                    return nullptr;
                 }
             }
 
-            for (size_t i=node->start; i<=node->stop; i++) {
-                if (m_ptrs[i].ptr->rec == rec) {
-                    return m_ptrs[i].ptr;
+            for (size_t i=m_nodes[node].start; i<=m_nodes[node].stop; i++) {
+                if (m_data[i].rec == rec) {
+                    return m_data + i;
                 }
             }
 
@@ -160,7 +177,7 @@ public:
     Wrapped<R>* get_data() const {
         return m_data;
     }
-    
+
     size_t get_record_count() const {
         return m_reccnt;
     }
@@ -175,7 +192,7 @@ public:
     }
 
     size_t get_memory_usage() {
-        return m_node_cnt * sizeof(vpnode) + m_reccnt * sizeof(R*);
+        return m_nodes.capacity() * sizeof(vpnode);
     }
 
     size_t get_aux_memory_usage() {
@@ -183,11 +200,53 @@ public:
         return 0;
     }
 
-    void search(const R &point, size_t k, PriorityQueue<Wrapped<R>, 
-                DistCmpMax<Wrapped<R>>> &pq) {
-        double farthest = std::numeric_limits<double>::max();
-        
-        internal_search(m_root, point, k, pq, &farthest);
+    void search(KNNCandidates<R> &candidates) {
+        if (candidates.get_k() == 0 || m_nodes.size() == 0) {
+            return;
+        }
+
+        auto &point = candidates.get_point();
+        std::vector<search_frame> stack;
+        stack.push_back({0, 0.0});
+
+        while (stack.size() > 0) {
+            auto frame = stack.back();
+            stack.pop_back();
+
+            /*
+             * the bound was computed when the node was pushed, and
+             * farthest may have shrunk since
+             */
+            if (frame.bound > candidates.get_farthest()) {
+                continue;
+            }
+
+            auto &node = m_nodes[frame.node];
+
+            if (node.leaf) {
+                candidates.consider_block(m_data + node.start, node.stop - node.start + 1);
+                continue;
+            }
+
+            double od = ordering_distance(point, m_data[node.start].rec);
+            double d = ordering_to_distance<R>(od);
+            candidates.consider(m_data + node.start, od);
+
+            /*
+             * push the child on the far side of the partition first, so
+             * the near side is searched first and tightens farthest
+             */
+            search_frame inside = {node.inside, d - node.radius};
+            search_frame outside = {node.outside, node.radius - d};
+
+            if (d < node.radius) {
+                push_frame(stack, outside, candidates.get_farthest());
+                push_frame(stack, inside, candidates.get_farthest());
+            } else {
+                push_frame(stack, inside, candidates.get_farthest());
+                push_frame(stack, outside, candidates.get_farthest());
+            }
+        }
     }
 
 private:
@@ -196,27 +255,97 @@ private:
         double dist;
     };
     Wrapped<R>* m_data;
+
+    /*
+     * the records being partitioned, used only during construction, after
+     * which m_data is permuted into the same order
+     */
     vp_ptr* m_ptrs;
+
+    std::vector<vpnode> m_nodes;
     std::unordered_map<R, size_t, RecordHash<R>> m_lookup_map;
     size_t m_reccnt;
     size_t m_tombstone_cnt;
-    size_t m_node_cnt;
     size_t m_alloc_size;
 
-    vpnode *m_root;
+    void build_vptree() {
+        auto rng = gsl_rng_alloc(gsl_rng_mt19937);
 
-    vpnode *build_vptree() {
-        if (m_reccnt == 0) {
-            return nullptr;
-        }
+        /*
+         * Nodes are partitioned in the order in which they were created,
+         * with each appending its children to the array, which lays the
+         * tree out in breadth-first order.
+         */
+        m_nodes.push_back(make_node(0, m_reccnt - 1));
+        for (size_t i=0; i<m_nodes.size(); i++) {
+            if (m_nodes[i].leaf) {
+                continue;
+            }
 
-        size_t lower = 0;
-        size_t upper = m_reccnt - 1;
+            size_t start = m_nodes[i].start;
+            size_t stop = m_nodes[i].stop;
+
+            /*
+             * select a random element to be the vantage point of the
+             * subtree
+             */
+            auto j = start + gsl_rng_uniform_int(rng, stop - start + 1);
+            swap(start, j);
+
+            /*
+             * for efficiency, we'll pre-calculate the distances between each
+             * point and the root. Only their order matters for partitioning,
+             * so the cheaper ordering distance is used.
+             */
+            for (size_t j=start+1; j<=stop; j++) {
+                m_ptrs[j].dist = ordering_distance(m_ptrs[start].ptr->rec, m_ptrs[j].ptr->rec);
+            }
+
+            /*
+             * partition elements based on their distance from the start,
+             * with those elements with distance falling below the median
+             * distance going into the left sub-array and those above
+             * the median in the right. This is easily done using QuickSelect.
+             */
+            auto mid = (start + 1 + stop) / 2;
+            quickselect(start + 1, stop, mid, m_ptrs[start].ptr, rng);
+
+            /* store the radius of the circle used for partitioning the node. */
+            m_nodes[i].radius = ordering_to_distance<R>(m_ptrs[mid].dist);
+            m_ptrs[start].dist = m_ptrs[mid].dist;
+
+            /*
+             * the inside partition can be empty (when the node has only
+             * two records), but the outside one never is
+             */
+            if (mid - 1 >= start + 1) {
+                m_nodes[i].inside = m_nodes.size();
+                m_nodes.push_back(make_node(start + 1, mid - 1));
+            }
+
+            m_nodes[i].outside = m_nodes.size();
+            m_nodes.push_back(make_node(mid, stop));
+        }
 
-        auto rng = gsl_rng_alloc(gsl_rng_mt19937);
-        auto root = build_subtree(lower, upper, rng);
         gsl_rng_free(rng);
-        return root;
+        m_nodes.shrink_to_fit();
+
+        /* move the records themselves into the order of the tree */
+        Wrapped<R> *data;
+        m_alloc_size = pooled_aligned_alloc(m_reccnt * sizeof(Wrapped<R>),
+                                            (byte **) &data);
+        for (size_t i=0; i<m_reccnt; i++) {
+            data[i] = *m_ptrs[i].ptr;
+        }
+
+        pooled_free(m_data);
+        pooled_free(m_ptrs);
+        m_data = data;
+        m_ptrs = nullptr;
+    }
+
+    vpnode make_node(size_t start, size_t stop) {
+        return {start, stop, 0.0, 0, 0, stop - start <= LEAFSZ};
     }
 
     void build_map() {
@@ -237,64 +366,6 @@ private:
         }
     }
 
-    vpnode *build_subtree(size_t start, size_t stop, gsl_rng *rng) {
-        /* 
-         * base-case: sometimes happens (probably because of the +1 and -1
-         * in the first recursive call)
-         */
-        if (start > stop) {
-            return nullptr;
-        }
-
-        /* base-case: create a leaf node */
-        if (stop - start <= LEAFSZ) {
-            vpnode *node = new vpnode();
-            node->start = start;
-            node->stop = stop;
-            node->leaf = true;
-
-            m_node_cnt++;
-            return node;
-        }
-
-        /* 
-         * select a random element to be the root of the
-         * subtree
-         */
-        auto i = start + gsl_rng_uniform_int(rng, stop - start + 1);
-        swap(start, i);
-
-        /* for efficiency, we'll pre-calculate the distances between each point and the root */
-        for (size_t i=start+1; i<=stop; i++) {
-            m_ptrs[i].dist = m_ptrs[start].ptr->rec.calc_distance(m_ptrs[i].ptr->rec);
-        }
-
-        /* 
-         * partition elements based on their distance from the start,
-         * with those elements with distance falling below the median
-         * distance going into the left sub-array and those above 
-         * the median in the right. This is easily done using QuickSelect.
-         */
-        auto mid = (start + 1 + stop) / 2;
-        quickselect(start + 1, stop, mid, m_ptrs[start].ptr, rng);
-
-        /* Create a new node based on this partitioning */
-        vpnode *node = new vpnode();
-        node->start = start;
-
-        /* store the radius of the circle used for partitioning the node. */
-        node->radius = m_ptrs[start].ptr->rec.calc_distance(m_ptrs[mid].ptr->rec);
-        m_ptrs[start].dist = node->radius;
-
-        /* recursively construct the left and right subtrees */
-        node->inside = build_subtree(start + 1, mid-1, rng); 
-        node->outside = build_subtree(mid, stop, rng);
-
-        m_node_cnt++;
-
-        return node;
-    }
-
     void quickselect(size_t start, size_t stop, size_t k, Wrapped<R> *p, gsl_rng *rng) {
         if (start == stop) return;
 
@@ -336,57 +407,9 @@ private:
         m_ptrs[idx2] = tmp;
     }
 
-    void internal_search(vpnode *node, const R &point, size_t k, PriorityQueue<Wrapped<R>, 
-                DistCmpMax<Wrapped<R>>> &pq, double *farthest) {
-
-        if (node == nullptr) return;
-
-        if (node->leaf) {
-            for (size_t i=node->start; i<=node->stop; i++) {
-                double d = point.calc_distance(m_ptrs[i].ptr->rec);
-                if (d < *farthest) {
-                    if (pq.size() == k) {
-                        pq.pop();
-                    }
-
-                    pq.push(m_ptrs[i].ptr);
-                    if (pq.size() == k) {
-                        *farthest = point.calc_distance(pq.peek().data->rec);
-                    }
-                }
-            }
-
-            return;
-        }
-
-        double d = point.calc_distance(m_ptrs[node->start].ptr->rec);
-
-        if (d < *farthest) {
-            if (pq.size() == k) {
-                pq.pop();
-            }
-            pq.push(m_ptrs[node->start].ptr);
-            if (pq.size() == k) {
-                *farthest = point.calc_distance(pq.peek().data->rec);
-            }
-        }
-
-        if (d < node->radius) {
-            if (d - (*farthest) <= node->radius) {
-                internal_search(node->inside, point, k, pq, farthest);
-            }
-
-            if (d + (*farthest) >= node->radius) {
-                internal_search(node->outside, point, k, pq, farthest);
-            }
-        } else {
-            if (d + (*farthest) >= node->radius) {
-                internal_search(node->outside, point, k, pq, farthest);
-            }
-
-            if (d - (*farthest) <= node->radius) {
-                internal_search(node->inside, point, k, pq, farthest);
-            }
+    void push_frame(std::vector<search_frame> &stack, search_frame frame, double farthest) {
+        if (frame.node != 0 && frame.bound <= farthest) {
+            stack.push_back(frame);
         }
     }
    };
@@ -0,0 +1,280 @@
+/*
+ * include/util/Allocators.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * Memory allocation support for shards and queries, to reduce the
+ * allocator overhead and fragmentation caused by the constant creation
+ * and destruction of these objects in a long-running process.
+ *
+ * There are two allocators here,
+ *   1. A pool of cache-aligned blocks (RecordArrayPool), used for the
+ *      large arrays allocated by shards. Freed blocks are retained
+ *      (up to a configurable limit) and reused for allocations of the
+ *      same size class. As level capacities are fixed, most shards on a
+ *      level will draw their arrays from the same few classes. The
+ *      retained blocks count as memory in use when a framework
+ *      instance checks whether a reconstruction fits within its memory
+ *      budget.
+ *   2. Per-thread free lists for small, short-lived objects, such as
+ *      the local query objects created for each shard by a query. Types
+ *      opt in to these by inheriting from ScratchAllocated.
+ */
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include "psu-util/alignment.h"
+
+namespace de {
+
+class RecordArrayPool {
+public:
+  /* the default limit on the number of bytes of free blocks retained */
+  static const size_t DEFAULT_CAPACITY = 256ul << 20;
+
+  /*
+   * Blocks at or below this size are allocated and freed directly, as
+   * they aren't worth retaining
+   */
+  static const size_t MIN_POOLED_SIZE = 4096;
+
+  RecordArrayPool(size_t capacity = DEFAULT_CAPACITY)
+      : m_capacity(capacity), m_retained(0) {}
+
+  ~RecordArrayPool() { clear(); }
+
+  /*
+   * Allocate a cache-aligned block of at least size bytes, storing a
+   * pointer to it in out. Returns the size of the block, which will be
+   * rounded up to its size class.
+   */
+  size_t allocate(size_t size, psudb::byte **out) {
+    size_t block_size = size_class(size);
+
+    if (block_size > MIN_POOLED_SIZE) {
+      std::unique_lock<std::mutex> lk(m_lock);
+      auto &blocks = m_free[block_size];
+      if (blocks.size() > 0) {
+        *out = blocks.back();
+        blocks.pop_back();
+        m_retained -= block_size;
+        return block_size;
+      }
+    }
+
+    *out = (psudb::byte *)std::aligned_alloc(psudb::CACHELINE_SIZE,
+                                             block_size + HEADER_SIZE);
+    if (*out == nullptr) {
+      return 0;
+    }
+
+    *(size_t *)*out = block_size;
+    *out += HEADER_SIZE;
+    return block_size;
+  }
+
+  /*
+   * Release a block allocated from this pool, retaining it for reuse if
+   * there is room.
+   */
+  void release(void *ptr) {
+    if (ptr == nullptr) {
+      return;
+    }
+
+    auto block = (psudb::byte *)ptr;
+    size_t block_size = *(size_t *)(block - HEADER_SIZE);
+
+    if (block_size > MIN_POOLED_SIZE) {
+      std::unique_lock<std::mutex> lk(m_lock);
+      if (m_retained + block_size <= m_capacity) {
+        m_free[block_size].push_back(block);
+        m_retained += block_size;
+        return;
+      }
+    }
+
+    std::free(block - HEADER_SIZE);
+  }
+
+  /*
+   * Set the limit on the number of bytes of free blocks retained by the
+   * pool. A capacity of 0 disables pooling. Blocks already retained in
+   * excess of the new capacity are freed.
+   */
+  void set_capacity(size_t capacity) {
+    std::unique_lock<std::mutex> lk(m_lock);
+    m_capacity = capacity;
+
+    for (auto &[block_size, blocks] : m_free) {
+      while (m_retained > m_capacity && blocks.size() > 0) {
+        std::free(blocks.back() - HEADER_SIZE);
+        blocks.pop_back();
+        m_retained -= block_size;
+      }
+    }
+  }
+
+  size_t get_capacity() {
+    std::unique_lock<std::mutex> lk(m_lock);
+    return m_capacity;
+  }
+
+  /* the number of bytes currently held in free blocks */
+  size_t get_retained() {
+    std::unique_lock<std::mutex> lk(m_lock);
+    return m_retained;
+  }
+
+  /* free all retained blocks */
+  void clear() {
+    std::unique_lock<std::mutex> lk(m_lock);
+    for (auto &[block_size, blocks] : m_free) {
+      for (auto block : blocks) {
+        std::free(block - HEADER_SIZE);
+      }
+    }
+
+    m_free.clear();
+    m_retained = 0;
+  }
+
+  /*
+   * Round size up to its size class. Each power of two is divided into
+   * four classes, so no more than 25% of a block is wasted.
+   */
+  static size_t size_class(size_t size) {
+    size_t step = (size <= MIN_POOLED_SIZE)
+                      ? psudb::CACHELINE_SIZE
+                      : std::bit_floor(size - 1) / 4;
+
+    return std::max((size + step - 1) / step * step, step);
+  }
+
+private:
+  /*
+   * each block is preceded by its size, padded out to keep the block
+   * itself cache-aligned
+   */
+  static const size_t HEADER_SIZE = psudb::CACHELINE_SIZE;
+
+  std::mutex m_lock;
+  std::unordered_map<size_t, std::vector<psudb::byte *>> m_free;
+  size_t m_capacity;
+  size_t m_retained;
+};
+
+/*
+ * The pool shared by all shards within the process. It is never
+ * destroyed, as shards held in static objects may still release blocks
+ * into it during program exit.
+ */
+inline RecordArrayPool &get_record_pool() {
+  static RecordArrayPool *pool = new RecordArrayPool();
+  return *pool;
+}
+
+/*
+ * Replacements for psudb::sf_aligned_alloc and sf_aligned_calloc that
+ * draw from the shared pool. Memory allocated by these must be freed
+ * with pooled_free.
+ */
+static inline size_t pooled_aligned_alloc(size_t size, psudb::byte **out) {
+  return get_record_pool().allocate(size, out);
+}
+
+static inline size_t pooled_aligned_calloc(size_t cnt, size_t size,
+                                           psudb::byte **out) {
+  size_t alloc_size = get_record_pool().allocate(cnt * size, out);
+  if (*out) {
+    memset(*out, 0, alloc_size);
+  }
+
+  return alloc_size;
+}
+
+static inline void pooled_free(void *ptr) { get_record_pool().release(ptr); }
+
+/*
+ * Thread-local free lists of small blocks, in cacheline-sized classes.
+ * A block freed by a different thread than allocated it is simply added
+ * to the freeing thread's list.
+ */
+class ScratchLists {
+public:
+  static const size_t MAX_SIZE = 1024;
+  static const size_t MAX_FREE_CNT = 256;
+
+  ~ScratchLists() {
+    for (auto &list : m_lists) {
+      for (auto block : list) {
+        ::operator delete(block);
+      }
+    }
+  }
+
+  void *allocate(size_t size) {
+    if (size > MAX_SIZE) {
+      return ::operator new(size);
+    }
+
+    auto &list = m_lists[size_class(size)];
+    if (list.size() > 0) {
+      auto block = list.back();
+      list.pop_back();
+      return block;
+    }
+
+    return ::operator new((size_class(size) + 1) * psudb::CACHELINE_SIZE);
+  }
+
+  void release(void *ptr, size_t size) {
+    if (size <= MAX_SIZE) {
+      auto &list = m_lists[size_class(size)];
+      if (list.size() < MAX_FREE_CNT) {
+        list.push_back(ptr);
+        return;
+      }
+    }
+
+    ::operator delete(ptr);
+  }
+
+private:
+  std::vector<void *> m_lists[MAX_SIZE / psudb::CACHELINE_SIZE];
+
+  static size_t size_class(size_t size) {
+    return (std::max<size_t>(size, 1) - 1) / psudb::CACHELINE_SIZE;
+  }
+};
+
+inline thread_local ScratchLists scratch_lists;
+
+/*
+ * Inheriting from this allocates objects of the derived type using the
+ * calling thread's scratch lists. The objects must be deleted through a
+ * pointer to their own type, as the size of the object is needed to
+ * release it.
+ */
+struct ScratchAllocated {
+  static void *operator new(size_t size) {
+    return scratch_lists.allocate(size);
+  }
+
+  static void operator delete(void *ptr, size_t size) {
+    scratch_lists.release(ptr, size);
+  }
+};
+
+} // namespace de
@@ -0,0 +1,147 @@
+/*
+ * include/util/Bitmap.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * A simple fixed-size bitmap, used by shards to store per-record
+ * flags (tombstones and tagged deletes) outside of the records
+ * themselves. Bits are stored in atomic words, so that bits can be
+ * set in place while other threads are reading the bitmap, as is
+ * required for delete tagging.
+ */
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+
+namespace de {
+
+class Bitmap {
+public:
+  Bitmap() : m_words(nullptr), m_word_cnt(0) {}
+
+  ~Bitmap() { delete[] m_words; }
+
+  Bitmap(const Bitmap &) = delete;
+  Bitmap &operator=(const Bitmap &) = delete;
+
+  /*
+   * Allocate space for bit_cnt bits, all initially clear, and return
+   * the number of bytes allocated. Any prior contents are released.
+   */
+  size_t allocate(size_t bit_cnt) {
+    delete[] m_words;
+    m_word_cnt = (bit_cnt + 63) / 64;
+    m_words = new std::atomic<uint64_t>[m_word_cnt]();
+
+    return m_word_cnt * sizeof(uint64_t);
+  }
+
+  /*
+   * Set bit idx. This is not an atomic read-modify-write, and so is only
+   * safe when no other thread can set bits in the same word, such as
+   * while the bitmap is being constructed.
+   */
+  void set(size_t idx) {
+    auto &word = m_words[idx / 64];
+    word.store(word.load(std::memory_order_relaxed) | mask(idx),
+               std::memory_order_relaxed);
+  }
+
+  /*
+   * Set bit idx, safely with respect to concurrent sets of other bits.
+   */
+  void set_atomic(size_t idx) const {
+    m_words[idx / 64].fetch_or(mask(idx), std::memory_order_relaxed);
+  }
+
+  bool test(size_t idx) const {
+    return word(idx / 64) & mask(idx);
+  }
+
+  uint64_t word(size_t word_idx) const {
+    return m_words[word_idx].load(std::memory_order_relaxed);
+  }
+
+  /*
+   * Return the number of set bits within [start, stop)
+   */
+  size_t count(size_t start, size_t stop) const {
+    return count_words(start, stop, [this](size_t w) { return word(w); });
+  }
+
+  /*
+   * Return the number of bits within [start, stop) that are set in
+   * this bitmap, and not set in other.
+   */
+  size_t count_and_not(const Bitmap &other, size_t start, size_t stop) const {
+    return count_words(start, stop, [this, &other](size_t w) {
+      return word(w) & ~other.word(w);
+    });
+  }
+
+  /*
+   * Return the index of the first clear bit within [start, stop), or
+   * stop if all of them are set.
+   */
+  size_t next_clear(size_t start, size_t stop) const {
+    size_t idx = start;
+    while (idx < stop) {
+      uint64_t clear = ~word(idx / 64) & (~0ull << (idx % 64));
+      if (clear) {
+        idx = (idx & ~63ull) + std::countr_zero(clear);
+        return (idx < stop) ? idx : stop;
+      }
+
+      idx = (idx & ~63ull) + 64;
+    }
+
+    return stop;
+  }
+
+  /* the number of bytes used by the bitmap */
+  size_t get_memory_usage() const { return m_word_cnt * sizeof(uint64_t); }
+
+private:
+  std::atomic<uint64_t> *m_words;
+  size_t m_word_cnt;
+
+  static uint64_t mask(size_t idx) { return 1ull << (idx % 64); }
+
+  /*
+   * Sum the popcounts of the words produced by f over the words
+   * overlapping [start, stop), masking off the bits outside of the
+   * range in the first and last words.
+   */
+  template <typename F>
+  size_t count_words(size_t start, size_t stop, F &&f) const {
+    if (start >= stop) {
+      return 0;
+    }
+
+    size_t first = start / 64;
+    size_t last = (stop - 1) / 64;
+    size_t cnt = 0;
+
+    for (size_t w = first; w <= last; w++) {
+      uint64_t bits = f(w);
+      if (w == first) {
+        bits &= ~0ull << (start % 64);
+      }
+
+      if (w == last && stop % 64) {
+        bits &= ~0ull >> (64 - stop % 64);
+      }
+
+      cnt += std::popcount(bits);
+    }
+
+    return cnt;
+  }
+};
+
+} // namespace de
@@ -0,0 +1,260 @@
+/*
+ * include/util/BlockedBloomFilter.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * A split-block bloom filter, used in place of psudb::BloomFilter for the
+ * tombstone and key filters of the buffer and shards. The filter is an
+ * array of 256-bit blocks, each within a single cache line. A key is
+ * hashed once, selecting a block, and sets (or tests) one bit in each of
+ * k of the block's eight 32-bit words, so that an insert or lookup
+ * touches one cache line rather than k. The bits within the block are
+ * derived from the hash by multiplication, which is done for all of the
+ * words at once using AVX2 (when the build targets it).
+ *
+ * Confining a key's bits to one block makes the filter somewhat less
+ * accurate than a standard bloom filter of the same size, and so the
+ * filter is sized using the false positive rate of the blocked layout,
+ * rather than that of a standard filter.
+ *
+ * Inserts may be performed concurrently with each other, and with
+ * lookups. A lookup concurrent with the insert of the same key may or
+ * may not see it.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "framework/interface/Record.h"
+#include "psu-util/hash.h"
+#include "util/Allocators.h"
+
+namespace de {
+
+template <typename K> class BlockedBloomFilter {
+public:
+  /* the maximum number of bits set per key, one in each word of a block */
+  static const size_t MAX_PROBES = 8;
+
+  /* the number of keys looked up together by lookup_batch */
+  static const size_t BATCH_SIZE = 16;
+
+  /*
+   * Create a filter for n keys with a false positive rate of fpr, setting
+   * k bits per key. k is clamped to [1, MAX_PROBES].
+   */
+  BlockedBloomFilter(double fpr, size_t n, size_t k)
+      : m_k(std::clamp<size_t>(k, 1, MAX_PROBES)), m_blocks(nullptr),
+        m_block_cnt(block_count(fpr, n, m_k)) {
+    m_alloc_size = pooled_aligned_calloc(m_block_cnt, sizeof(block),
+                                         (psudb::byte **)&m_blocks);
+
+    for (size_t i = 0; i < MAX_PROBES / 2; i++) {
+      uint64_t lo = (2 * i < m_k) ? 0xFFFFFFFF : 0;
+      uint64_t hi = (2 * i + 1 < m_k) ? 0xFFFFFFFF : 0;
+      m_lanes.words[i] = lo | (hi << 32);
+    }
+  }
+
+  ~BlockedBloomFilter() { pooled_free(m_blocks); }
+
+  BlockedBloomFilter(const BlockedBloomFilter &) = delete;
+  BlockedBloomFilter &operator=(const BlockedBloomFilter &) = delete;
+
+  int insert(const K &key) {
+    uint64_t h = hash_key(key);
+
+    block mask;
+    make_mask(h, mask);
+
+    auto &b = m_blocks[block_idx(h)];
+    for (size_t i = 0; i < MAX_PROBES / 2; i++) {
+      std::atomic_ref<uint64_t> word(b.words[i]);
+
+      /* avoid dirtying the line if the bits are already set */
+      if ((word.load(std::memory_order_relaxed) & mask.words[i]) !=
+          mask.words[i]) {
+        word.fetch_or(mask.words[i], std::memory_order_relaxed);
+      }
+    }
+
+    return 1;
+  }
+
+  bool lookup(const K &key) const {
+    uint64_t h = hash_key(key);
+    return probe(m_blocks[block_idx(h)], h);
+  }
+
+  /*
+   * Look up the cnt keys starting at keys, storing the result for each in
+   * the corresponding element of results. The blocks for each batch of
+   * keys are prefetched before any of them are probed, so that the
+   * cache misses of the batch overlap.
+   */
+  void lookup_batch(const K *keys, size_t cnt, bool *results) const {
+    uint64_t hashes[BATCH_SIZE];
+
+    for (size_t i = 0; i < cnt; i += BATCH_SIZE) {
+      size_t batch = std::min(BATCH_SIZE, cnt - i);
+      for (size_t j = 0; j < batch; j++) {
+        hashes[j] = hash_key(keys[i + j]);
+        __builtin_prefetch(m_blocks + block_idx(hashes[j]));
+      }
+
+      for (size_t j = 0; j < batch; j++) {
+        results[i + j] = probe(m_blocks[block_idx(hashes[j])], hashes[j]);
+      }
+    }
+  }
+
+  void clear() { memset((void *)m_blocks, 0, m_block_cnt * sizeof(block)); }
+
+  size_t get_memory_usage() const { return m_alloc_size; }
+
+  size_t memory_usage() const { return m_alloc_size; }
+
+  /*
+   * The expected false positive rate of a filter with k probes per key
+   * and an average of keys_per_block keys in each block. The number of
+   * keys in a block is Poisson distributed, and with i keys in a block,
+   * each of the k probed words fails to have the probed bit set with
+   * probability (31/32)^i.
+   */
+  static double expected_fpr(double keys_per_block, size_t k) {
+    double fpr = 0;
+    double p = std::exp(-keys_per_block);
+    size_t limit = 4 * (size_t)keys_per_block + 64;
+
+    for (size_t i = 0; i < limit; i++) {
+      fpr += p * std::pow(1 - std::pow(31.0 / 32.0, i), k);
+      p *= keys_per_block / (i + 1);
+    }
+
+    return fpr;
+  }
+
+private:
+  struct alignas(32) block {
+    uint64_t words[MAX_PROBES / 2];
+  };
+
+  size_t m_k;
+  block *m_blocks;
+  size_t m_block_cnt;
+  size_t m_alloc_size;
+
+  /* all ones in the 32-bit lanes of the k words probed, and zero otherwise */
+  block m_lanes;
+
+  /*
+   * The number of blocks needed for n keys at a false positive rate of
+   * fpr. This starts at the size of a standard bloom filter, and grows
+   * it until the blocked layout meets fpr.
+   */
+  static size_t block_count(double fpr, size_t n, size_t k) {
+    n = std::max<size_t>(n, 1);
+
+    double bits_per_key =
+        std::max(-std::log(fpr) / (std::log(2) * std::log(2)), 1.0);
+    while (bits_per_key < 64 && expected_fpr(256 / bits_per_key, k) > fpr) {
+      bits_per_key *= 1.05;
+    }
+
+    return std::max<size_t>(std::ceil(n * bits_per_key / 256), 1);
+  }
+
+  /*
+   * Records are hashed by their key and value, rather than as a whole,
+   * as the hash would otherwise include any padding bytes within them.
+   */
+  static uint64_t hash_key(const K &key) {
+    if constexpr (KVPInterface<K>) {
+      return mix(hash_value(key.key) ^
+                 (hash_value(key.value) * 0x9e3779b97f4a7c15ull));
+    } else {
+      return mix(hash_value(key));
+    }
+  }
+
+  template <typename T> static uint64_t hash_value(const T &v) {
+    return psudb::hash_bytes((const std::byte *)&v, sizeof(T));
+  }
+
+  /* the finalizer of MurmurHash3, to spread the hash across all bits */
+  static uint64_t mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+  }
+
+  /* the block is selected by the upper half of the hash */
+  size_t block_idx(uint64_t h) const {
+    return ((h >> 32) * m_block_cnt) >> 32;
+  }
+
+  /*
+   * Set mask to the bits for the hash h, with the bit in each 32-bit
+   * word selected by the lower half of h, multiplied by a per-word salt.
+   */
+  void make_mask(uint64_t h, block &mask) const {
+    static const uint32_t salts[MAX_PROBES] = {
+        0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+        0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+#if defined(__AVX2__)
+    __m256i bits =
+        _mm256_mullo_epi32(_mm256_set1_epi32((uint32_t)h),
+                           _mm256_loadu_si256((const __m256i *)salts));
+    bits =
+        _mm256_sllv_epi32(_mm256_set1_epi32(1), _mm256_srli_epi32(bits, 27));
+    bits =
+        _mm256_and_si256(bits, _mm256_load_si256((const __m256i *)&m_lanes));
+    _mm256_store_si256((__m256i *)&mask, bits);
+#else
+    uint32_t bits[MAX_PROBES];
+    for (size_t i = 0; i < MAX_PROBES; i++) {
+      bits[i] = 1u << (((uint32_t)h * salts[i]) >> 27);
+    }
+
+    for (size_t i = 0; i < MAX_PROBES / 2; i++) {
+      mask.words[i] = (bits[2 * i] | ((uint64_t)bits[2 * i + 1] << 32)) &
+                      m_lanes.words[i];
+    }
+#endif
+  }
+
+  bool probe(const block &b, uint64_t h) const {
+    block mask;
+    make_mask(h, mask);
+
+#if defined(__AVX2__)
+    return _mm256_testc_si256(_mm256_load_si256((const __m256i *)&b),
+                              _mm256_load_si256((const __m256i *)&mask));
+#else
+    for (size_t i = 0; i < MAX_PROBES / 2; i++) {
+      if ((b.words[i] & mask.words[i]) != mask.words[i]) {
+        return false;
+      }
+    }
+
+    return true;
+#endif
+  }
+};
+
+} // namespace de
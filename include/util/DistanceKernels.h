@@ -0,0 +1,154 @@
+/*
+ * include/util/DistanceKernels.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * Vectorized kernels for the distance functions of the multi-dimensional
+ * point records. Points with double coordinates are processed several
+ * dimensions at a time, using AVX-512 or AVX2 with FMA (whichever the
+ * build targets). All other coordinate types, and builds without either
+ * instruction set (including those for non-x86 targets), use a scalar
+ * loop with several independent accumulators, which the compiler is
+ * free to vectorize on its own.
+ *
+ * As the sums are accumulated in a different order than a simple loop,
+ * the results may differ from one in the last few bits.
+ */
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace de {
+namespace simd {
+
+/* the sums needed for the cosine similarity of two vectors */
+struct cosine_terms {
+  double prod;
+  double asquared;
+  double bsquared;
+};
+
+#if defined(__AVX__)
+static inline double hsum(__m256d v) {
+  __m128d lo = _mm256_castpd256_pd128(v);
+  __m128d hi = _mm256_extractf128_pd(v, 1);
+  lo = _mm_add_pd(lo, hi);
+  return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+#endif
+
+#if defined(__AVX512F__)
+/*
+ * NOTE: _mm512_reduce_add_pd, and the unmasked extracts and casts, trip
+ *       -Wmaybe-uninitialized on some versions of GCC
+ */
+static inline double hsum(__m512d v) {
+  __m256d lo = _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xF, v, 0);
+  __m256d hi = _mm512_mask_extractf64x4_pd(_mm256_setzero_pd(), 0xF, v, 1);
+  return hsum(_mm256_add_pd(lo, hi));
+}
+#endif
+
+/*
+ * The squared Euclidean distance between the D-dimensional points a
+ * and b. The coordinate differences are taken after conversion to
+ * double, so unsigned coordinates do not wrap.
+ */
+template <typename V, size_t D>
+static inline double squared_euclidean(const V *a, const V *b) {
+  size_t i = 0;
+  double dist = 0;
+
+  if constexpr (std::is_same_v<V, double>) {
+#if defined(__AVX512F__)
+    __m512d acc = _mm512_setzero_pd();
+    for (; i + 8 <= D; i += 8) {
+      __m512d diff =
+          _mm512_sub_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i));
+      acc = _mm512_fmadd_pd(diff, diff, acc);
+    }
+    dist = hsum(acc);
+#elif defined(__AVX2__) && defined(__FMA__)
+    __m256d acc = _mm256_setzero_pd();
+    for (; i + 4 <= D; i += 4) {
+      __m256d diff =
+          _mm256_sub_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i));
+      acc = _mm256_fmadd_pd(diff, diff, acc);
+    }
+    dist = hsum(acc);
+#endif
+  }
+
+  double acc[4] = {0, 0, 0, 0};
+  for (; i + 4 <= D; i += 4) {
+    for (size_t j = 0; j < 4; j++) {
+      double diff = (double)a[i + j] - (double)b[i + j];
+      acc[j] += diff * diff;
+    }
+  }
+
+  for (; i < D; i++) {
+    double diff = (double)a[i] - (double)b[i];
+    acc[0] += diff * diff;
+  }
+
+  return dist + (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+/*
+ * The dot product of the D-dimensional vectors a and b, along with
+ * their squared norms, computed in a single pass.
+ */
+template <typename V, size_t D>
+static inline cosine_terms cosine(const V *a, const V *b) {
+  size_t i = 0;
+  cosine_terms terms = {0, 0, 0};
+
+  if constexpr (std::is_same_v<V, double>) {
+#if defined(__AVX512F__)
+    __m512d prod = _mm512_setzero_pd();
+    __m512d asq = _mm512_setzero_pd();
+    __m512d bsq = _mm512_setzero_pd();
+    for (; i + 8 <= D; i += 8) {
+      __m512d va = _mm512_loadu_pd(a + i);
+      __m512d vb = _mm512_loadu_pd(b + i);
+      prod = _mm512_fmadd_pd(va, vb, prod);
+      asq = _mm512_fmadd_pd(va, va, asq);
+      bsq = _mm512_fmadd_pd(vb, vb, bsq);
+    }
+    terms = {hsum(prod), hsum(asq), hsum(bsq)};
+#elif defined(__AVX2__) && defined(__FMA__)
+    __m256d prod = _mm256_setzero_pd();
+    __m256d asq = _mm256_setzero_pd();
+    __m256d bsq = _mm256_setzero_pd();
+    for (; i + 4 <= D; i += 4) {
+      __m256d va = _mm256_loadu_pd(a + i);
+      __m256d vb = _mm256_loadu_pd(b + i);
+      prod = _mm256_fmadd_pd(va, vb, prod);
+      asq = _mm256_fmadd_pd(va, va, asq);
+      bsq = _mm256_fmadd_pd(vb, vb, bsq);
+    }
+    terms = {hsum(prod), hsum(asq), hsum(bsq)};
+#endif
+  }
+
+  for (; i < D; i++) {
+    double va = a[i];
+    double vb = b[i];
+    terms.prod += va * vb;
+    terms.asquared += va * va;
+    terms.bsquared += vb * vb;
+  }
+
+  return terms;
+}
+
+} // namespace simd
+} // namespace de
@@ -0,0 +1,138 @@
+/*
+ * include/util/KNNCandidates.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * A bounded set of the k nearest records to a query point seen so far,
+ * for use in k-NN searches. Each candidate is stored alongside its
+ * distance, so that the heap never recomputes distances when comparing
+ * candidates, and the distance of the current k-th nearest candidate is
+ * cached for use as a pruning threshold. Distances are held in the
+ * record's ordering form (see ordering_distance), avoiding a square root
+ * per candidate for Euclidean points.
+ */
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "framework/interface/Record.h"
+
+namespace de {
+
+template <NDRecordInterface R> class KNNCandidates {
+  typedef std::pair<double, const Wrapped<R> *> candidate;
+
+public:
+  /*
+   * The number of records whose distances are computed together by
+   * consider_block, before any are compared against the threshold
+   */
+  static const size_t BATCH_SIZE = 32;
+
+  KNNCandidates(const R &point, size_t k)
+      : m_point(point), m_k(k),
+        m_threshold(std::numeric_limits<double>::max()),
+        m_farthest(std::numeric_limits<double>::max()) {
+    m_heap.reserve(k);
+  }
+
+  const R &get_point() const { return m_point; }
+
+  size_t get_k() const { return m_k; }
+
+  size_t size() const { return m_heap.size(); }
+
+  /*
+   * The distance of the k-th nearest candidate, or the maximum double
+   * if there are fewer than k candidates. A record must be strictly
+   * nearer than this to be added.
+   */
+  double get_farthest() const { return m_farthest; }
+
+  /*
+   * Add rec, at the ordering distance dist from the query point, if it
+   * is among the k nearest records seen so far. Returns true if it was
+   * added.
+   */
+  bool consider(const Wrapped<R> *rec, double dist) {
+    if (m_k == 0 || dist >= m_threshold) {
+      return false;
+    }
+
+    if (m_heap.size() == m_k) {
+      std::pop_heap(m_heap.begin(), m_heap.end(), cmp);
+      m_heap.pop_back();
+    }
+
+    m_heap.push_back({dist, rec});
+    std::push_heap(m_heap.begin(), m_heap.end(), cmp);
+
+    if (m_heap.size() == m_k) {
+      m_threshold = m_heap.front().first;
+      m_farthest = ordering_to_distance<R>(m_threshold);
+    }
+
+    return true;
+  }
+
+  bool consider(const Wrapped<R> *rec) {
+    return consider(rec, ordering_distance(m_point, rec->rec));
+  }
+
+  /*
+   * Consider each of the cnt records starting at recs. The distances of
+   * each batch of records are computed in one pass, and only then
+   * compared against the threshold, keeping the distance computations
+   * free of the branches and heap updates.
+   */
+  void consider_block(const Wrapped<R> *recs, size_t cnt) {
+    double dists[BATCH_SIZE];
+
+    for (size_t i = 0; i < cnt; i += BATCH_SIZE) {
+      size_t batch = std::min(BATCH_SIZE, cnt - i);
+      for (size_t j = 0; j < batch; j++) {
+        dists[j] = ordering_distance(m_point, recs[i + j].rec);
+      }
+
+      for (size_t j = 0; j < batch; j++) {
+        if (dists[j] < m_threshold) {
+          consider(recs + i + j, dists[j]);
+        }
+      }
+    }
+  }
+
+  /* the candidates, ordered from nearest to farthest */
+  std::vector<const Wrapped<R> *> get_results() {
+    std::sort_heap(m_heap.begin(), m_heap.end(), cmp);
+
+    std::vector<const Wrapped<R> *> results;
+    results.reserve(m_heap.size());
+    for (auto &c : m_heap) {
+      results.push_back(c.second);
+    }
+
+    std::make_heap(m_heap.begin(), m_heap.end(), cmp);
+    return results;
+  }
+
+private:
+  R m_point;
+  size_t m_k;
+  double m_threshold;
+  double m_farthest;
+
+  /* a max-heap on distance, so the farthest candidate is at the front */
+  std::vector<candidate> m_heap;
+
+  static bool cmp(const candidate &a, const candidate &b) {
+    return a.first < b.first;
+  }
+};
+
+} // namespace de
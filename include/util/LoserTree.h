@@ -0,0 +1,136 @@
+/*
+ * include/util/LoserTree.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * A tournament (loser) tree for selecting the smallest of the head
+ * records of a set of sorted runs, for use in k-way merges. Each internal
+ * node records the run that lost the comparison made there, and the
+ * overall winner is stored separately, so replacing the head of the
+ * winning run requires only the log k comparisons along the path from
+ * its leaf to the root, against the losers stored on that path, rather
+ * than the roughly 2 log k comparisons of a binary heap.
+ *
+ * Runs are identified by their index, and ties between equal records
+ * are broken in favor of the run with the smaller index. An empty run
+ * is represented by a nullptr head, which loses to every record.
+ */
+#pragma once
+
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+namespace de {
+
+template <typename R> class LoserTree {
+public:
+  /*
+   * Create a tree over run_cnt runs. All of the runs are initially
+   * empty, and should be given their heads with set_head before calling
+   * build.
+   */
+  LoserTree(size_t run_cnt) : m_leaf_cnt(2), m_winner(0) {
+    while (m_leaf_cnt < run_cnt) {
+      m_leaf_cnt *= 2;
+    }
+
+    m_heads.resize(m_leaf_cnt, nullptr);
+    m_losers.resize(m_leaf_cnt, 0);
+  }
+
+  void set_head(size_t run, const R *head) { m_heads[run] = head; }
+
+  /* play the full tournament over the current run heads */
+  void build() { m_winner = play(1); }
+
+  /* the index of the run with the smallest head */
+  size_t top() const { return m_winner; }
+
+  const R *head(size_t run) const { return m_heads[run]; }
+
+  /* true once every run is empty */
+  bool empty() const { return m_heads[m_winner] == nullptr; }
+
+  /*
+   * Replace the head of the winning run (which may be nullptr, if the
+   * run is now empty) and replay its path to find the new winner.
+   */
+  void replace_top(const R *head) {
+    size_t winner = m_winner;
+    m_heads[winner] = head;
+
+    for (size_t node = (winner + m_leaf_cnt) / 2; node > 0; node /= 2) {
+      if (less(m_losers[node], winner)) {
+        std::swap(m_losers[node], winner);
+      }
+    }
+
+    m_winner = winner;
+  }
+
+  /*
+   * The index of the run with the second smallest head, which must have
+   * lost to the winner directly and so is one of the losers on the
+   * winner's path. Returns a run with a nullptr head if there is none.
+   */
+  size_t second() const {
+    size_t node = (m_winner + m_leaf_cnt) / 2;
+    size_t second = m_losers[node];
+    for (node /= 2; node > 0; node /= 2) {
+      if (less(m_losers[node], second)) {
+        second = m_losers[node];
+      }
+    }
+
+    return second;
+  }
+
+private:
+  size_t m_leaf_cnt;
+  size_t m_winner;
+
+  std::vector<const R *> m_heads;
+
+  /* the loser at each internal node, with the root at index 1 */
+  std::vector<size_t> m_losers;
+
+  inline bool less(size_t a, size_t b) const {
+    auto ra = m_heads[a];
+    auto rb = m_heads[b];
+
+    if (ra == nullptr || rb == nullptr) {
+      return rb == nullptr && (ra != nullptr || a < b);
+    }
+
+    if (*ra < *rb) {
+      return true;
+    } else if (*rb < *ra) {
+      return false;
+    }
+
+    return a < b;
+  }
+
+  /* return the winner of the subtree rooted at node, recording losers */
+  size_t play(size_t node) {
+    if (node >= m_leaf_cnt) {
+      return node - m_leaf_cnt;
+    }
+
+    size_t left = play(2 * node);
+    size_t right = play(2 * node + 1);
+
+    if (less(right, left)) {
+      m_losers[node] = left;
+      return right;
+    }
+
+    m_losers[node] = right;
+    return left;
+  }
+};
+
+} // namespace de
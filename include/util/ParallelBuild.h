@@ -0,0 +1,167 @@
+/*
+ * include/util/ParallelBuild.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * Support for spreading the construction of a single shard across
+ * multiple threads. Shards are built by their constructors, which have
+ * no access to the framework's scheduler, and so the threads available
+ * for a build are described by a BuildContext that the reconstruction
+ * installs for the thread running it. The construction routines used
+ * by shards (such as the sorted merge in util/SortedMerge.h) then use
+ * parallel_for to divide their work, which runs serially if no context
+ * is installed.
+ *
+ * Tasks are handed to the context's thread pool, but the thread calling
+ * parallel_for also claims and runs them itself, and only waits on tasks
+ * that another thread has already started. So a build will still
+ * complete if no pool threads are free to help with it.
+ *
+ * The same mechanism is used by the framework to answer the local queries
+ * of a single query concurrently, with parallel_for_each.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+namespace de {
+
+struct BuildContext {
+  /* run a task on another thread, typically from the scheduler's pool */
+  std::function<void(std::function<void()>)> submit;
+
+  /* the maximum number of threads (including the caller) to use */
+  size_t parallelism;
+};
+
+inline thread_local const BuildContext *current_build_context = nullptr;
+
+/*
+ * Install a BuildContext for the calling thread for the lifetime of the
+ * guard, restoring the previous one (if any) afterwards.
+ */
+class BuildContextGuard {
+public:
+  BuildContextGuard(const BuildContext *context)
+      : m_prev(current_build_context) {
+    current_build_context = context;
+  }
+
+  ~BuildContextGuard() { current_build_context = m_prev; }
+
+  BuildContextGuard(const BuildContextGuard &) = delete;
+  BuildContextGuard &operator=(const BuildContextGuard &) = delete;
+
+private:
+  const BuildContext *m_prev;
+};
+
+/*
+ * Return the number of threads available to the calling thread for
+ * building a shard.
+ */
+static inline size_t get_build_parallelism() {
+  return (current_build_context) ? current_build_context->parallelism : 1;
+}
+
+/*
+ * Run f(0), ..., f(task_cnt - 1) on up to thread_cnt threads (including
+ * the caller), with each thread claiming the next unclaimed task in
+ * order. Returns once all of the calls have completed.
+ */
+template <typename F>
+static void run_tasks(size_t task_cnt, size_t thread_cnt, F &&f) {
+  /*
+   * the state is shared with the helper tasks, which may not run until
+   * after this call has returned, in which case they will find no work
+   * left to claim and exit without touching f
+   */
+  struct state {
+    std::atomic<size_t> next;
+    std::atomic<size_t> done;
+    std::mutex lk;
+    std::condition_variable cv;
+  };
+
+  auto s = std::make_shared<state>();
+  s->next.store(0);
+  s->done.store(0);
+
+  auto work = [s, task_cnt, &f]() {
+    size_t task;
+    while ((task = s->next.fetch_add(1)) < task_cnt) {
+      f(task);
+
+      if (s->done.fetch_add(1) + 1 == task_cnt) {
+        std::unique_lock<std::mutex> lk(s->lk);
+        s->cv.notify_all();
+      }
+    }
+  };
+
+  for (size_t i = 1; i < thread_cnt; i++) {
+    current_build_context->submit(work);
+  }
+
+  work();
+
+  std::unique_lock<std::mutex> lk(s->lk);
+  s->cv.wait(lk, [&s, task_cnt] { return s->done.load() == task_cnt; });
+}
+
+/*
+ * Call f(start, stop) over a set of disjoint ranges covering [0, n),
+ * each of at least grain elements (except possibly the last), using up
+ * to get_build_parallelism() threads. Returns once all of the calls have
+ * completed.
+ */
+template <typename F>
+static void parallel_for(size_t n, size_t grain, F &&f) {
+  grain = std::max<size_t>(grain, 1);
+  size_t task_cnt = (n + grain - 1) / grain;
+  size_t thread_cnt = std::min(get_build_parallelism(), task_cnt);
+
+  if (thread_cnt <= 1) {
+    if (n > 0) {
+      f(0, n);
+    }
+    return;
+  }
+
+  /* spread the work over exactly enough tasks to occupy each thread */
+  grain = std::max(grain, (n + thread_cnt - 1) / thread_cnt);
+  task_cnt = (n + grain - 1) / grain;
+
+  run_tasks(task_cnt, thread_cnt, [n, grain, &f](size_t task) {
+    f(task * grain, std::min(n, (task + 1) * grain));
+  });
+}
+
+/*
+ * Call f(i) for each i in [0, n), using up to get_build_parallelism()
+ * threads. Unlike parallel_for, each call is a separate task, and tasks
+ * are started in index order, so this suits a small number of calls
+ * of uneven size, ideally ordered from largest to smallest.
+ */
+template <typename F> static void parallel_for_each(size_t n, F &&f) {
+  size_t thread_cnt = std::min(get_build_parallelism(), n);
+
+  if (thread_cnt <= 1) {
+    for (size_t i = 0; i < n; i++) {
+      f(i);
+    }
+    return;
+  }
+
+  run_tasks(n, thread_cnt, f);
+}
+
+} // namespace de
@@ -0,0 +1,76 @@
+/*
+ * include/util/ShardFilters.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * Construction of the bloom filters used as auxiliary structures on
+ * sorted shards. There are two of these,
+ *   1. A filter over the keys of the shard's tombstones, used by
+ *      point_lookup when filter is true (i.e., when searching for a
+ *      tombstone).
+ *   2. A filter over the distinct keys within the shard, which allows
+ *      point lookups to skip shards that cannot contain the key without
+ *      searching their index. These are disabled by default, and can be
+ *      enabled using BF_SET_KEY_FILTERS (see util/bf_config.h).
+ *
+ * Both filters are over keys, rather than whole records, as the hash of
+ * a record would include any padding bytes within it.
+ *
+ * The filters are built in a single pass over the shard's records once
+ * it has been constructed, rather than as the records are merged, so as
+ * not to prevent the merge from being split across threads.
+ */
+#pragma once
+
+#include "framework/interface/Record.h"
+#include "util/BlockedBloomFilter.h"
+#include "util/bf_config.h"
+
+namespace de {
+
+/*
+ * Build the tombstone and key filters over the reccnt records of shard,
+ * of which tombstone_cnt are tombstones. The tombstone filter is set to
+ * nullptr if the shard has no tombstones, and the key filter if key
+ * filters are disabled, or if the shard is empty.
+ */
+template <KVPInterface R, typename S, typename K = decltype(R::key)>
+static void build_shard_filters(const S *shard, size_t reccnt,
+                                size_t tombstone_cnt,
+                                BlockedBloomFilter<K> **tombstones,
+                                BlockedBloomFilter<K> **keys) {
+  *tombstones = nullptr;
+  if (tombstone_cnt > 0) {
+    *tombstones =
+        new BlockedBloomFilter<K>(BF_FPR, tombstone_cnt, BF_HASH_FUNCS);
+  }
+
+  *keys = nullptr;
+  if (BF_KEY_FILTERS && reccnt > 0) {
+    *keys = new BlockedBloomFilter<K>(BF_FPR, reccnt, BF_HASH_FUNCS);
+  }
+
+  if (tombstone_cnt == 0 && *keys == nullptr) {
+    return;
+  }
+
+  K last_key{};
+
+  for (size_t i = 0; i < reccnt; i++) {
+    Wrapped<R> rec = *shard->get_record_at(i);
+
+    /* the records are sorted, so duplicate keys are adjacent */
+    if (*keys && (i == 0 || !(rec.rec.key == last_key))) {
+      (*keys)->insert(rec.rec.key);
+    }
+    last_key = rec.rec.key;
+
+    if (*tombstones && rec.is_tombstone()) {
+      (*tombstones)->insert(rec.rec.key);
+    }
+  }
+}
+
+} // namespace de
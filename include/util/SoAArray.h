@@ -0,0 +1,202 @@
+/*
+ * include/util/SoAArray.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * A structure-of-arrays storage layout for the sorted record arrays
+ * used by shards. Rather than storing an array of Wrapped<R>, the keys
+ * and values of the records are kept in separate arrays, so that
+ * searches and scans that only examine keys need only touch key bytes.
+ * Of the header, only the tombstone and delete bits are retained (the
+ * rest are only meaningful within the mutable buffer), and these are
+ * stored as a pair of bitmaps, so that queries can count or skip over
+ * them a word at a time.
+ *
+ * For Record<int64_t, int64_t>, this reduces the size of each record
+ * within a shard from 24 bytes to a little over 16.
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <type_traits>
+
+#include "framework/interface/Record.h"
+#include "psu-util/alignment.h"
+#include "util/Allocators.h"
+#include "util/Bitmap.h"
+
+namespace de {
+
+/*
+ * The storage layout used by a shard for its records, either an array
+ * of Wrapped<R> (AOS), or separate arrays of keys, values, and
+ * flags (SOA).
+ */
+enum class RecordLayout { AOS, SOA };
+
+/*
+ * Records that can be stored using the SOA layout. The record must
+ * consist of only a key and a value, as these are the only fields
+ * retained, and pointer keys are not supported.
+ */
+template <typename R>
+concept SoARecordInterface =
+    KVPInterface<R> &&
+    std::is_same_v<R, Record<decltype(R::key), decltype(R::value)>> &&
+    !std::is_pointer_v<decltype(R::key)>;
+
+/*
+ * A pointer-like reference to a record stored in an SoAArray, for
+ * use in place of a Wrapped<R> pointer. The record itself is copied
+ * out of the arrays on construction, but the delete bitmap is
+ * referenced in place, so that set_delete will update the record
+ * within the shard. A default constructed reference is equivalent to a
+ * null pointer.
+ */
+template <KVPInterface R> class WrappedRef {
+public:
+  WrappedRef() : rec(), m_deletes(nullptr), m_idx(0), m_tombstone(false) {}
+
+  WrappedRef(const R &rec, bool tombstone, const Bitmap *deletes, size_t idx)
+      : rec(rec), m_deletes(deletes), m_idx(idx), m_tombstone(tombstone) {}
+
+  explicit operator bool() const { return m_deletes != nullptr; }
+
+  WrappedRef *operator->() { return this; }
+
+  const WrappedRef *operator->() const { return this; }
+
+  Wrapped<R> operator*() const {
+    return {(uint32_t)is_tombstone() | ((uint32_t)is_deleted() << 1), rec};
+  }
+
+  inline void set_delete() { m_deletes->set_atomic(m_idx); }
+
+  inline bool is_deleted() const { return m_deletes->test(m_idx); }
+
+  inline bool is_tombstone() const { return m_tombstone; }
+
+  R rec;
+
+private:
+  const Bitmap *m_deletes;
+  size_t m_idx;
+  bool m_tombstone;
+};
+
+template <KVPInterface R> class SoAArray {
+  typedef decltype(R::key) K;
+  typedef decltype(R::value) V;
+
+public:
+  SoAArray() : m_keys(nullptr), m_values(nullptr) {}
+
+  ~SoAArray() {
+    pooled_free(m_keys);
+    pooled_free(m_values);
+  }
+
+  SoAArray(const SoAArray &) = delete;
+  SoAArray &operator=(const SoAArray &) = delete;
+
+  /*
+   * Allocate space for cnt records, and return the number of bytes
+   * allocated. Any previously allocated storage is released.
+   */
+  size_t allocate(size_t cnt) {
+    pooled_free(m_keys);
+    pooled_free(m_values);
+
+    size_t alloc_size = 0;
+    alloc_size +=
+        pooled_aligned_alloc(cnt * sizeof(K), (psudb::byte **)&m_keys);
+    alloc_size +=
+        pooled_aligned_alloc(cnt * sizeof(V), (psudb::byte **)&m_values);
+    alloc_size += m_tombstones.allocate(cnt);
+    alloc_size += m_deletes.allocate(cnt);
+
+    return alloc_size;
+  }
+
+  /*
+   * Store rec at idx. The flag bits are set atomically, so that records
+   * can be stored at distinct indices concurrently (as is done by
+   * parallel merges) even where they share a bitmap word. As few records
+   * have either flag set, this costs little.
+   */
+  void set(size_t idx, const Wrapped<R> &rec) {
+    m_keys[idx] = rec.rec.key;
+    m_values[idx] = rec.rec.value;
+
+    if (rec.is_tombstone()) {
+      m_tombstones.set_atomic(idx);
+    }
+
+    if (rec.is_deleted()) {
+      m_deletes.set_atomic(idx);
+    }
+  }
+
+  Wrapped<R> get(size_t idx) const {
+    Wrapped<R> rec;
+    rec.header = (uint32_t)m_tombstones.test(idx) |
+                 ((uint32_t)m_deletes.test(idx) << 1);
+    rec.rec.key = m_keys[idx];
+    rec.rec.value = m_values[idx];
+    return rec;
+  }
+
+  WrappedRef<R> ref(size_t idx) const {
+    return WrappedRef<R>({m_keys[idx], m_values[idx]}, m_tombstones.test(idx),
+                         &m_deletes, idx);
+  }
+
+  const K &key(size_t idx) const { return m_keys[idx]; }
+
+  const K *get_keys() const { return m_keys; }
+
+  const V *get_values() const { return m_values; }
+
+  const Bitmap &get_tombstones() const { return m_tombstones; }
+
+  const Bitmap &get_deletes() const { return m_deletes; }
+
+private:
+  K *m_keys;
+  V *m_values;
+  Bitmap m_tombstones;
+  Bitmap m_deletes;
+};
+
+/*
+ * A cursor over the records of an SoAArray, for use in merging. As the
+ * records are not stored as Wrapped<R>, the record at the head of the
+ * cursor is copied into the cursor itself, where it can be referenced
+ * by a priority queue.
+ */
+template <KVPInterface R> struct SoACursor {
+  const SoAArray<R> *data;
+  size_t cur_rec_idx;
+  size_t rec_cnt;
+  Wrapped<R> head;
+};
+
+/*
+ * Advance the cursor to the next record, loading it into the head of
+ * the cursor. Returns false if the cursor has reached the end of its
+ * records, and true otherwise.
+ */
+template <KVPInterface R> inline static bool advance_cursor(SoACursor<R> &cur) {
+  cur.cur_rec_idx++;
+
+  if (cur.cur_rec_idx >= cur.rec_cnt)
+    return false;
+
+  cur.head = cur.data->get(cur.cur_rec_idx);
+  return true;
+}
+
+} // namespace de
@@ -9,26 +9,43 @@
  * shards will use a sorted array to represent their data. Also encapsulates
  * the necessary tombstone-cancellation logic.
  *
- * FIXME: include generic per-record processing functionality for Shards that
- * need it, to avoid needing to reprocess the array in the shard after
- * creation.
+ * Merges of two inputs, the common case under leveling, use a dedicated
+ * two-way routine, and larger merges use a loser tree (see
+ * util/LoserTree.h). Large merges can also be split across multiple
+ * threads (see util/ParallelBuild.h).
+ *
+ * Shards that need to do their own processing of each record as it is
+ * added (such as feeding keys into an index builder) can provide a
+ * callback to do so, rather than making another pass over the records
+ * after construction.
  */
 #pragma once
 
 #include <algorithm>
+#include <type_traits>
 
 #include "framework/interface/Shard.h"
 #include "psu-ds/PriorityQueue.h"
+#include "util/Allocators.h"
+#include "util/BlockedBloomFilter.h"
 #include "util/Cursor.h"
+#include "util/LoserTree.h"
+#include "util/ParallelBuild.h"
+#include "util/SoAArray.h"
 
 namespace de {
 
-using psudb::BloomFilter;
 using psudb::byte;
 using psudb::CACHELINE_SIZE;
 using psudb::PriorityQueue;
 using psudb::queue_record;
 
+/*
+ * The minimum number of records per thread for a merge to be split
+ * across multiple threads
+ */
+constexpr size_t PARALLEL_MERGE_GRAIN = 1 << 15;
+
 /*
  * A simple struct to return record_count and tombstone_count information
  * back to the caller. Could've been an std::pair, but I like the more
@@ -39,6 +56,14 @@ struct merge_info {
   size_t tombstone_count;
 };
 
+/*
+ * The default per-record processing callback for the routines below,
+ * which does nothing.
+ */
+struct no_processing {
+  template <typename T> inline void operator()(const T &) const {}
+};
+
 /*
  * Build a vector of cursors corresponding to the records contained within
  * a vector of shards. The cursor at index i in the output will correspond
@@ -75,33 +100,232 @@ build_cursor_vec(std::vector<S *> const &shards, size_t *reccnt,
   return cursors;
 }
 
+/*
+ * Build a vector of cursors over a vector of shards using the SOA
+ * record layout. Behaves identically to build_cursor_vec otherwise.
+ */
+template <RecordInterface R, SoAShardInterface S>
+static std::vector<SoACursor<R>>
+build_soa_cursor_vec(std::vector<S *> const &shards, size_t *reccnt,
+                     size_t *tscnt) {
+  std::vector<SoACursor<R>> cursors;
+  cursors.reserve(shards.size());
+
+  *reccnt = 0;
+  *tscnt = 0;
+
+  for (size_t i = 0; i < shards.size(); ++i) {
+    if (shards[i] && shards[i]->get_record_count() > 0) {
+      auto columns = shards[i]->get_columns();
+      cursors.emplace_back(SoACursor<R>{columns, 0,
+                                        shards[i]->get_record_count(),
+                                        columns->get(0)});
+      *reccnt += shards[i]->get_record_count();
+      *tscnt += shards[i]->get_tombstone_count();
+    } else {
+      cursors.emplace_back(SoACursor<R>{nullptr, 0, 0, {}});
+    }
+  }
+
+  return cursors;
+}
+
+/*
+ * Build a vector of cursors over only the records within the [start, stop)
+ * index range given for each shard in ranges, for use in building a shard
+ * from a portion of the records of its inputs. Otherwise behaves
+ * identically to build_cursor_vec, except that tscnt is only an upper
+ * bound on the number of tombstones within the ranges.
+ */
+template <RecordInterface R, ShardInterface S>
+static std::vector<Cursor<Wrapped<R>>>
+build_cursor_vec(std::vector<S *> const &shards,
+                 std::vector<std::pair<size_t, size_t>> const &ranges,
+                 size_t *reccnt, size_t *tscnt) {
+  std::vector<Cursor<Wrapped<R>>> cursors;
+  cursors.reserve(shards.size());
+
+  *reccnt = 0;
+  *tscnt = 0;
+
+  for (size_t i = 0; i < shards.size(); ++i) {
+    auto [start, stop] = ranges[i];
+    if (shards[i] && start < stop) {
+      auto base = shards[i]->get_data();
+      cursors.emplace_back(
+          Cursor<Wrapped<R>>{base + start, base + stop, 0, stop - start});
+      *reccnt += stop - start;
+      *tscnt += std::min(stop - start, shards[i]->get_tombstone_count());
+    } else {
+      cursors.emplace_back(Cursor<Wrapped<R>>{nullptr, nullptr, 0, 0});
+    }
+  }
+
+  return cursors;
+}
+
+/*
+ * Build a vector of cursors over the [start, stop) index range of each
+ * shard using the SOA record layout. The tombstones within the ranges
+ * are counted exactly, using the tombstone bitmaps.
+ */
+template <RecordInterface R, SoAShardInterface S>
+static std::vector<SoACursor<R>>
+build_soa_cursor_vec(std::vector<S *> const &shards,
+                     std::vector<std::pair<size_t, size_t>> const &ranges,
+                     size_t *reccnt, size_t *tscnt) {
+  std::vector<SoACursor<R>> cursors;
+  cursors.reserve(shards.size());
+
+  *reccnt = 0;
+  *tscnt = 0;
+
+  for (size_t i = 0; i < shards.size(); ++i) {
+    auto [start, stop] = ranges[i];
+    if (shards[i] && start < stop) {
+      auto columns = shards[i]->get_columns();
+      cursors.emplace_back(
+          SoACursor<R>{columns, start, stop, columns->get(start)});
+      *reccnt += stop - start;
+      *tscnt += columns->get_tombstones().count(start, stop);
+    } else {
+      cursors.emplace_back(SoACursor<R>{nullptr, 0, 0, {}});
+    }
+  }
+
+  return cursors;
+}
+
+/*
+ * Helpers to allow the routines below to operate over both record
+ * layouts. The output buffer is either an array of Wrapped<R>, or
+ * an SoAArray, and the cursors are either Cursors over an array of
+ * Wrapped<R>, or SoACursors.
+ */
+template <RecordInterface R>
+static inline void store_record(Wrapped<R> *buffer, size_t idx,
+                                const Wrapped<R> &rec) {
+  buffer[idx] = rec;
+}
+
+template <KVPInterface R>
+static inline void store_record(SoAArray<R> &buffer, size_t idx,
+                                const Wrapped<R> &rec) {
+  buffer.set(idx, rec);
+}
+
+template <RecordInterface R>
+static inline Wrapped<R> load_record(const Wrapped<R> *buffer, size_t idx) {
+  return buffer[idx];
+}
+
+template <KVPInterface R>
+static inline Wrapped<R> load_record(const SoAArray<R> &buffer, size_t idx) {
+  return buffer.get(idx);
+}
+
+template <RecordInterface R>
+static inline const Wrapped<R> *cursor_record(Cursor<Wrapped<R>> &cursor) {
+  return cursor.ptr;
+}
+
+template <KVPInterface R>
+static inline const Wrapped<R> *cursor_record(SoACursor<R> &cursor) {
+  return &cursor.head;
+}
+
+template <RecordInterface R>
+static inline bool cursor_empty(const Cursor<Wrapped<R>> &cursor) {
+  return cursor.ptr == nullptr || cursor.rec_cnt == 0;
+}
+
+template <KVPInterface R>
+static inline bool cursor_empty(const SoACursor<R> &cursor) {
+  return cursor.rec_cnt == 0;
+}
+
+/* the number of records remaining in the cursor */
+template <RecordInterface R>
+static inline size_t cursor_size(const Cursor<Wrapped<R>> &cursor) {
+  return (cursor.ptr) ? cursor.rec_cnt - cursor.cur_rec_idx : 0;
+}
+
+template <KVPInterface R>
+static inline size_t cursor_size(const SoACursor<R> &cursor) {
+  return (cursor.data) ? cursor.rec_cnt - cursor.cur_rec_idx : 0;
+}
+
+/* the idx'th of the records remaining in the cursor */
+template <RecordInterface R>
+static inline Wrapped<R> cursor_record_at(const Cursor<Wrapped<R>> &cursor,
+                                          size_t idx) {
+  return cursor.ptr[idx];
+}
+
+template <KVPInterface R>
+static inline Wrapped<R> cursor_record_at(const SoACursor<R> &cursor,
+                                          size_t idx) {
+  return cursor.data->get(cursor.cur_rec_idx + idx);
+}
+
+/*
+ * A cursor over the [start, stop) range of the records remaining in
+ * cursor
+ */
+template <RecordInterface R>
+static inline Cursor<Wrapped<R>> cursor_slice(const Cursor<Wrapped<R>> &cursor,
+                                              size_t start, size_t stop) {
+  if (start >= stop) {
+    return {nullptr, nullptr, 0, 0};
+  }
+
+  return {cursor.ptr + start, cursor.ptr + stop, 0, stop - start};
+}
+
+template <KVPInterface R>
+static inline SoACursor<R> cursor_slice(const SoACursor<R> &cursor,
+                                        size_t start, size_t stop) {
+  if (start >= stop) {
+    return {nullptr, 0, 0, {}};
+  }
+
+  size_t idx = cursor.cur_rec_idx + start;
+  return {cursor.data, idx, cursor.cur_rec_idx + stop, cursor.data->get(idx)};
+}
+
 /*
  * Build a sorted array of records based on the contents of a BufferView.
  * This routine does not alter the buffer view, but rather copies the
- * records out and then sorts them. The provided buffer must be large
+ * records out in sorted order (merging the buffer's sorted runs, if it
+ * maintains them). The provided buffer, either an array of Wrapped<R>
+ * or an SoAArray, must be large
  * enough to store the records from the BufferView, or the behavior of the
  * function is undefined.
  *
+ * If provided, process is called with each record that is copied into
+ * buffer, in sorted order.
+ *
  * It allocates a temporary buffer for the sorting, and execution of the
  * program will be aborted if the allocation fails.
  */
-template <RecordInterface R>
+template <RecordInterface R, typename B, typename F = no_processing>
 static merge_info
-sorted_array_from_bufferview(BufferView<R> bv, Wrapped<R> *buffer,
-                             psudb::BloomFilter<R> *bf = nullptr) {
+sorted_array_from_bufferview(BufferView<R> bv, B &&buffer,
+                             BlockedBloomFilter<R> *bf = nullptr,
+                             F &&process = F()) {
   /*
-   * Copy the contents of the buffer view into a temporary buffer, and
-   * sort them. We still need to iterate over these temporary records to
+   * Copy the contents of the buffer view into a temporary buffer, in
+   * sorted order. We still need to iterate over these temporary records to
    * apply tombstone/deleted record filtering, as well as any possible
    * per-record processing that is required by the shard being built.
    */
-  auto temp_buffer = (Wrapped<R> *)psudb::sf_aligned_calloc(
-      CACHELINE_SIZE, bv.get_record_count(), sizeof(Wrapped<R>));
-  bv.copy_to_buffer((byte *)temp_buffer);
+  Wrapped<R> *temp_buffer;
+  pooled_aligned_alloc(bv.get_record_count() * sizeof(Wrapped<R>),
+                       (byte **)&temp_buffer);
+  bv.copy_to_buffer_sorted((byte *)temp_buffer);
 
   auto base = temp_buffer;
   auto stop = base + bv.get_record_count();
-  std::sort(base, stop, std::less<Wrapped<R>>());
 
   merge_info info = {0, 0};
 
@@ -124,7 +348,8 @@ sorted_array_from_bufferview(BufferView<R> bv, Wrapped<R> *buffer,
     // ensures that tagged records from the buffer are able to be
     // dropped, eventually. It should only need to be &= 1
     base->header &= 3;
-    buffer[info.record_count++] = *base;
+    store_record<R>(buffer, info.record_count++, *base);
+    process(*base);
 
     if (base->is_tombstone()) {
       info.tombstone_count++;
@@ -136,77 +361,351 @@ sorted_array_from_bufferview(BufferView<R> bv, Wrapped<R> *buffer,
     base++;
   }
 
-  free(temp_buffer);
+  pooled_free(temp_buffer);
   return info;
 }
 
 /*
- * Perform a sorted merge of the records within cursors into the provided
- * buffer. Includes tombstone and tagged delete cancellation logic, and
- * will insert tombstones into a bloom filter, if one is provided.
- *
- * The behavior of this function is undefined if the provided buffer does
- * not have space to contain all of the records within the input cursors.
+ * Drain a single cursor, calling emit with each record that hasn't been
+ * deleted via tagging. With only one input there is nothing to cancel
+ * its records against.
  */
-template <RecordInterface R>
-static merge_info sorted_array_merge(std::vector<Cursor<Wrapped<R>>> &cursors,
-                                     Wrapped<R> *buffer,
-                                     psudb::BloomFilter<R> *bf = nullptr) {
-
-  // FIXME: For smaller cursor arrays, it may be more efficient to skip
-  //        the priority queue and just do a scan.
-  PriorityQueue<Wrapped<R>> pq(cursors.size());
-  for (size_t i = 0; i < cursors.size(); i++) {
-    pq.push(cursors[i].ptr, i);
+template <RecordInterface R, typename C, typename F>
+static void drain_cursor(C &cursor, F &&emit) {
+  if (cursor_empty<R>(cursor)) {
+    return;
   }
 
-  merge_info info = {0, 0};
-  while (pq.size()) {
-    auto now = pq.peek();
-    auto next =
-        pq.size() > 1 ? pq.peek(1) : queue_record<Wrapped<R>>{nullptr, 0};
+  do {
+    auto rec = cursor_record<R>(cursor);
+    if (!rec->is_deleted()) {
+      emit(rec);
+    }
+  } while (advance_cursor(cursor));
+}
+
+/*
+ * Merge two non-empty cursors, which is by far the most common case under
+ * leveling. The smaller head is selected with a single comparison, and
+ * cancellation only needs to consider the other head, as it is the next
+ * smallest record. Ties are resolved in favor of c1, as in the general
+ * case.
+ */
+template <RecordInterface R, typename C, typename F>
+static void merge_two_cursors(C &c1, C &c2, F &&emit) {
+  auto r1 = cursor_record<R>(c1);
+  auto r2 = cursor_record<R>(c2);
+
+  while (true) {
+    bool second = *r2 < *r1;
+    auto now = second ? r2 : r1;
+    auto next = second ? r1 : r2;
+
     /*
      * if the current record is not a tombstone, and the next record is
-     * a tombstone that matches the current one, then the current one
-     * has been deleted, and both it and its tombstone can be skipped
-     * over.
+     * a tombstone that matches it, then both can be skipped over
      */
-    if (!now.data->is_tombstone() && next.data != nullptr &&
-        now.data->rec == next.data->rec && next.data->is_tombstone()) {
-
-      pq.pop();
-      pq.pop();
-      auto &cursor1 = cursors[now.version];
-      auto &cursor2 = cursors[next.version];
-      if (advance_cursor(cursor1))
-        pq.push(cursor1.ptr, now.version);
-      if (advance_cursor(cursor2))
-        pq.push(cursor2.ptr, next.version);
+    if (!now->is_tombstone() && next->is_tombstone() && now->rec == next->rec) {
+      bool more1 = advance_cursor(c1);
+      bool more2 = advance_cursor(c2);
+      if (!more1 || !more2) {
+        if (more1) {
+          drain_cursor<R>(c1, emit);
+        } else if (more2) {
+          drain_cursor<R>(c2, emit);
+        }
+        return;
+      }
+
+      r1 = cursor_record<R>(c1);
+      r2 = cursor_record<R>(c2);
+      continue;
+    }
+
+    /* skip over records that have been deleted via tagging */
+    if (!now->is_deleted()) {
+      emit(now);
+    }
+
+    auto &cursor = second ? c2 : c1;
+    if (!advance_cursor(cursor)) {
+      drain_cursor<R>(second ? c1 : c2, emit);
+      return;
+    }
+
+    if (second) {
+      r2 = cursor_record<R>(c2);
     } else {
-      auto &cursor = cursors[now.version];
-      /* skip over records that have been deleted via tagging */
-      if (!cursor.ptr->is_deleted()) {
-        buffer[info.record_count++] = *cursor.ptr;
+      r1 = cursor_record<R>(c1);
+    }
+  }
+}
+
+/*
+ * Perform a sorted merge of the records within cursors, including
+ * tombstone and tagged delete cancellation, calling emit with a pointer
+ * to each record that survives, in sorted order. The cursors are
+ * advanced to their ends.
+ *
+ * A record is cancelled when the next smallest record amongst the heads
+ * of the other cursors is a matching tombstone. Merges of one or two
+ * cursors are handled directly, and larger ones use a loser tree.
+ */
+template <RecordInterface R, typename C, typename F>
+static void merge_cursors(std::vector<C> &cursors, F &&emit) {
+  std::vector<size_t> active;
+  for (size_t i = 0; i < cursors.size(); i++) {
+    if (!cursor_empty<R>(cursors[i])) {
+      active.push_back(i);
+    }
+  }
+
+  if (active.size() == 0) {
+    return;
+  } else if (active.size() == 1) {
+    drain_cursor<R>(cursors[active[0]], emit);
+    return;
+  } else if (active.size() == 2) {
+    merge_two_cursors<R>(cursors[active[0]], cursors[active[1]], emit);
+    return;
+  }
+
+  LoserTree<Wrapped<R>> tree(cursors.size());
+  for (auto i : active) {
+    tree.set_head(i, cursor_record<R>(cursors[i]));
+  }
+  tree.build();
+
+  while (!tree.empty()) {
+    /*
+     * the head of an SoACursor is overwritten when it advances, so the
+     * record must be copied out first
+     */
+    size_t top = tree.top();
+    auto &cursor = cursors[top];
+    Wrapped<R> now = *tree.head(top);
+
+    tree.replace_top(advance_cursor(cursor) ? cursor_record<R>(cursor)
+                                            : nullptr);
+
+    if (!now.is_tombstone()) {
+      /*
+       * the new winner is the smallest of the other heads, unless it
+       * is the cursor that now was taken from. Its new head can only
+       * precede a matching tombstone if it is a duplicate of now, and
+       * so the other heads need only be searched in that case.
+       */
+      size_t ts = tree.top();
+      if (ts == top) {
+        auto head = tree.head(top);
+        ts = (head != nullptr && head->rec == now.rec) ? tree.second() : top;
+      }
+
+      auto next = tree.head(ts);
+      if (ts != top && next != nullptr && next->is_tombstone() &&
+          next->rec == now.rec) {
+        auto &ts_cursor = cursors[ts];
+        auto ts_next =
+            advance_cursor(ts_cursor) ? cursor_record<R>(ts_cursor) : nullptr;
 
         /*
-         * if the record is a tombstone, increment the ts count and
-         * insert it into the bloom filter if one has been
-         * provided.
+         * the tombstone is below the winner in the duplicate case, and
+         * so the tree is rebuilt to remove it
          */
-        if (cursor.ptr->is_tombstone()) {
-          info.tombstone_count++;
-          if (bf) {
-            bf->insert(cursor.ptr->rec);
+        if (tree.top() == ts) {
+          tree.replace_top(ts_next);
+        } else {
+          tree.set_head(ts, ts_next);
+          tree.build();
+        }
+        continue;
+      }
+    }
+
+    /* skip over records that have been deleted via tagging */
+    if (!now.is_deleted()) {
+      emit(&now);
+    }
+  }
+}
+
+/*
+ * Split the records of cursors into part_cnt groups of cursors covering
+ * disjoint, consecutive ranges of records, of roughly equal size. The
+ * ranges are divided at splitter records sampled from the cursors, so
+ * all copies of a record (and its tombstone) fall into the same group,
+ * and the groups can be merged independently of one another.
+ */
+template <RecordInterface R, typename C>
+static std::vector<std::vector<C>> split_cursors(std::vector<C> const &cursors,
+                                                 size_t total,
+                                                 size_t part_cnt) {
+  size_t sample_cnt = part_cnt * 32;
+  std::vector<R> samples;
+  for (auto &cursor : cursors) {
+    size_t n = cursor_size<R>(cursor);
+    if (n == 0) {
+      continue;
+    }
+
+    size_t k = std::max<size_t>(1, n * sample_cnt / total);
+    for (size_t j = 0; j < k; j++) {
+      samples.push_back(cursor_record_at<R>(cursor, j * n / k).rec);
+    }
+  }
+
+  std::sort(samples.begin(), samples.end());
+
+  std::vector<std::vector<C>> parts(part_cnt);
+  std::vector<size_t> starts(cursors.size(), 0);
+  for (size_t p = 0; p < part_cnt; p++) {
+    for (size_t i = 0; i < cursors.size(); i++) {
+      size_t n = cursor_size<R>(cursors[i]);
+      size_t stop = n;
+
+      /* find the first record in the cursor not less than the splitter */
+      if (p + 1 < part_cnt) {
+        auto &splitter = samples[(p + 1) * samples.size() / part_cnt];
+        size_t low = starts[i];
+        while (low < stop) {
+          size_t mid = low + (stop - low) / 2;
+          if (cursor_record_at<R>(cursors[i], mid).rec < splitter) {
+            low = mid + 1;
+          } else {
+            stop = mid;
           }
         }
       }
-      pq.pop();
 
-      if (advance_cursor(cursor))
-        pq.push(cursor.ptr, now.version);
+      parts[p].push_back(cursor_slice<R>(cursors[i], starts[i], stop));
+      starts[i] = stop;
+    }
+  }
+
+  return parts;
+}
+
+/*
+ * Perform a sorted merge of the records within cursors into buffer using
+ * multiple threads, by splitting them into part_cnt groups with
+ * split_cursors and merging each group separately. As cancellation makes
+ * the number of records each group produces unpredictable, each group
+ * is merged into the slice of buffer starting at the number of input
+ * records in the groups before it, which bounds the output of those
+ * groups. The groups' outputs are then compacted to close the gaps left
+ * by cancelled records.
+ */
+template <RecordInterface R, typename C, typename B>
+static merge_info parallel_sorted_array_merge(std::vector<C> &cursors,
+                                              B &&buffer, size_t total,
+                                              size_t part_cnt) {
+  auto parts = split_cursors<R>(cursors, total, part_cnt);
+
+  std::vector<size_t> starts(part_cnt, 0);
+  for (size_t p = 1; p < part_cnt; p++) {
+    starts[p] = starts[p - 1];
+    for (auto &cursor : parts[p - 1]) {
+      starts[p] += cursor_size<R>(cursor);
+    }
+  }
+
+  std::vector<size_t> cnts(part_cnt, 0);
+  std::vector<size_t> tombstone_cnts(part_cnt, 0);
+  parallel_for(part_cnt, 1, [&](size_t start, size_t stop) {
+    for (size_t p = start; p < stop; p++) {
+      size_t idx = starts[p];
+      merge_cursors<R>(parts[p], [&](const auto &rec) {
+        store_record<R>(buffer, idx++, *rec);
+        if (rec->is_tombstone()) {
+          tombstone_cnts[p]++;
+        }
+      });
+      cnts[p] = idx - starts[p];
+    }
+  });
+
+  /*
+   * each group's output only ever moves towards the front of the
+   * buffer, over its own slice and those of the groups before it, so
+   * the groups must be moved in order
+   */
+  merge_info info = {cnts[0], tombstone_cnts[0]};
+  for (size_t p = 1; p < part_cnt; p++) {
+    if (info.record_count != starts[p]) {
+      for (size_t i = 0; i < cnts[p]; i++) {
+        store_record<R>(buffer, info.record_count + i,
+                        load_record<R>(buffer, starts[p] + i));
+      }
+    }
+
+    info.record_count += cnts[p];
+    info.tombstone_count += tombstone_cnts[p];
+  }
+
+  return info;
+}
+
+/*
+ * Perform a sorted merge of the records within cursors into the provided
+ * buffer. Includes tombstone and tagged delete cancellation logic, and
+ * will insert tombstones into a bloom filter, if one is provided.
+ *
+ * The cursors may be either Cursors or SoACursors, and the buffer either
+ * an array of Wrapped<R> or an SoAArray. The behavior of this function
+ * is undefined if the provided buffer does not have space to contain all
+ * of the records within the input cursors.
+ *
+ * If provided, process is called with each record that is written into
+ * buffer, in sorted order and from the calling thread.
+ *
+ * Large merges are split across threads if the calling thread has a
+ * BuildContext installed (see util/ParallelBuild.h), so long as no bloom
+ * filter is provided, as the filter cannot be built concurrently. In
+ * this case, process is called for each record in a separate pass over
+ * buffer once the merge is complete.
+ */
+template <RecordInterface R, typename C, typename B,
+          typename F = no_processing>
+static merge_info sorted_array_merge(std::vector<C> &cursors, B &&buffer,
+                                     BlockedBloomFilter<R> *bf = nullptr,
+                                     F &&process = F()) {
+  size_t total = 0;
+  for (auto &cursor : cursors) {
+    total += cursor_size<R>(cursor);
+  }
+
+  size_t part_cnt =
+      std::min(get_build_parallelism(), total / PARALLEL_MERGE_GRAIN);
+  if (part_cnt > 1 && bf == nullptr) {
+    auto info = parallel_sorted_array_merge<R>(cursors, buffer, total, part_cnt);
+
+    if constexpr (!std::is_same_v<std::decay_t<F>, no_processing>) {
+      for (size_t i = 0; i < info.record_count; i++) {
+        process(load_record<R>(buffer, i));
+      }
     }
+
+    return info;
   }
 
+  merge_info info = {0, 0};
+  merge_cursors<R>(cursors, [&](const auto &rec) {
+    store_record<R>(buffer, info.record_count++, *rec);
+    process(*rec);
+
+    /*
+     * if the record is a tombstone, increment the ts count and
+     * insert it into the bloom filter if one has been
+     * provided.
+     */
+    if (rec->is_tombstone()) {
+      info.tombstone_count++;
+      if (bf) {
+        bf->insert(rec->rec);
+      }
+    }
+  });
+
   return info;
 }
 
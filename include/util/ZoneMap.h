@@ -0,0 +1,71 @@
+/*
+ * include/util/ZoneMap.h
+ *
+ * Copyright (C) 2024 Douglas B. Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ * A coarse zone map over the sorted keys of a shard. The records are
+ * divided into at most ZONE_CNT zones of equal size, and the first and
+ * last key of each zone are retained. This is enough to determine
+ * whether a key range falls entirely outside of the shard's keys, or
+ * within a gap between two zones, without searching the shard itself.
+ */
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace de {
+
+template <typename K> class ZoneMap {
+public:
+  /* the maximum number of zones in the map */
+  static const size_t ZONE_CNT = 64;
+
+  ZoneMap() = default;
+
+  /*
+   * Build a map over reccnt records, for which key_at(i) returns the key
+   * of the ith record in sorted order.
+   */
+  template <typename F> ZoneMap(size_t reccnt, F key_at) {
+    if (reccnt == 0) {
+      return;
+    }
+
+    size_t zone_size = (reccnt + ZONE_CNT - 1) / ZONE_CNT;
+    for (size_t i = 0; i < reccnt; i += zone_size) {
+      size_t last = std::min(i + zone_size, reccnt) - 1;
+      m_zones.push_back({key_at(i), key_at(last)});
+    }
+  }
+
+  /*
+   * Return false if no key within [lower, upper] can be present in the
+   * records. A return value of true means that such a key may be present.
+   */
+  bool overlaps(const K &lower, const K &upper) const {
+    /* the first zone that ends at or after lower */
+    auto zone = std::partition_point(
+        m_zones.begin(), m_zones.end(),
+        [&lower](const zone_bounds &z) { return z.last < lower; });
+
+    return zone != m_zones.end() && !(upper < zone->first);
+  }
+
+  size_t get_memory_usage() const {
+    return m_zones.capacity() * sizeof(zone_bounds);
+  }
+
+private:
+  struct zone_bounds {
+    K first;
+    K last;
+  };
+
+  std::vector<zone_bounds> m_zones;
+};
+
+} // namespace de
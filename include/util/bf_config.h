@@ -10,7 +10,7 @@
  * structures on shards within the framework. The bloom filter class
  * can be found in
  *
- * $PROJECT_ROOT/external/psudb-common/cpp/include/psu-ds/BloomFilter.h
+ * $PROJECT_ROOT/include/util/BlockedBloomFilter.h
  *
  */
 #pragma once
@@ -22,9 +22,19 @@ namespace de {
 /* global variable for specifying bloom filter FPR */
 static double BF_FPR = .01;
 
-/* global variable for specifying number of BF hash functions (k) */
+/*
+ * global variable for specifying number of BF hash functions (k). The
+ * blocked filters support at most 8, and larger values are clamped.
+ */
 static size_t BF_HASH_FUNCS = 7;
 
+/*
+ * global variable for enabling the filters over the keys of each shard,
+ * which are used to skip shards during point lookups. These are off by
+ * default, as they cost memory and build time on every shard.
+ */
+static bool BF_KEY_FILTERS = false;
+
 /*
  * Adjust the value of BF_FPR. The argument must be on the interval
  * (0, 1), or the behavior of bloom filters is undefined.
@@ -37,4 +47,10 @@ static size_t BF_HASH_FUNCS = 7;
  */
 [[maybe_unused]] static void BF_SET_HASHFUNC(size_t func_cnt) { BF_HASH_FUNCS = func_cnt; }
 
+/*
+ * Enable or disable the construction of key filters on shards built
+ * after the call. Shards without a key filter are always searched.
+ */
+[[maybe_unused]] static void BF_SET_KEY_FILTERS(bool enabled) { BF_KEY_FILTERS = enabled; }
+
 } // namespace de
@@ -82,6 +82,12 @@ typedef struct ReconstructionTask {
   level_index target;
   size_t reccnt = 0;
 
+  /*
+   * the number of records to move out of the source level, when levels
+   * are partitioned. 0 moves the entire level.
+   */
+  size_t move_reccnt = 0;
+
   void add_source(level_index source, size_t cnt) {
     sources.push_back(source);
     reccnt += cnt;
@@ -98,8 +104,8 @@ public:
   ReconstructionTask operator[](size_t idx) { return m_tasks[idx]; }
 
   void add_reconstruction(level_index source, level_index target,
-                          size_t reccnt) {
-    m_tasks.push_back({{source}, target, reccnt});
+                          size_t reccnt, size_t move_reccnt = 0) {
+    m_tasks.push_back({{source}, target, reccnt, move_reccnt});
     total_reccnt += reccnt;
   }
 
@@ -0,0 +1,355 @@
+/*
+ * tests/de_level_partitioned.cpp
+ *
+ * Unit tests for Dynamic Extension Framework with key-range partitioned
+ * leveling
+ *
+ * Copyright (C) 2024 Douglas Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ */
+#include <set>
+#include <random>
+#include <algorithm>
+
+#include "include/testing.h"
+#include "framework/DynamicExtension.h"
+#include "framework/scheduling/FIFOScheduler.h"
+#include "shard/ISAMTree.h"
+#include "query/rangequery.h"
+
+#include <check.h>
+using namespace de;
+
+typedef Rec R;
+typedef ISAMTree<R> S;
+typedef ISAMTree<R, RecordLayout::SOA> SOAS;
+typedef rq::Query<S> Q;
+typedef rq::Query<SOAS> SOAQ;
+
+typedef DynamicExtension<S, Q, LayoutPolicy::LEVELING, DeletePolicy::TOMBSTONE, SerialScheduler> DE;
+typedef DynamicExtension<SOAS, SOAQ, LayoutPolicy::LEVELING, DeletePolicy::TOMBSTONE, SerialScheduler> SOADE;
+typedef DynamicExtension<S, Q, LayoutPolicy::LEVELING, DeletePolicy::TOMBSTONE, FIFOScheduler> CDE;
+
+static_assert(PartitionedShardInterface<S>);
+static_assert(PartitionedShardInterface<SOAS>);
+
+static constexpr size_t PARTITION_SIZE = 500;
+
+
+/*
+ * Check that a range query over [lower, upper] against test_de returns
+ * exactly the keys within that range in expected
+ */
+template <typename D, typename QT>
+static void check_range(D *test_de, std::multiset<uint64_t> &expected,
+                        uint64_t lower, uint64_t upper) {
+    typename QT::Parameters p;
+    p.lower_bound = lower;
+    p.upper_bound = upper;
+
+    auto r = test_de->query(std::move(p)).get();
+    std::sort(r.begin(), r.end());
+
+    auto start = expected.lower_bound(lower);
+    auto stop = expected.upper_bound(upper);
+    ck_assert_int_eq(r.size(), std::distance(start, stop));
+
+    size_t i = 0;
+    for (auto itr = start; itr != stop; itr++, i++) {
+        ck_assert_int_eq(r[i].key, *itr);
+    }
+}
+
+
+START_TEST(t_range_query)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2,
+                           .thread_cnt = 1,
+                           .partition_size = PARTITION_SIZE});
+    size_t n = 20000;
+
+    std::multiset<uint64_t> keys;
+    for (size_t i=0; i<n; i++) {
+        uint64_t key = rand() % 50000;
+        keys.insert(key);
+
+        R r = {key, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    ck_assert_int_eq(test_de->get_record_count(), n);
+    ck_assert_int_gt(test_de->get_height(), 1);
+
+    for (size_t i=0; i<100; i++) {
+        uint64_t lower = rand() % 50000;
+        uint64_t upper = lower + rand() % 2500;
+        check_range<DE, Q>(test_de, keys, lower, upper);
+    }
+
+    check_range<DE, Q>(test_de, keys, 0, 50000);
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_range_query_soa)
+{
+    auto test_de = new SOADE({.buffer_low_watermark = 100,
+                              .buffer_high_watermark = 1000,
+                              .scale_factor = 2,
+                              .thread_cnt = 1,
+                              .partition_size = PARTITION_SIZE});
+    size_t n = 20000;
+
+    std::multiset<uint64_t> keys;
+    for (size_t i=0; i<n; i++) {
+        uint64_t key = rand() % 50000;
+        keys.insert(key);
+
+        R r = {key, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    ck_assert_int_eq(test_de->get_record_count(), n);
+
+    for (size_t i=0; i<100; i++) {
+        uint64_t lower = rand() % 50000;
+        uint64_t upper = lower + rand() % 2500;
+        check_range<SOADE, SOAQ>(test_de, keys, lower, upper);
+    }
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_sequential_insert)
+{
+    /*
+     * with sequential keys, the incoming partitions never overlap those
+     * already within a level, and so are moved without being merged
+     */
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2,
+                           .thread_cnt = 1,
+                           .partition_size = PARTITION_SIZE});
+    size_t n = 50000;
+
+    std::multiset<uint64_t> keys;
+    for (size_t i=0; i<n; i++) {
+        keys.insert(i);
+
+        R r = {i, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    ck_assert_int_eq(test_de->get_record_count(), n);
+    check_range<DE, Q>(test_de, keys, 0, n);
+    check_range<DE, Q>(test_de, keys, 1234, 4321);
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_tombstone_cancellation)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2,
+                           .thread_cnt = 1,
+                           .partition_size = PARTITION_SIZE});
+    size_t n = 20000;
+
+    std::set<std::pair<uint64_t, uint32_t>> records;
+    while (records.size() < n) {
+        records.insert({rand() % 100000, rand()});
+    }
+
+    std::vector<std::pair<uint64_t, uint32_t>> shuffled(records.begin(), records.end());
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937{std::random_device{}()});
+
+    std::multiset<uint64_t> keys;
+    for (size_t i=0; i<shuffled.size(); i++) {
+        R r = {shuffled[i].first, shuffled[i].second};
+        ck_assert_int_eq(test_de->insert(r), 1);
+
+        /* delete every third record, some time after inserting it */
+        if (i >= 1000 && (i - 1000) % 3 == 0) {
+            R d = {shuffled[i - 1000].first, shuffled[i - 1000].second};
+            ck_assert_int_eq(test_de->erase(d), 1);
+        }
+    }
+
+    for (size_t i=0; i<shuffled.size(); i++) {
+        if (i + 1000 >= shuffled.size() || i % 3 != 0) {
+            keys.insert(shuffled[i].first);
+        }
+    }
+
+    /*
+     * the buffer's local query results are unsorted, and so tombstones
+     * within it aren't cancelled by the range query. Push the records
+     * being checked out of the buffer with some outside of the range.
+     */
+    for (size_t i=0; i<1000; i++) {
+        R r = {200000 + i, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    for (size_t i=0; i<100; i++) {
+        uint64_t lower = rand() % 100000;
+        uint64_t upper = lower + rand() % 5000;
+        check_range<DE, Q>(test_de, keys, lower, upper);
+    }
+
+    check_range<DE, Q>(test_de, keys, 0, 100000);
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_concurrent_insert)
+{
+    auto test_de = new CDE({.buffer_low_watermark = 100,
+                            .buffer_high_watermark = 1000,
+                            .scale_factor = 2,
+                            .thread_cnt = 4,
+                            .partition_size = PARTITION_SIZE});
+    size_t n = 100000;
+
+    std::multiset<uint64_t> keys;
+    for (size_t i=0; i<n; i++) {
+        uint64_t key = rand() % 250000;
+        keys.insert(key);
+
+        R r = {key, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert_wait(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    ck_assert_int_eq(test_de->get_record_count(), n);
+
+    for (size_t i=0; i<100; i++) {
+        uint64_t lower = rand() % 250000;
+        uint64_t upper = lower + rand() % 10000;
+        check_range<CDE, Q>(test_de, keys, lower, upper);
+    }
+
+    check_range<CDE, Q>(test_de, keys, 0, 250000);
+
+    delete test_de;
+}
+END_TEST
+
+
+/*
+ * Background reconstructions should only perform work early that a
+ * later flush would have done anyway, so once the flushed buffers can
+ * be absorbed by L0 without any further reconstructions, the levels of
+ * a concurrent index should match those of a serial one. Using equal
+ * watermarks makes every flush exactly one buffer's worth of records
+ * under both schedulers. Partitioned reconstructions move a varying
+ * number of records, so the comparison is made without partitioning,
+ * where the flush after which L0 has space left is known up front.
+ */
+START_TEST(t_background_layout)
+{
+    size_t bufsize = 1000;
+    auto serial_de = new DE({.buffer_low_watermark = bufsize,
+                             .buffer_high_watermark = bufsize,
+                             .scale_factor = 2,
+                             .thread_cnt = 1});
+    auto concurrent_de = new CDE({.buffer_low_watermark = bufsize,
+                                  .buffer_high_watermark = bufsize,
+                                  .scale_factor = 2,
+                                  .thread_cnt = 4});
+
+    /* an odd number of flushes leaves L0 half full */
+    size_t n = 52 * bufsize;
+    for (size_t i=0; i<n; i++) {
+        R r = {(uint64_t) rand() % 250000, (uint32_t) i};
+        ck_assert_int_eq(serial_de->insert(r), 1);
+        ck_assert_int_eq(concurrent_de->insert_wait(r), 1);
+    }
+
+    concurrent_de->await_next_epoch();
+
+    ck_assert_int_eq(concurrent_de->get_record_count(), n);
+    ck_assert_int_eq(serial_de->get_record_count(), n);
+
+    auto serial_levels = serial_de->get_level_record_counts();
+    auto concurrent_levels = concurrent_de->get_level_record_counts();
+    ck_assert_int_eq(concurrent_levels.size(), serial_levels.size());
+    for (size_t i=0; i<serial_levels.size(); i++) {
+        ck_assert_int_eq(concurrent_levels[i], serial_levels[i]);
+    }
+
+    delete serial_de;
+    delete concurrent_de;
+}
+END_TEST
+
+
+Suite *unit_testing()
+{
+    Suite *unit = suite_create("DynamicExtension: Partitioned Leveling Testing");
+
+    TCase *insert = tcase_create("de::DynamicExtension::insert Testing");
+    tcase_add_test(insert, t_sequential_insert);
+    tcase_add_test(insert, t_concurrent_insert);
+    tcase_add_test(insert, t_background_layout);
+    tcase_set_timeout(insert, 500);
+    suite_add_tcase(unit, insert);
+
+    TCase *query = tcase_create("de::DynamicExtension::range_query Testing");
+    tcase_add_test(query, t_range_query);
+    tcase_add_test(query, t_range_query_soa);
+    tcase_set_timeout(query, 500);
+    suite_add_tcase(unit, query);
+
+    TCase *ts = tcase_create("de::DynamicExtension::tombstone_cancellation Testing");
+    tcase_add_test(ts, t_tombstone_cancellation);
+    tcase_set_timeout(ts, 500);
+    suite_add_tcase(unit, ts);
+
+    return unit;
+}
+
+
+int shard_unit_tests()
+{
+    int failed = 0;
+    Suite *unit = unit_testing();
+    SRunner *unit_shardner = srunner_create(unit);
+
+    srunner_run_all(unit_shardner, CK_NORMAL);
+    failed = srunner_ntests_failed(unit_shardner);
+    srunner_free(unit_shardner);
+
+    return failed;
+}
+
+
+int main()
+{
+    int unit_failed = shard_unit_tests();
+
+    return (unit_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
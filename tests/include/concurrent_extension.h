@@ -39,7 +39,9 @@
 
 START_TEST(t_create)
 {
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     ck_assert_ptr_nonnull(test_de);
     ck_assert_int_eq(test_de->get_record_count(), 0);
@@ -52,7 +54,9 @@ END_TEST
 
 START_TEST(t_insert)
 {
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     uint64_t key = 0;
     uint32_t val = 0;
@@ -73,7 +77,9 @@ END_TEST
 
 START_TEST(t_debug_insert)
 {
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     uint64_t key = 0;
     uint32_t val = 0;
@@ -92,7 +98,9 @@ END_TEST
 
 START_TEST(t_insert_with_mem_merges)
 {
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     uint64_t key = 0;
     uint32_t val = 0;
@@ -133,9 +141,179 @@ START_TEST(t_insert_with_mem_merges)
 END_TEST
 
 
+START_TEST(t_insert_wait)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+
+    /*
+     * inserting well past the high watermark should block, rather
+     * than fail, while the buffer is flushed
+     */
+    size_t n = 100000;
+    for (size_t i=0; i<n; i++) {
+        R r = {i, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert_wait(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    ck_assert_int_eq(test_de->get_record_count(), n);
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_background_reconstruction)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+
+    /*
+     * with a small buffer, deeper levels will be reconstructed in the
+     * background alongside buffer flushes. Every record should end up
+     * in exactly one level once they have all been installed.
+     */
+    size_t n = 200000;
+    for (size_t i=0; i<n; i++) {
+        R r = {i, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert_wait(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    ck_assert_int_eq(test_de->get_record_count(), n);
+    ck_assert_int_gt(test_de->get_height(), 2);
+
+    Q::Parameters p;
+    p.lower_bound = 0;
+    p.upper_bound = n - 1;
+
+    auto result = test_de->query(std::move(p));
+    auto r = result.get();
+    std::sort(r.begin(), r.end());
+
+    ck_assert_int_eq(r.size(), n);
+    for (size_t i=0; i<r.size(); i++) {
+        ck_assert_int_eq(r[i].key, i);
+    }
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_insert_async)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+
+    size_t n = 100000;
+    std::vector<std::future<int>> results;
+    for (size_t i=0; i<n; i++) {
+        R r = {i, (uint32_t) i};
+        results.emplace_back(test_de->insert_async(r));
+    }
+
+    for (size_t i=0; i<n; i++) {
+        ck_assert_int_eq(results[i].get(), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    ck_assert_int_eq(test_de->get_record_count(), n);
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_memory_budget)
+{
+    /* a budget too small for any two reconstructions to run together */
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2,
+                           .memory_budget = 1});
+
+    /*
+     * flushes will be deferred while background reconstructions are
+     * running, but each must run once nothing else holds a reservation,
+     * so inserts are throttled rather than failing indefinitely
+     */
+    size_t n = 100000;
+    for (size_t i=0; i<n; i++) {
+        R r = {i, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert_wait(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    ck_assert_int_eq(test_de->get_record_count(), n);
+    ck_assert_int_gt(test_de->get_memory_usage(), test_de->get_memory_budget());
+
+    delete test_de;
+}
+END_TEST
+
+
+void lane_insert_thread(DE *test_de, std::vector<R> *records, size_t start, size_t stop)
+{
+    StagingLane<DE, R> lane(test_de, 32);
+    for (size_t i=start; i<stop; i++) {
+        while (!lane.insert((*records)[i])) {
+            _mm_pause();
+        }
+    }
+
+    while (!lane.flush()) {
+        _mm_pause();
+    }
+}
+
+
+START_TEST(t_multithreaded_staging_lane_insert)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+
+    size_t n = 100000;
+    std::vector<R> records(n);
+    for (size_t i=0; i<n; i++) {
+        records[i] = R{i, (uint32_t) i};
+    }
+
+    size_t thread_cnt = 4;
+    size_t per_thread = n / thread_cnt;
+    std::vector<std::thread> workers(thread_cnt);
+    for (size_t i=0; i<thread_cnt; i++) {
+        workers[i] = std::thread(lane_insert_thread, test_de, &records,
+                                 i * per_thread, (i + 1) * per_thread);
+    }
+
+    for (size_t i=0; i<thread_cnt; i++) {
+        workers[i].join();
+    }
+
+    test_de->await_next_epoch();
+
+    ck_assert_int_eq(test_de->get_record_count(), n);
+
+    delete test_de;
+}
+END_TEST
+
+
 START_TEST(t_range_query)
 {
-    auto test_de = new DE(1000, 10000, 4);
+    auto test_de = new DE({.buffer_low_watermark = 1000,
+                           .buffer_high_watermark = 10000,
+                           .scale_factor = 4});
     size_t n = 10000000;
 
     std::vector<uint64_t> keys;
@@ -186,10 +364,180 @@ START_TEST(t_range_query)
 END_TEST
 
 
+/*
+ * A cursor sees the records present when it was opened, even if buffer
+ * flushes and reconstructions happen while it is being read.
+ */
+START_TEST(t_scan_concurrent_flush)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+    size_t n = 10000;
+
+    for (size_t i=0; i<n; i++) {
+        R r = {2 * i, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert_wait(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    auto cursor = test_de->scan(0, 2 * n);
+
+    std::thread inserter([test_de, n] {
+        for (size_t i=0; i<n; i++) {
+            R r = {2 * i + 1, (uint32_t) i};
+            test_de->insert_wait(r);
+        }
+    });
+
+    R r;
+    size_t j = 0;
+    while (cursor.next(r)) {
+        ck_assert_int_eq(r.key, 2 * j);
+        j++;
+    }
+    ck_assert_int_eq(j, n);
+
+    inserter.join();
+    test_de->await_next_epoch();
+
+    /* a new cursor sees the records inserted during the first scan */
+    auto full = test_de->scan(0, 2 * n);
+    j = 0;
+    while (full.next(r)) {
+        ck_assert_int_eq(r.key, j);
+        j++;
+    }
+    ck_assert_int_eq(j, 2 * n);
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_parallel_build)
+{
+    auto test_de = new DE({.buffer_low_watermark = 1000,
+                           .buffer_high_watermark = 10000,
+                           .scale_factor = 4});
+    test_de->set_build_parallelism(4);
+    ck_assert_int_eq(test_de->get_build_parallelism(), 4);
+
+    size_t n = 1000000;
+
+    std::vector<uint64_t> keys;
+    for (size_t i=0; i<n; i++) {
+        keys.push_back(i);
+    }
+
+    std::random_device rd;
+    std::mt19937 gen{rd()};
+    std::shuffle(keys.begin(), keys.end(), gen);
+
+    size_t i=0;
+    while ( i < keys.size()) {
+        R r = {keys[i], (uint32_t) i};
+        if (test_de->insert(r)) {
+            i++;
+        } else {
+            _mm_pause();
+        }
+    }
+
+    test_de->await_next_epoch();
+
+    ck_assert_int_eq(test_de->get_record_count(), n);
+
+    std::sort(keys.begin(), keys.end());
+
+    for (size_t j=0; j<10; j++) {
+        auto idx = rand() % (keys.size() - 1000);
+
+        Q::Parameters p;
+        p.lower_bound = keys[idx];
+        p.upper_bound = keys[idx + 1000];
+
+        auto result = test_de->query(std::move(p));
+        auto r = result.get();
+        std::sort(r.begin(), r.end());
+
+        ck_assert_int_eq(r.size(), 1001);
+
+        for (size_t i=0; i<r.size(); i++) {
+            ck_assert_int_eq(r[i].key, keys[idx + i]);
+        }
+    }
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_parallel_query)
+{
+    auto test_de = new DE({.buffer_low_watermark = 1000,
+                           .buffer_high_watermark = 10000,
+                           .scale_factor = 4});
+    test_de->set_query_parallelism(4);
+    ck_assert_int_eq(test_de->get_query_parallelism(), 4);
+
+    size_t n = 1000000;
+
+    std::vector<uint64_t> keys;
+    for (size_t i=0; i<n; i++) {
+        keys.push_back(i);
+    }
+
+    std::random_device rd;
+    std::mt19937 gen{rd()};
+    std::shuffle(keys.begin(), keys.end(), gen);
+
+    size_t i=0;
+    while ( i < keys.size()) {
+        R r = {keys[i], (uint32_t) i};
+        if (test_de->insert(r)) {
+            i++;
+        } else {
+            _mm_pause();
+        }
+    }
+
+    test_de->await_next_epoch();
+
+    std::sort(keys.begin(), keys.end());
+
+    /* wide enough ranges for the local queries to be run in parallel */
+    size_t width = 200000;
+    for (size_t j=0; j<5; j++) {
+        auto idx = rand() % (keys.size() - width);
+
+        Q::Parameters p;
+        p.lower_bound = keys[idx];
+        p.upper_bound = keys[idx + width - 1];
+
+        auto result = test_de->query(std::move(p));
+        auto r = result.get();
+        std::sort(r.begin(), r.end());
+
+        ck_assert_int_eq(r.size(), width);
+
+        for (size_t i=0; i<r.size(); i++) {
+            ck_assert_int_eq(r[i].key, keys[idx + i]);
+        }
+    }
+
+    delete test_de;
+}
+END_TEST
+
+
 START_TEST(t_tombstone_merging_01)
 {
     size_t reccnt = 100000;
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     auto rng = gsl_rng_alloc(gsl_rng_mt19937);
 
@@ -245,7 +593,9 @@ END_TEST
 DE *create_test_tree(size_t reccnt, size_t memlevel_cnt) {
     auto rng = gsl_rng_alloc(gsl_rng_mt19937);
 
-    auto test_de = new DE(1000, 10000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 1000,
+                           .buffer_high_watermark = 10000,
+                           .scale_factor = 2});
 
     std::set<R> records; 
     std::set<R> to_delete;
@@ -289,7 +639,9 @@ START_TEST(t_static_structure)
     auto rng = gsl_rng_alloc(gsl_rng_mt19937);
 
     size_t reccnt = 100000;
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     std::set<R> records; 
     std::set<R> to_delete;
@@ -360,11 +712,19 @@ static void inject_dynamic_extension_tests(Suite *suite) {
     tcase_add_test(insert, t_insert);
     tcase_add_test(insert, t_insert_with_mem_merges);
     tcase_add_test(insert, t_debug_insert);
+    tcase_add_test(insert, t_multithreaded_staging_lane_insert);
+    tcase_add_test(insert, t_insert_wait);
+    tcase_add_test(insert, t_background_reconstruction);
+    tcase_add_test(insert, t_insert_async);
+    tcase_add_test(insert, t_memory_budget);
     tcase_set_timeout(insert, 500);
     suite_add_tcase(suite, insert);
 
     TCase *query = tcase_create("de::DynamicExtension::range_query Testing");
     tcase_add_test(query, t_range_query);
+    tcase_add_test(query, t_scan_concurrent_flush);
+    tcase_add_test(query, t_parallel_build);
+    tcase_add_test(query, t_parallel_query);
     tcase_set_timeout(query, 500);
     suite_add_tcase(suite, query);
 
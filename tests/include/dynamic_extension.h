@@ -42,7 +42,9 @@
 #include "framework/util/Configuration.h"
 START_TEST(t_create)
 {
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     ck_assert_ptr_nonnull(test_de);
     ck_assert_int_eq(test_de->get_record_count(), 0);
@@ -55,7 +57,9 @@ END_TEST
 
 START_TEST(t_insert)
 {
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     uint64_t key = 0;
     uint32_t val = 0;
@@ -74,9 +78,140 @@ START_TEST(t_insert)
 END_TEST
 
 
+START_TEST(t_insert_batch)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+
+    std::vector<R> records;
+    for (size_t i=0; i<10000; i++) {
+        records.push_back({i, (uint32_t) i});
+    }
+
+    size_t batch_size = 250;
+    size_t inserted = 0;
+    while (inserted < records.size()) {
+        size_t cnt = std::min(batch_size, records.size() - inserted);
+        auto batch = std::span<const R>(records.data() + inserted, cnt);
+        size_t res = test_de->insert_batch(batch);
+        ck_assert_int_gt(res, 0);
+        inserted += res;
+    }
+
+    ck_assert_int_eq(test_de->get_record_count(), records.size());
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_staging_lane_insert)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+
+    {
+        StagingLane<DE, R> lane(test_de, 64);
+
+        for (size_t i=0; i<10000; i++) {
+            R r = {i, (uint32_t) i};
+            ck_assert_int_eq(lane.insert(r), 1);
+            ck_assert_int_lt(lane.get_staged_count(), lane.get_capacity());
+        }
+
+        /* staged records are not yet part of the index */
+        ck_assert_int_eq(test_de->get_record_count(), 10000 - lane.get_staged_count());
+
+        ck_assert_int_eq(lane.flush(), 1);
+        ck_assert_int_eq(lane.get_staged_count(), 0);
+    }
+
+    ck_assert_int_eq(test_de->get_record_count(), 10000);
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_insert_async)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+
+    std::vector<std::future<int>> results;
+    for (size_t i=0; i<10000; i++) {
+        R r = {i, (uint32_t) i};
+        results.emplace_back(test_de->insert_async(r));
+    }
+
+    for (size_t i=0; i<results.size(); i++) {
+        ck_assert_int_eq(results[i].get(), 1);
+    }
+
+    ck_assert_int_eq(test_de->get_record_count(), 10000);
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_memory_budget)
+{
+    /* a budget too small for any reconstruction to fit */
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2,
+                           .memory_budget = 1});
+    ck_assert_int_eq(test_de->get_memory_budget(), 1);
+
+    /*
+     * flushes are still run when nothing else holds a reservation, so
+     * inserts may be throttled, but must eventually succeed
+     */
+    size_t n = 10000;
+    for (size_t i=0; i<n; i++) {
+        R r = {i, (uint32_t) i};
+        while (!test_de->insert(r)) {
+            _mm_pause();
+        }
+    }
+
+    test_de->await_next_epoch();
+    ck_assert_int_eq(test_de->get_record_count(), n);
+    ck_assert_int_gt(test_de->get_height(), 0);
+    ck_assert_int_gt(test_de->get_memory_usage(), test_de->get_memory_budget());
+    ck_assert_int_eq(test_de->get_reserved_memory(), 0);
+
+    delete test_de;
+
+    /* a budget with plenty of room should not affect anything */
+    test_de = new DE({.buffer_low_watermark = 100,
+                      .buffer_high_watermark = 1000,
+                      .scale_factor = 2,
+                      .memory_budget = 1ull << 30});
+    for (size_t i=0; i<10000; i++) {
+        R r = {i, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert(r), 1);
+    }
+
+    test_de->await_next_epoch();
+    ck_assert_int_eq(test_de->get_record_count(), 10000);
+    ck_assert_int_eq(test_de->get_deferred_reconstruction_count(), 0);
+    ck_assert_int_le(test_de->get_memory_usage(), 1ull << 30);
+
+    delete test_de;
+}
+END_TEST
+
+
 START_TEST(t_debug_insert)
 {
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     uint64_t key = 0;
     uint32_t val = 0;
@@ -95,7 +230,9 @@ END_TEST
 
 START_TEST(t_insert_with_mem_merges)
 {
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     uint64_t key = 0;
     uint32_t val = 0;
@@ -127,7 +264,9 @@ END_TEST
 
 START_TEST(t_range_query)
 {
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
     size_t n = 10000;
 
     std::vector<uint64_t> keys;
@@ -172,10 +311,281 @@ START_TEST(t_range_query)
 END_TEST
 
 
+START_TEST(t_query_batch)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+    size_t n = 10000;
+
+    for (size_t i=0; i<n; i++) {
+        R r = {(uint64_t) rand() % 25000, (uint32_t) i};
+        ck_assert_int_eq(test_de->insert(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    /* the batch is deliberately out of key order */
+    std::vector<Q::Parameters> batch;
+    for (size_t i=0; i<100; i++) {
+        uint64_t lower = rand() % 25000;
+        batch.push_back({lower, lower + rand() % 500});
+    }
+
+    auto expected_parms = batch;
+    auto results = test_de->query_batch(std::move(batch)).get();
+    ck_assert_int_eq(results.size(), expected_parms.size());
+
+    for (size_t i=0; i<results.size(); i++) {
+        auto parms = expected_parms[i];
+        auto expected = test_de->query(std::move(parms)).get();
+
+        std::sort(expected.begin(), expected.end());
+        std::sort(results[i].begin(), results[i].end());
+
+        ck_assert_int_eq(results[i].size(), expected.size());
+        for (size_t j=0; j<expected.size(); j++) {
+            ck_assert_int_eq(results[i][j].key, expected[j].key);
+            ck_assert_int_eq(results[i][j].value, expected[j].value);
+        }
+    }
+
+    auto empty = test_de->query_batch({}).get();
+    ck_assert_int_eq(empty.size(), 0);
+
+    /* a query matching no records still gets an (empty) result */
+    std::vector<Q::Parameters> miss = {{30000, 40000}};
+    auto missed = test_de->query_batch(std::move(miss)).get();
+    ck_assert_int_eq(missed.size(), 1);
+    ck_assert_int_eq(missed[0].size(), 0);
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_query_sync)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+    size_t n = 10000;
+
+    std::vector<R> records;
+    for (size_t i=0; i<n; i++) {
+        R r = {(uint64_t) rand() % 25000, (uint32_t) i};
+        records.push_back(r);
+        ck_assert_int_eq(test_de->insert(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    for (size_t i=0; i<100; i++) {
+        uint64_t lower = rand() % 25000;
+        Q::Parameters p = {lower, lower + rand() % 500};
+        auto p2 = p;
+
+        auto r = test_de->query_sync(std::move(p));
+        auto expected = test_de->query(std::move(p2)).get();
+
+        std::sort(r.begin(), r.end());
+        std::sort(expected.begin(), expected.end());
+
+        ck_assert_int_eq(r.size(), expected.size());
+        for (size_t j=0; j<r.size(); j++) {
+            ck_assert_int_eq(r[j].key, expected[j].key);
+            ck_assert_int_eq(r[j].value, expected[j].value);
+        }
+    }
+
+    /*
+     * with deletes (and so, under tombstone deletes, tombstones in both
+     * the buffer and the shards) present, the results should still
+     * match those of query
+     */
+    for (size_t i=0; i<records.size(); i+=10) {
+        ck_assert_int_eq(test_de->erase(records[i]), 1);
+    }
+
+    Q::Parameters p = {0, 25000};
+    auto p2 = p;
+
+    auto r = test_de->query_sync(std::move(p));
+    auto expected = test_de->query(std::move(p2)).get();
+
+    std::sort(r.begin(), r.end());
+    std::sort(expected.begin(), expected.end());
+
+    ck_assert_int_eq(r.size(), expected.size());
+    for (size_t j=0; j<r.size(); j++) {
+        ck_assert_int_eq(r[j].key, expected[j].key);
+        ck_assert_int_eq(r[j].value, expected[j].value);
+    }
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_range_query_sorted_buffer)
+{
+    auto test_de = new DE({.buffer_low_watermark = 1000,
+                           .buffer_high_watermark = 2000,
+                           .scale_factor = 2,
+                           .thread_cnt = 1,
+                           .sorted_buffer = true});
+    size_t n = 10000;
+
+    std::vector<uint64_t> keys;
+    for (size_t i=0; i<n; i++) {
+        keys.push_back(rand() % 25000);
+    }
+
+    std::random_device rd;
+    std::mt19937 gen{rd()};
+    std::shuffle(keys.begin(), keys.end(), gen);
+
+    for (size_t i=0; i<keys.size(); i++) {
+        R r = {keys[i], (uint32_t) i};
+        ck_assert_int_eq(test_de->insert(r), 1);
+    }
+
+    test_de->await_next_epoch();
+
+    std::sort(keys.begin(), keys.end());
+
+    auto idx = rand() % (keys.size() - 250);
+
+    uint64_t lower_key = keys[idx];
+    uint64_t upper_key = keys[idx + 250];
+
+    Q::Parameters p;
+
+    p.lower_bound = lower_key;
+    p.upper_bound = upper_key;
+
+    auto result = test_de->query(std::move(p));
+    auto r = result.get();
+    std::sort(r.begin(), r.end());
+    ck_assert_int_eq(r.size(), 251);
+
+    for (size_t i=0; i<r.size(); i++) {
+        ck_assert_int_eq(r[i].key, keys[idx + i]);
+    }
+
+    delete test_de;
+}
+END_TEST
+
+
+START_TEST(t_scan)
+{
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
+    size_t n = 10000;
+
+    std::set<std::pair<uint64_t, uint32_t>> records;
+    std::set<std::pair<uint64_t, uint32_t>> live;
+
+    while (records.size() < n) {
+        records.insert({rand() % 25000, rand() % 4});
+    }
+
+    size_t i = 0;
+    for (auto rec : records) {
+        R r = {rec.first, rec.second};
+        ck_assert_int_eq(test_de->insert(r), 1);
+
+        /* delete every tenth record once it has been inserted */
+        if (i++ % 10 == 0) {
+            ck_assert_int_eq(test_de->erase(r), 1);
+        } else {
+            live.insert(rec);
+        }
+    }
+
+    test_de->await_next_epoch();
+
+    uint64_t lower_key = 5000;
+    uint64_t upper_key = 15000;
+
+    std::vector<std::pair<uint64_t, uint32_t>> expected;
+    for (auto rec : live) {
+        if (rec.first >= lower_key && rec.first <= upper_key) {
+            expected.push_back(rec);
+        }
+    }
+
+    {
+        auto cursor = test_de->scan(lower_key, upper_key);
+        R r;
+        size_t j = 0;
+        while (cursor.next(r)) {
+            ck_assert_int_lt(j, expected.size());
+            ck_assert_int_eq(r.key, expected[j].first);
+            ck_assert_int_eq(r.value, expected[j].second);
+            j++;
+        }
+
+        ck_assert_int_eq(j, expected.size());
+        ck_assert_int_eq(cursor.get_returned_count(), expected.size());
+        ck_assert(!cursor.next(r));
+    }
+
+    /* a limited scan returns a prefix of the full one */
+    {
+        auto cursor = test_de->scan(lower_key, upper_key, 10);
+        R r;
+        size_t j = 0;
+        while (cursor.next(r)) {
+            ck_assert_int_eq(r.key, expected[j].first);
+            j++;
+        }
+
+        ck_assert_int_eq(j, 10);
+    }
+
+    /* a cursor can be moved part-way through a scan, and picks up where it left off */
+    {
+        std::vector<decltype(test_de->scan(lower_key, upper_key))> cursors;
+
+        auto cursor = test_de->scan(lower_key, upper_key);
+        R r;
+        ck_assert(cursor.next(r));
+        ck_assert_int_eq(r.key, expected[0].first);
+
+        cursors.push_back(std::move(cursor));
+        ck_assert(!cursor.next(r));
+
+        size_t j = 1;
+        while (cursors[0].next(r)) {
+            ck_assert_int_eq(r.key, expected[j].first);
+            j++;
+        }
+
+        ck_assert_int_eq(j, expected.size());
+    }
+
+    /* a scan over a range without any records returns nothing */
+    {
+        auto cursor = test_de->scan(25000, 30000);
+        R r;
+        ck_assert(!cursor.next(r));
+        ck_assert_int_eq(cursor.get_returned_count(), 0);
+    }
+
+    delete test_de;
+}
+END_TEST
+
+
 START_TEST(t_tombstone_merging_01)
 {
     size_t reccnt = 100000;
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     auto rng = gsl_rng_alloc(gsl_rng_mt19937);
 
@@ -227,7 +637,9 @@ END_TEST
 [[maybe_unused]] static DE *create_test_tree(size_t reccnt, size_t memlevel_cnt) {
     auto rng = gsl_rng_alloc(gsl_rng_mt19937);
 
-    auto test_de = new DE(1000, 10000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 1000,
+                           .buffer_high_watermark = 10000,
+                           .scale_factor = 2});
 
     std::set<Rec> records; 
     std::set<Rec> to_delete;
@@ -271,7 +683,9 @@ START_TEST(t_static_structure)
     auto rng = gsl_rng_alloc(gsl_rng_mt19937);
 
     size_t reccnt = 100000;
-    auto test_de = new DE(100, 1000, 2);
+    auto test_de = new DE({.buffer_low_watermark = 100,
+                           .buffer_high_watermark = 1000,
+                           .scale_factor = 2});
 
     std::set<Rec> records; 
     std::set<Rec> to_delete;
@@ -334,10 +748,18 @@ static void inject_dynamic_extension_tests(Suite *suite) {
     tcase_add_test(insert, t_insert);
     tcase_add_test(insert, t_insert_with_mem_merges);
     tcase_add_test(insert, t_debug_insert);
+    tcase_add_test(insert, t_insert_batch);
+    tcase_add_test(insert, t_staging_lane_insert);
+    tcase_add_test(insert, t_insert_async);
+    tcase_add_test(insert, t_memory_budget);
     suite_add_tcase(suite, insert);
 
     TCase *query = tcase_create("de::DynamicExtension::range_query Testing");
     tcase_add_test(query, t_range_query);
+    tcase_add_test(query, t_range_query_sorted_buffer);
+    tcase_add_test(query, t_query_batch);
+    tcase_add_test(query, t_query_sync);
+    tcase_add_test(query, t_scan);
     suite_add_tcase(suite, query);
 
     TCase *ts = tcase_create("de::DynamicExtension::tombstone_compaction Testing");
@@ -74,6 +74,51 @@ START_TEST(t_buffer_range_count)
 END_TEST
 
 
+START_TEST(t_buffer_range_count_headers)
+{
+    auto buffer = new MutableBuffer<R>(500, 1000);
+
+    /*
+     * interleave tombstones and tagged deletes throughout the buffer, so
+     * that every scanned block has a mix of header bits
+     */
+    for (size_t i=0; i<1000; i++) {
+        R r = {i % 700, (uint32_t) i};
+        buffer->append(r, i % 7 == 0);
+    }
+
+    rc::Query<Shard>::Parameters parms = {150, 467};
+
+    {
+        auto view = buffer->get_buffer_view();
+        for (size_t i=0; i<view.get_record_count(); i += 5) {
+            view.get(i)->set_delete();
+        }
+
+        size_t reccnt = 0;
+        size_t tscnt = 0;
+        for (size_t i=0; i<view.get_record_count(); i++) {
+            auto rec = view.get(i);
+            if (rec->rec.key >= parms.lower_bound && rec->rec.key <= parms.upper_bound
+                && !rec->is_deleted()) {
+                reccnt++;
+                tscnt += rec->is_tombstone();
+            }
+        }
+
+        auto query = rc::Query<Shard>::local_preproc_buffer(&view, &parms);
+        auto result = rc::Query<Shard>::local_query_buffer(query); 
+        delete query;
+
+        ck_assert_int_eq(result.record_count, reccnt);
+        ck_assert_int_eq(result.tombstone_count, tscnt);
+    }
+
+    delete buffer;
+}
+END_TEST
+
+
 START_TEST(t_range_count_merge)
 {    
     auto buffer1 = create_sequential_mbuffer<R>(100, 200);
@@ -114,6 +159,7 @@ END_TEST
     TCase *range_count = tcase_create("Range Query Testing"); 
     tcase_add_test(range_count, t_range_count); 
     tcase_add_test(range_count, t_buffer_range_count); 
+    tcase_add_test(range_count, t_buffer_range_count_headers); 
     tcase_add_test(range_count, t_range_count_merge); 
     suite_add_tcase(suite, range_count);
 }
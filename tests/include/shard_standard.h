@@ -15,6 +15,11 @@
  */
 #pragma once
 
+#include <thread>
+
+#include "util/Allocators.h"
+#include "util/ParallelBuild.h"
+
 /*
  * Uncomment these lines temporarily to remove errors in this file
  * temporarily for development purposes. They should be removed prior
@@ -146,6 +151,44 @@ START_TEST(t_full_cancelation)
 END_TEST
 
 
+START_TEST(t_multiway_cancelation)
+{
+    /*
+     * spread the records and their tombstones over enough shards that
+     * the merge can't use its two-way path
+     */
+    size_t n = 100;
+    std::vector<MutableBuffer<R>*> buffers;
+    std::vector<Shard*> shards;
+
+    buffers.push_back(create_sequential_mbuffer<R>(n, 2*n));
+    buffers.push_back(create_double_seq_mbuffer<R>(n, false));
+    buffers.push_back(create_sequential_mbuffer<R>(2*n, 3*n));
+    buffers.push_back(create_double_seq_mbuffer<R>(n, true));
+
+    for (auto buffer : buffers) {
+        shards.push_back(new Shard(buffer->get_buffer_view()));
+    }
+
+    Shard* merged = new Shard(shards);
+
+    ck_assert_int_eq(merged->get_tombstone_count(), 0);
+    ck_assert_int_eq(merged->get_record_count(), 2*n);
+
+    for (size_t i=0; i<2*n; i++) {
+        ck_assert_int_eq(merged->get_record_at(i)->rec.key, n + i);
+    }
+
+    for (size_t i=0; i<shards.size(); i++) {
+        delete shards[i];
+        delete buffers[i];
+    }
+
+    delete merged;
+}
+END_TEST
+
+
 START_TEST(t_point_lookup) 
 {
     size_t n = 10000;
@@ -161,7 +204,7 @@ START_TEST(t_point_lookup)
             R r = {rec->rec.key, rec->rec.value};
 
             auto result = isam.point_lookup(r);
-            ck_assert_ptr_nonnull(result);
+            ck_assert(result);
             ck_assert_int_eq(result->rec.key, r.key);
             ck_assert_int_eq(result->rec.value, r.value);
         }
@@ -183,23 +226,216 @@ START_TEST(t_point_lookup_miss)
         R r = R{i, i};
 
         auto result = isam.point_lookup(r);
-        ck_assert_ptr_null(result);
+        ck_assert(!result);
+    }
+
+    delete buffer;
+}
+
+/*
+ * check the key filter of shard, built over the keys [0, n/2), against the
+ * keys [0, n), if the shard has one
+ */
+template <typename S>
+static void check_key_filter(S &shard, size_t n) {
+    if constexpr (KeyFilteredShardInterface<S>) {
+        /* no false negatives... */
+        for (size_t i=0; i<n / 2; i++) {
+            ck_assert(shard.may_contain_key(i));
+        }
+
+        /* ...and few false positives */
+        size_t false_positives = 0;
+        for (size_t i=n / 2; i<n; i++) {
+            false_positives += shard.may_contain_key(i);
+        }
+        ck_assert_int_lt(false_positives, n / 20);
+    }
+}
+
+START_TEST(t_filters)
+{
+    size_t n = 10000;
+
+    auto buffer = create_double_seq_mbuffer<R>(n, false);
+    auto buffer_ts = create_double_seq_mbuffer<R>(n, true);
+
+    /* key filters are disabled by default */
+    BF_SET_KEY_FILTERS(true);
+    auto shard = Shard(buffer->get_buffer_view());
+    BF_SET_KEY_FILTERS(false);
+    auto shard_ts = Shard(buffer_ts->get_buffer_view());
+
+    /* every tombstone should pass the tombstone filter */
+    for (size_t i=0; i<shard_ts.get_record_count(); i++) {
+        R r = shard_ts.get_record_at(i)->rec;
+
+        auto result = shard_ts.point_lookup(r, true);
+        ck_assert(result);
+        ck_assert(result->is_tombstone());
     }
 
+    check_key_filter(shard, n);
+
     delete buffer;
+    delete buffer_ts;
 }
+END_TEST
+
+
+/*
+ * check the key range and zone map of shard, built over the keys [0, n/2)
+ * and [2n, 5n/2), if the shard has them
+ */
+template <typename S>
+static void check_key_range(S &shard, size_t n) {
+    if constexpr (KeyRangeShardInterface<S>) {
+        ck_assert_int_eq(shard.get_min_key(), 0);
+        ck_assert_int_eq(shard.get_max_key(), 5 * n / 2 - 1);
+    }
+
+    if constexpr (ZoneMappedShardInterface<S>) {
+        ck_assert(shard.may_contain_range(0, 0));
+        ck_assert(shard.may_contain_range(n / 2 - 1, 2 * n));
+        ck_assert(shard.may_contain_range(n, 3 * n));
+        ck_assert(!shard.may_contain_range(n, 3 * n / 2));
+        ck_assert(!shard.may_contain_range(3 * n, 4 * n));
+    }
+}
+
+START_TEST(t_key_range)
+{
+    /*
+     * the zone map can only detect gaps falling between zones, so the
+     * gap between the two runs is placed at a zone boundary
+     */
+    size_t n = 6400;
+
+    auto buffer = create_sequential_mbuffer<R>(0, n / 2);
+    auto buffer2 = create_sequential_mbuffer<R>(2 * n, 5 * n / 2);
+
+    auto shard1 = new Shard(buffer->get_buffer_view());
+    auto shard2 = new Shard(buffer2->get_buffer_view());
+
+    std::vector<Shard *> shards = {shard1, shard2};
+    auto merged = Shard(shards);
+
+    check_key_range(merged, n);
+
+    delete shard1;
+    delete shard2;
+    delete buffer;
+    delete buffer2;
+}
+END_TEST
+
+
+START_TEST(t_parallel_merge)
+{
+    /* large enough for the merge to be split across several threads */
+    size_t n = 50000;
+    std::vector<MutableBuffer<R>*> buffers;
+    std::vector<Shard*> shards;
+
+    for (size_t i=0; i<4; i++) {
+        buffers.push_back(create_test_mbuffer<R>(n));
+    }
+    buffers.push_back(create_double_seq_mbuffer<R>(n, false));
+    buffers.push_back(create_double_seq_mbuffer<R>(n / 2, true));
+
+    for (auto buffer : buffers) {
+        shards.push_back(new Shard(buffer->get_buffer_view()));
+    }
+
+    auto serial = new Shard(shards);
+
+    std::vector<std::thread> threads;
+    BuildContext context = {
+        [&threads](std::function<void()> task) { threads.emplace_back(task); },
+        4};
+
+    Shard *parallel;
+    {
+        BuildContextGuard guard(&context);
+        ck_assert_int_eq(get_build_parallelism(), 4);
+        parallel = new Shard(shards);
+    }
+    ck_assert_int_eq(get_build_parallelism(), 1);
+
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    ck_assert_int_eq(parallel->get_record_count(), serial->get_record_count());
+    ck_assert_int_eq(parallel->get_tombstone_count(), serial->get_tombstone_count());
+
+    for (size_t i=0; i<serial->get_record_count(); i++) {
+        auto rec1 = serial->get_record_at(i);
+        auto rec2 = parallel->get_record_at(i);
+        ck_assert(rec1->rec == rec2->rec);
+        ck_assert_int_eq(rec1->is_tombstone(), rec2->is_tombstone());
+    }
+
+    /* any index built alongside the merge should be identical, too */
+    for (size_t i=0; i<1000; i++) {
+        auto key = serial->get_record_at(rand() % serial->get_record_count())->rec.key;
+        ck_assert_int_eq(parallel->get_lower_bound(key), serial->get_lower_bound(key));
+    }
+
+    for (size_t i=0; i<shards.size(); i++) {
+        delete shards[i];
+        delete buffers[i];
+    }
+
+    delete serial;
+    delete parallel;
+}
+END_TEST
+
+START_TEST(t_pooled_reuse)
+{
+    size_t n = 1000;
+    auto buffer = create_test_mbuffer<R>(n);
+    auto &pool = get_record_pool();
+
+    /* start from an empty pool, so earlier tests' blocks aren't reused */
+    pool.clear();
+    auto shard = new Shard(buffer->get_buffer_view());
+    delete shard;
+
+    /* the shard's arrays should have been returned to the pool... */
+    size_t after_first = pool.get_retained();
+    ck_assert_int_gt(after_first, 0);
+
+    /* ...and drawn back out of it by an identical shard */
+    shard = new Shard(buffer->get_buffer_view());
+    ck_assert_int_lt(pool.get_retained(), after_first);
+    ck_assert_int_eq(shard->get_record_count(), n);
+    delete shard;
+
+    ck_assert_int_eq(pool.get_retained(), after_first);
+
+    delete buffer;
+}
+END_TEST
+
 
 static void inject_shard_tests(Suite *suite) {
     TCase *create = tcase_create("Shard constructor Testing");
     tcase_add_test(create, t_mbuffer_init);
     tcase_add_test(create, t_shard_init);
+    tcase_add_test(create, t_parallel_merge);
+    tcase_add_test(create, t_pooled_reuse);
     tcase_set_timeout(create, 100);
     suite_add_tcase(suite, create);
     TCase *tombstone = tcase_create("Shard tombstone cancellation Testing");
     tcase_add_test(tombstone, t_full_cancelation);
+    tcase_add_test(tombstone, t_multiway_cancelation);
     suite_add_tcase(suite, tombstone); 
     TCase *pointlookup = tcase_create("Shard point lookup Testing"); 
     tcase_add_test(pointlookup, t_point_lookup);
     tcase_add_test(pointlookup, t_point_lookup_miss); 
+    tcase_add_test(pointlookup, t_filters);
+    tcase_add_test(pointlookup, t_key_range);
     suite_add_tcase(suite, pointlookup);
 }
@@ -48,6 +48,45 @@ START_TEST(t_memlevel_merge)
 }
 
 
+START_TEST(t_local_query_pruning)
+{
+    auto tbl1 = create_sequential_mbuffer<Rec>(0, 1000);
+    auto tbl2 = create_sequential_mbuffer<Rec>(5000, 6000);
+
+    auto level = new ILevel(1, 2);
+    level->append_buffer(tbl1->get_buffer_view());
+    level->append_buffer(tbl2->get_buffer_view());
+
+    /* the number of shards against which a query on [lower, upper] runs */
+    auto shard_cnt = [level](uint64_t lower, uint64_t upper) {
+        rq::Query<ISAMTree<Rec>>::Parameters parms = {lower, upper};
+        std::vector<std::pair<ShardID, ISAMTree<Rec> *>> shards;
+        std::vector<rq::Query<ISAMTree<Rec>>::LocalQuery *> local_queries;
+
+        level->get_local_queries(shards, local_queries, &parms);
+        ck_assert_int_eq(shards.size(), local_queries.size());
+
+        for (auto query : local_queries) {
+            delete query;
+        }
+
+        return shards.size();
+    };
+
+    ck_assert_int_eq(shard_cnt(100, 200), 1);
+    ck_assert_int_eq(shard_cnt(5500, 7000), 1);
+    ck_assert_int_eq(shard_cnt(500, 5500), 2);
+    ck_assert_int_eq(shard_cnt(999, 5000), 2);
+    ck_assert_int_eq(shard_cnt(2000, 3000), 0);
+    ck_assert_int_eq(shard_cnt(7000, 8000), 0);
+
+    delete level;
+    delete tbl1;
+    delete tbl2;
+}
+END_TEST
+
+
 ILevel *create_test_memlevel(size_t reccnt) {
     auto tbl1 = create_test_mbuffer<Rec>(reccnt/2);
     auto tbl2 = create_test_mbuffer<Rec>(reccnt/2);
@@ -70,6 +109,10 @@ Suite *unit_testing()
     tcase_add_test(merge, t_memlevel_merge);
     suite_add_tcase(unit, merge);
 
+    TCase *query = tcase_create("de::InternalLevel::get_local_queries Testing");
+    tcase_add_test(query, t_local_query_pruning);
+    suite_add_tcase(unit, query);
+
     return unit;
 }
 
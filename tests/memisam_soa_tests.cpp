@@ -0,0 +1,130 @@
+/*
+ * tests/memisam_soa_tests.cpp
+ *
+ * Unit tests for ISAM Tree shard, using the SOA record layout
+ *
+ * Copyright (C) 2024 Douglas Rumbaugh <drumbaugh@psu.edu>
+ *
+ * Distributed under the Modified BSD License.
+ *
+ */
+
+#include "shard/ISAMTree.h"
+#include "include/testing.h"
+#include <check.h>
+
+using namespace de;
+
+typedef Rec R;
+typedef ISAMTree<R, RecordLayout::SOA> Shard;
+
+#include "include/shard_standard.h"
+#include "include/rangequery.h"
+#include "include/rangecount.h"
+
+
+START_TEST(t_soa_layout)
+{
+    size_t n = 1000;
+    auto buffer = create_test_mbuffer<R>(n);
+    auto aos = ISAMTree<R>(buffer->get_buffer_view());
+    auto soa = Shard(buffer->get_buffer_view());
+
+    ck_assert_int_eq(soa.get_record_count(), aos.get_record_count());
+
+    auto columns = soa.get_columns();
+    for (size_t i=0; i<soa.get_record_count(); i++) {
+        auto rec = aos.get_record_at(i);
+        ck_assert_int_eq(columns->get_keys()[i], rec->rec.key);
+        ck_assert_int_eq(columns->get_values()[i], rec->rec.value);
+        ck_assert_int_eq(columns->get(i).header, rec->header & 3);
+        ck_assert(columns->get(i).rec == rec->rec);
+    }
+
+    for (size_t i=0; i<1000; i++) {
+        auto key = rand();
+        ck_assert_int_eq(soa.get_lower_bound(key), aos.get_lower_bound(key));
+        ck_assert_int_eq(soa.get_upper_bound(key), aos.get_upper_bound(key));
+    }
+
+    delete buffer;
+}
+END_TEST
+
+
+START_TEST(t_soa_tagged_delete)
+{
+    auto buffer = create_sequential_mbuffer<R>(100, 1000);
+    auto shard = Shard(buffer->get_buffer_view());
+
+    /* delete every other record in [300, 500] through point_lookup */
+    for (uint64_t i=300; i<=500; i+=2) {
+        auto rec = shard.point_lookup({i, (uint32_t) i});
+        ck_assert(rec);
+        ck_assert(!rec->is_deleted());
+        rec->set_delete();
+    }
+
+    for (uint64_t i=300; i<=500; i++) {
+        auto rec = shard.point_lookup({i, (uint32_t) i});
+        ck_assert(rec);
+        ck_assert_int_eq(rec->is_deleted(), i % 2 == 0);
+        ck_assert_int_eq((*rec).is_deleted(), i % 2 == 0);
+    }
+
+    rc::Query<Shard>::Parameters parms = {300, 500};
+    auto local_query = rc::Query<Shard>::local_preproc(&shard, &parms);
+    auto result = rc::Query<Shard>::local_query(&shard, local_query);
+    delete local_query;
+
+    ck_assert_int_eq(result.record_count, 100);
+
+    /* the deleted records should be dropped when the shard is merged */
+    std::vector<Shard*> shards = {&shard};
+    auto merged = Shard(shards);
+    ck_assert_int_eq(merged.get_record_count(), 900 - 101);
+    ck_assert(!merged.point_lookup({300, 300}));
+    ck_assert(merged.point_lookup({301, 301}));
+
+    delete buffer;
+}
+END_TEST
+
+
+Suite *unit_testing()
+{
+    Suite *unit = suite_create("ISAM Tree SOA Shard Unit Testing");
+
+    inject_rangequery_tests(unit);
+    inject_rangecount_tests(unit);
+    inject_shard_tests(unit);
+
+    TCase *layout = tcase_create("de::ISAMTree<SOA> layout Testing");
+    tcase_add_test(layout, t_soa_layout);
+    tcase_add_test(layout, t_soa_tagged_delete);
+    suite_add_tcase(unit, layout);
+
+    return unit;
+}
+
+
+int shard_unit_tests()
+{
+    int failed = 0;
+    Suite *unit = unit_testing();
+    SRunner *unit_shardner = srunner_create(unit);
+
+    srunner_run_all(unit_shardner, CK_NORMAL);
+    failed = srunner_ntests_failed(unit_shardner);
+    srunner_free(unit_shardner);
+
+    return failed;
+}
+
+
+int main()
+{
+    int unit_failed = shard_unit_tests();
+
+    return (unit_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -103,6 +103,142 @@ START_TEST(t_insert)
 END_TEST
 
 
+START_TEST(t_append_batch)
+{
+    auto buffer = new MutableBuffer<Rec>(50, 100);
+
+    std::vector<Rec> records(150);
+    for (size_t i=0; i<records.size(); i++) {
+        records[i] = Rec {i, (uint32_t) i};
+    }
+
+    /* an empty batch should be a no-op */
+    ck_assert_int_eq(buffer->append_batch(records.data(), 0), 0);
+    ck_assert_int_eq(buffer->get_record_count(), 0);
+
+    /* a batch which fits should be entirely appended */
+    ck_assert_int_eq(buffer->append_batch(records.data(), 60), 60);
+    ck_assert_int_eq(buffer->get_record_count(), 60);
+    ck_assert_int_eq(buffer->get_tail(), 60);
+    ck_assert_int_eq(buffer->is_at_low_watermark(), true);
+
+    /* a batch crossing the HWM should be partially appended */
+    ck_assert_int_eq(buffer->append_batch(records.data() + 60, 90), 40);
+    ck_assert_int_eq(buffer->get_record_count(), 100);
+    ck_assert_int_eq(buffer->is_full(), 1);
+
+    /* and further batches should fail */
+    ck_assert_int_eq(buffer->append_batch(records.data() + 100, 50), 0);
+
+    {
+        auto view = buffer->get_buffer_view();
+        ck_assert_int_eq(view.get_record_count(), 100);
+        for (size_t i=0; i<view.get_record_count(); i++) {
+            ck_assert_int_eq(view.get(i)->rec.key, i);
+            ck_assert_int_eq(view.get(i)->is_tombstone(), 0);
+            ck_assert_int_eq(view.get(i)->is_visible(), 1);
+        }
+    }
+
+    ck_assert_int_eq(buffer->get_tombstone_count(), 0);
+
+    delete buffer;
+}
+END_TEST
+
+
+START_TEST(t_append_batch_wraparound)
+{
+    auto buffer = new MutableBuffer<Rec>(50, 100);
+
+    std::vector<Rec> records(200);
+    for (size_t i=0; i<records.size(); i++) {
+        records[i] = Rec {i, (uint32_t) i};
+    }
+
+    /* fill the buffer and advance the head to near the end of the array */
+    ck_assert_int_eq(buffer->append_batch(records.data(), 100), 100);
+    ck_assert_int_eq(buffer->advance_head(100), 1);
+    ck_assert_int_eq(buffer->append_batch(records.data(), 80), 80);
+    ck_assert_int_eq(buffer->advance_head(180), 1);
+
+    /* this batch of tombstones will wrap around the end of the array */
+    ck_assert_int_eq(buffer->append_batch(records.data() + 100, 50, true), 50);
+    ck_assert_int_eq(buffer->get_record_count(), 50);
+    ck_assert_int_eq(buffer->get_tombstone_count(), 50);
+
+    {
+        auto view = buffer->get_buffer_view();
+        ck_assert_int_eq(view.get_record_count(), 50);
+        for (size_t i=0; i<view.get_record_count(); i++) {
+            ck_assert_int_eq(view.get(i)->rec.key, i + 100);
+            ck_assert_int_eq(view.get(i)->is_tombstone(), 1);
+        }
+
+        ck_assert_int_eq(view.check_tombstone(records[120]), 1);
+        ck_assert_int_eq(view.check_tombstone(records[10]), 0);
+    }
+
+    delete buffer;
+}
+END_TEST
+
+
+void insert_batches(std::vector<Rec> *values, size_t start, size_t stop, MutableBuffer<Rec> *buffer)
+{
+    size_t batch_size = 7;
+    for (size_t i=start; i<stop; i+=batch_size) {
+        buffer->append_batch(values->data() + i, std::min(batch_size, stop - i));
+    }
+}
+
+
+START_TEST(t_multithreaded_append_batch)
+{
+    size_t cnt = 10000;
+    auto buffer = new MutableBuffer<Rec>(cnt/2, cnt);
+
+    std::vector<Rec> records(cnt);
+    for (size_t i=0; i<cnt; i++) {
+        records[i] = Rec {i, (uint32_t) i};
+    }
+
+    size_t thread_cnt = 8;
+    size_t per_thread = cnt / thread_cnt;
+    std::vector<std::thread> workers(thread_cnt);
+    size_t start = 0;
+    size_t stop = start + per_thread;
+    for (size_t i=0; i<thread_cnt; i++) {
+        workers[i] = std::thread(insert_batches, &records, start, stop, buffer);
+        start = stop;
+        stop = std::min(start + per_thread, cnt);
+    }
+
+    for (size_t i=0; i<thread_cnt; i++) {
+        if (workers[i].joinable()) {
+            workers[i].join();
+        }
+    }
+
+    ck_assert_int_eq(buffer->is_full(), 1);
+    ck_assert_int_eq(buffer->get_record_count(), cnt);
+
+    /* every record should appear exactly once */
+    {
+        auto view = buffer->get_buffer_view();
+        std::vector<bool> seen(cnt, false);
+        for (size_t i=0; i<view.get_record_count(); i++) {
+            auto key = view.get(i)->rec.key;
+            ck_assert_int_eq(seen[key], false);
+            seen[key] = true;
+        }
+    }
+
+    delete buffer;
+}
+END_TEST
+
+
 START_TEST(t_advance_head) 
 {
     auto buffer = new MutableBuffer<Rec>(50, 100);
@@ -142,12 +278,20 @@ START_TEST(t_advance_head)
         ck_assert_int_eq(view.get_record_count(), cnt);
         ck_assert_int_eq(buffer->get_available_capacity(), 200 - cnt);
 
-        /* refuse to advance head again while there remain references to the old one */
-        ck_assert_int_eq(buffer->advance_head(buffer->get_tail() -1), 0);
+        /* the head can be advanced again while there remain references to the old one */
+        ck_assert_int_eq(buffer->advance_head(buffer->get_tail() -1), 1);
+        ck_assert_int_eq(buffer->get_record_count(), 1);
+        ck_assert_int_eq(buffer->get_available_capacity(), 200 - cnt);
+
+        /* and the old view is unaffected */
+        ck_assert_int_eq(view.get_record_count(), cnt);
+        for (size_t i=0; i<cnt; i++) {
+            ck_assert_int_eq(view.get(i)->rec.key, view_records[i].rec.key);
+        }
     }
 
     /* once the buffer view falls out of scope, the capacity of the buffer should increase */
-    ck_assert_int_eq(buffer->get_available_capacity(), 175);
+    ck_assert_int_eq(buffer->get_available_capacity(), 199);
 
     /* now the head should be able to be advanced */
     ck_assert_int_eq(buffer->advance_head(buffer->get_tail()), 1);
@@ -160,6 +304,52 @@ START_TEST(t_advance_head)
 }
 END_TEST
 
+START_TEST(t_advance_head_pinned_view)
+{
+    auto buffer = new MutableBuffer<Rec>(50, 100);
+
+    std::vector<Rec> records(400);
+    for (size_t i=0; i<records.size(); i++) {
+        records[i] = Rec {i, (uint32_t) i};
+    }
+
+    ck_assert_int_eq(buffer->append_batch(records.data(), 100), 100);
+
+    {
+        auto view = buffer->get_buffer_view();
+
+        /*
+         * inserts should be able to continue through several head
+         * advances, well past the buffer's nominal capacity, without
+         * waiting on the view to be released
+         */
+        for (size_t i=1; i<4; i++) {
+            ck_assert_int_eq(buffer->advance_head(i * 100), 1);
+            ck_assert_int_eq(buffer->append_batch(records.data() + i*100, 100), 100);
+        }
+
+        ck_assert_int_eq(buffer->get_available_capacity(), 0);
+
+        /* the view should still see the original records */
+        ck_assert_int_eq(view.get_record_count(), 100);
+        for (size_t i=0; i<view.get_record_count(); i++) {
+            ck_assert_int_eq(view.get(i)->rec.key, i);
+        }
+
+        auto new_view = buffer->get_buffer_view();
+        ck_assert_int_eq(new_view.get_record_count(), 100);
+        for (size_t i=0; i<new_view.get_record_count(); i++) {
+            ck_assert_int_eq(new_view.get(i)->rec.key, i + 300);
+        }
+    }
+
+    /* releasing the view should free up the space behind the head */
+    ck_assert_int_eq(buffer->get_available_capacity(), 100);
+
+    delete buffer;
+}
+END_TEST
+
 void insert_records(std::vector<Rec> *values, size_t start, size_t stop, MutableBuffer<Rec> *buffer)
 {
     for (size_t i=start; i<stop; i++) {
@@ -386,6 +576,135 @@ START_TEST(t_bview_delete)
 END_TEST
 
 
+START_TEST(t_bview_sorted_runs)
+{
+    auto buffer = new MutableBuffer<Rec>(500, 1000, 0, true);
+    ck_assert_int_eq(buffer->has_sorted_runs(), 1);
+
+    std::vector<Rec> records(1000);
+    for (size_t i=0; i<records.size(); i++) {
+        records[i] = Rec {(uint64_t) rand() % 500, (uint32_t) i};
+    }
+
+    /*
+     * advance the head part-way into a segment, so that the view
+     * begins in the middle of a sorted run
+     */
+    ck_assert_int_eq(buffer->append_batch(records.data(), 700), 700);
+    ck_assert_int_eq(buffer->advance_head(150), 1);
+    for (size_t i=700; i<records.size(); i++) {
+        ck_assert_int_eq(buffer->append(records[i]), 1);
+    }
+
+    {
+        /* runs are only built for views that request them */
+        auto view = buffer->get_buffer_view(true);
+        ck_assert_int_eq(view.get_record_count(), 850);
+
+        /* the sorted copy should contain exactly the records in the view, in order */
+        std::vector<Wrapped<Rec>> sorted(view.get_record_count());
+        view.copy_to_buffer_sorted((psudb::byte *) sorted.data());
+
+        std::vector<Wrapped<Rec>> expected;
+        for (size_t i=0; i<view.get_record_count(); i++) {
+            expected.push_back(*view.get(i));
+        }
+        std::sort(expected.begin(), expected.end());
+
+        for (size_t i=0; i<sorted.size(); i++) {
+            ck_assert(sorted[i].rec == expected[i].rec);
+        }
+
+        /* a range scan should find the same records as a full scan */
+        uint64_t lower = 100, upper = 200;
+        size_t cnt = 0;
+        view.for_each_in_range(lower, upper, [&cnt, lower, upper](Wrapped<Rec> *rec) {
+            ck_assert_int_ge(rec->rec.key, lower);
+            ck_assert_int_le(rec->rec.key, upper);
+            ck_assert_int_ge(rec->rec.value, 150);
+            cnt++;
+            return true;
+        });
+
+        size_t expected_cnt = 0;
+        for (size_t i=150; i<records.size(); i++) {
+            if (records[i].key >= lower && records[i].key <= upper) {
+                expected_cnt++;
+            }
+        }
+
+        ck_assert_int_eq(cnt, expected_cnt);
+    }
+
+    delete buffer;
+}
+END_TEST
+
+
+START_TEST(t_bview_hash_index)
+{
+    auto buffer = new MutableBuffer<Rec>(500, 1000, 0, false, true);
+    ck_assert_int_eq(buffer->has_hash_index(), 1);
+
+    /* every key appears twice, once as a record and once as a tombstone */
+    std::vector<Rec> records(400);
+    for (size_t i=0; i<records.size(); i++) {
+        records[i] = Rec {i, (uint32_t) i};
+    }
+
+    ck_assert_int_eq(buffer->append_batch(records.data(), records.size()), 400);
+    ck_assert_int_eq(buffer->append_batch(records.data(), 200, true), 200);
+
+    /* records behind the head should no longer be found */
+    ck_assert_int_eq(buffer->advance_head(150), 1);
+
+    {
+        auto view = buffer->get_buffer_view();
+
+        size_t cnt = 0;
+        view.for_each_with_key((uint64_t) 160, [&cnt](Wrapped<Rec> *rec) {
+            ck_assert_int_eq(rec->rec.key, 160);
+            cnt++;
+            return true;
+        });
+        ck_assert_int_eq(cnt, 2);
+
+        cnt = 0;
+        view.for_each_with_key((uint64_t) 100, [&cnt](Wrapped<Rec> *rec) {
+            cnt++;
+            return true;
+        });
+        ck_assert_int_eq(cnt, 1);
+
+        ck_assert_int_eq(view.check_tombstone(records[100]), 1);
+        ck_assert_int_eq(view.check_tombstone(records[300]), 0);
+
+        ck_assert_int_eq(view.delete_record(records[300]), 1);
+        ck_assert_int_eq(view.delete_record(Rec {50, 51}), 0);
+        ck_assert_int_eq(view.delete_record(Rec {1000, 1000}), 0);
+
+        for (size_t i=0; i<view.get_record_count(); i++) {
+            auto rec = view.get(i);
+            ck_assert_int_eq(rec->is_deleted(), rec->rec.key == 300);
+        }
+    }
+
+    /* a new view should only see records appended after the head */
+    ck_assert_int_eq(buffer->advance_head(buffer->get_tail()), 1);
+    ck_assert_int_eq(buffer->append(records[5]), 1);
+
+    {
+        auto view = buffer->get_buffer_view();
+        ck_assert_int_eq(view.check_tombstone(records[100]), 0);
+        ck_assert_int_eq(view.delete_record(records[5]), 1);
+        ck_assert_int_eq(view.delete_record(records[6]), 0);
+    }
+
+    delete buffer;
+}
+END_TEST
+
+
 Suite *unit_testing()
 {
     Suite *unit = suite_create("Mutable Buffer Unit Testing");
@@ -398,13 +717,19 @@ Suite *unit_testing()
     TCase *append = tcase_create("de::MutableBuffer::append Testing");
     tcase_add_test(append, t_insert);
     tcase_add_test(append, t_advance_head);
+    tcase_add_test(append, t_advance_head_pinned_view);
     tcase_add_test(append, t_multithreaded_insert);
+    tcase_add_test(append, t_append_batch);
+    tcase_add_test(append, t_append_batch_wraparound);
+    tcase_add_test(append, t_multithreaded_append_batch);
 
     suite_add_tcase(unit, append);
 
     TCase *view = tcase_create("de::BufferView Testing");
     tcase_add_test(view, t_bview_get);
     tcase_add_test(view, t_bview_delete);
+    tcase_add_test(view, t_bview_sorted_runs);
+    tcase_add_test(view, t_bview_hash_index);
 
     suite_add_tcase(unit, view);
 
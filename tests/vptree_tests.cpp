@@ -165,8 +165,14 @@ START_TEST(t_knn_query)
         delete query;
 
         ck_assert_int_eq(results.size(), p.k);
+        if (p.k == 0) {
+            continue;
+        }
 
-        std::sort(results.begin(), results.end());
+        /* the shard stores its records in tree order, so sort by value */
+        std::sort(results.begin(), results.end(), [](auto a, auto b) {
+            return a->rec.data[0] < b->rec.data[0];
+        });
 
         if ((int64_t) (p.point.data[0] - p.k/2 - 1) < 0) {
             ck_assert_int_eq(results[0]->rec.data[0], 0);
@@ -187,6 +193,59 @@ START_TEST(t_knn_query)
 }
 
 
+START_TEST(t_knn_high_dim)
+{
+    /* enough dimensions to exercise both the vector and remainder loops */
+    typedef EuclidPoint<double, 37> HDRec;
+    size_t n = 2000;
+    size_t k = 25;
+
+    auto buffer = new MutableBuffer<HDRec>(n/2, n);
+    gsl_rng *rng = gsl_rng_alloc(gsl_rng_mt19937);
+    for (size_t i=0; i<n; i++) {
+        HDRec r;
+        for (size_t j=0; j<37; j++) {
+            r.data[j] = gsl_rng_uniform(rng);
+        }
+        buffer->append(r);
+    }
+
+    auto vptree = VPTree<HDRec>(buffer->get_buffer_view());
+    ck_assert_int_eq(vptree.get_record_count(), n);
+
+    for (size_t i=0; i<20; i++) {
+        auto point = vptree.get_record_at(gsl_rng_uniform_int(rng, n))->rec;
+
+        double naive = 0;
+        auto other = vptree.get_record_at(0)->rec;
+        for (size_t j=0; j<37; j++) {
+            naive += (point.data[j] - other.data[j]) * (point.data[j] - other.data[j]);
+        }
+        ck_assert(std::abs(point.calc_squared_distance(other) - naive) < 1e-9);
+
+        KNNCandidates<HDRec> candidates(point, k);
+        vptree.search(candidates);
+        auto results = candidates.get_results();
+        ck_assert_int_eq(results.size(), k);
+
+        /* compare against the k smallest distances found by brute force */
+        std::vector<double> dists;
+        for (size_t j=0; j<n; j++) {
+            dists.push_back(point.calc_distance(vptree.get_record_at(j)->rec));
+        }
+        std::sort(dists.begin(), dists.end());
+
+        for (size_t j=0; j<k; j++) {
+            ck_assert(std::abs(point.calc_distance(results[j]->rec) - dists[j]) < 1e-9);
+        }
+    }
+
+    gsl_rng_free(rng);
+    delete buffer;
+}
+END_TEST
+
+
 Suite *unit_testing()
 {
     Suite *unit = suite_create("VPTree Shard Unit Testing");
@@ -207,6 +266,7 @@ Suite *unit_testing()
     TCase *query = tcase_create("de:VPTree::VPTreeQuery Testing");
     tcase_add_test(query, t_buffer_query);
     tcase_add_test(query, t_knn_query);
+    tcase_add_test(query, t_knn_high_dim);
     suite_add_tcase(unit, query);
 
     return unit;